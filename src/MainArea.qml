@@ -54,12 +54,16 @@ Item {
       id:      curr_time
       enabled: player.is_available
 
+      // If we know when the recording was made, we show the time of day of the
+      // current position as well
       text: {
-        if (slider.pressed) {
-          formatSeconds(slider.value)
-        } else {
-          formatSeconds(player.position)
+        var seconds = slider.pressed ? Math.round(slider.value) : player.position
+        var str     = formatSeconds(seconds)
+        if (hasRecordingTime()) {
+          var time = new Date(player.recording_time.getTime() + seconds * 1000)
+          str += " (" + Qt.formatTime(time, "hh:mm:ss") + ")"
         }
+        str
       }
       anchors.left: parent.left
       anchors.top:  parent.top
@@ -71,13 +75,14 @@ Item {
 
       orientation:              Qt.Horizontal
       updateValueWhileDragging: true
-      stepSize:                 1.0
       maximumValue:             player.duration
 
+      // The slider follows the position in ms, so that it moves smoothly
+      // instead of jumping from second to second
       Connections {
         target: player
-        onPositionChanged: {
-          if (!slider.pressed) slider.value = player.position
+        onPositionMsChanged: {
+          if (!slider.pressed) slider.value = player.position_ms / 1000
         }
       }
 
@@ -91,7 +96,36 @@ Item {
         // after programmatic changes (thus to slider updates from the audio
         // player). So we need to check if the slider is actually pressed and
         // released.
-        if (!pressed) main_area.valueChanged(value)
+        if (!pressed) main_area.valueChanged(Math.round(value))
+      }
+    }
+
+    /* The markers in the audio, as ticks below the slider. Clicking one seeks
+       to it, and hovering over it shows its label. */
+    Repeater {
+      model: player.duration > 0 ? player.markers : []
+
+      delegate: Rectangle {
+        x:      slider.x + (modelData.position / player.duration) * slider.width
+        y:      slider.y + slider.height - height
+        width:  3
+        height: slider.height / 3
+        color:  "steelblue"
+
+        MouseArea {
+          id:           marker_area
+          anchors.fill: parent
+          hoverEnabled: true
+          onClicked:    main_area.valueChanged(modelData.position)
+        }
+
+        Text {
+          visible: marker_area.containsMouse && modelData.label !== ""
+          text:    modelData.label
+
+          anchors.top:              parent.bottom
+          anchors.horizontalCenter: parent.horizontalCenter
+        }
       }
     }
 
@@ -286,6 +320,13 @@ Item {
     }
   }
 
+  /** Internal function to check if the loaded audio file tells us when the
+      recording was made. */
+  function hasRecordingTime() {
+    return player.recording_time instanceof Date &&
+           !isNaN(player.recording_time.getTime())
+  }
+
   /** Internal function to convert seconds to h.mm:ss strings. */
   function formatSeconds(seconds) {
     seconds     = parseInt(seconds)
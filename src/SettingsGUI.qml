@@ -109,6 +109,66 @@ Item {
     anchors.rightMargin:    Constants.margin
   }
 
+  Text {
+    id: audio_header_text
+
+    text:               qsTr("Audio output")
+    anchors.left:       parent.left
+    anchors.leftMargin: Constants.margin
+    anchors.top:        type_timeout_slider.bottom
+    anchors.topMargin:  Constants.margin
+  }
+
+  ComboBox {
+    id: latency_profile_box
+
+    model: [qsTr("Low latency"), qsTr("Balanced"), qsTr("Power saver")]
+
+    anchors.left:       parent.left
+    anchors.leftMargin: Constants.margin
+    anchors.top:        audio_header_text.bottom
+  }
+
+  Text {
+    id: latency_text
+
+    // The achieved latency is only known once the audio has been played
+    text: player.output_latency > 0 ?
+            qsTr("Latency: %1 ms, %2 wakeups per second")
+              .arg(player.output_latency)
+              .arg(player.wakeup_rate.toLocaleString(Qt.locale(), "f", 0)) :
+            ""
+
+    textFormat:             Text.PlainText
+    font.pointSize:         font_metrics.font.pointSize * 0.9
+    anchors.verticalCenter: latency_profile_box.verticalCenter
+    anchors.left:           latency_profile_box.right
+    anchors.leftMargin:     Constants.margin
+  }
+
+  Text {
+    id: refresh_rate_text
+
+    text: qsTr("Position updates per second:")
+
+    font.pointSize:         font_metrics.font.pointSize * 0.9
+    anchors.verticalCenter: refresh_rate_box.verticalCenter
+    anchors.left:           parent.left
+    anchors.leftMargin:     Constants.margin
+  }
+
+  SpinBox {
+    id: refresh_rate_box
+
+    minimumValue: player.refresh_rate_min
+    maximumValue: player.refresh_rate_max
+
+    anchors.left:       refresh_rate_text.right
+    anchors.leftMargin: Constants.margin
+    anchors.top:        latency_profile_box.bottom
+    anchors.topMargin:  Constants.margin
+  }
+
   // The button to dismiss the settings GUI
   Button {
     anchors.right:   parent.right
@@ -118,6 +178,8 @@ Item {
     onClicked: {
       typingtimelord.wait_timeout = wait_timeout_slider.value
       typingtimelord.type_timeout = type_timeout_slider.value
+      player.latency_profile      = latency_profile_box.currentIndex
+      player.refresh_rate         = refresh_rate_box.value
       config_window.settingsDone()
     }
   }
@@ -127,6 +189,8 @@ Item {
     if (visible) {
       wait_timeout_slider.value = typingtimelord.wait_timeout
       type_timeout_slider.value = typingtimelord.type_timeout
+      latency_profile_box.currentIndex = player.latency_profile
+      refresh_rate_box.value           = player.refresh_rate
     }
   }
 }
@@ -2,6 +2,7 @@ TEMPLATE = app
 
 QT += qml quick multimedia widgets
 android: QT += androidextras
+android: LIBS += -lmediandk
 CONFIG += c++11
 
 SOURCES += main.cpp \
@@ -10,10 +11,21 @@ SOURCES += main.cpp \
     keycatcher.cpp \
     typingtimelord.cpp \
     sonicbooster.cpp \
+    audiobufferpool.cpp \
     audiodecoder.cpp \
+    decodethread.cpp \
+    flacdecoder.cpp \
+    gainkernel.cpp \
+    pcmreader.cpp \
+    pcmringbuffer.cpp \
+    playbackdevice.cpp \
+    readaheadthread.cpp \
+    rewindcache.cpp \
+    seekindex.cpp \
+    wavheader.cpp \
     historymodel.cpp \
     icontranslationmatrix.cpp
-android: SOURCES += storageperm.cpp
+android: SOURCES += storageperm.cpp mediacodecdecoder.cpp
 
 RESOURCES += qml.qrc
 
@@ -29,10 +41,22 @@ HEADERS += \
     keycatcher.h \
     typingtimelord.h \
     sonicbooster.h \
+    audiobufferpool.h \
     audiodecoder.h \
+    decodethread.h \
+    flacdecoder.h \
+    gainkernel.h \
+    pcmreader.h \
+    pcmringbuffer.h \
+    playbackdevice.h \
+    readaheadthread.h \
+    rewindcache.h \
+    seekindex.h \
+    spscqueue.h \
+    wavheader.h \
     historymodel.h \
     icontranslationmatrix.h
-android: HEADERS += storageperm.h
+android: HEADERS += storageperm.h mediacodecdecoder.h
 
 DISTFILES += \
     README.md \
@@ -0,0 +1,25 @@
+#include "audiobufferpool.h"
+
+void AudioBufferPool::reset(int num_buffers, int buffer_size) {
+  num_buffers   = qMax(0, num_buffers);
+  m_buffer_size = qMax(0, buffer_size);
+  m_memory.resize((size_t)num_buffers * m_buffer_size);
+
+  // The free list never needs to grow beyond this
+  m_free.clear();
+  m_free.reserve(num_buffers);
+  for (int i = num_buffers - 1; i >= 0; i--) {
+    m_free.push_back(m_memory.data() + (size_t)i * m_buffer_size);
+  }
+}
+
+char* AudioBufferPool::acquire() {
+  if (m_free.empty() || m_buffer_size == 0) return NULL;
+  char* buffer = m_free.back();
+  m_free.pop_back();
+  return buffer;
+}
+
+void AudioBufferPool::release(char* buffer) {
+  if (buffer != NULL) m_free.push_back(buffer);
+}
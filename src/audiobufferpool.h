@@ -0,0 +1,41 @@
+#ifndef AUDIOBUFFERPOOL_H
+#define AUDIOBUFFERPOOL_H
+
+#include <QtGlobal>
+
+#include <vector>
+
+/** A fixed number of equally sized buffers for periods of audio data, which
+ *  are allocated once and then handed out and taken back over and over again,
+ *  so that the audio thread doesn't need the heap while playing.
+ *  The pool is sized when the audio format changes. It is not thread safe; it
+ *  is meant to be used by the audio thread only. */
+class AudioBufferPool {
+
+public:
+  /** Make room for num_buffers buffers of buffer_size bytes each. This
+   *  allocates memory if the pool grows, and takes back all buffers. */
+  void reset(int num_buffers, int buffer_size);
+
+  /** The size of each buffer in bytes. */
+  int bufferSize() const {return m_buffer_size;}
+
+  /** The number of buffers that are not handed out. */
+  int numFree() const {return (int)m_free.size();}
+
+  /** Take a buffer of bufferSize() bytes from the pool.
+   *  @return the buffer, or NULL if all buffers are handed out. */
+  char* acquire();
+
+  /** Give a buffer from acquire() back to the pool. */
+  void release(char* buffer);
+
+private:
+  /** The memory of all buffers, and the buffers that are not handed out. */
+  std::vector<char>  m_memory;
+  std::vector<char*> m_free;
+
+  int m_buffer_size = 0;
+};
+
+#endif // AUDIOBUFFERPOOL_H
@@ -1,78 +1,102 @@
 #include "audiodecoder.h"
 
-AudioDecoder::AudioDecoder(QObject* parent) : QMediaPlayer(parent) {
-#if defined(Q_OS_WIN) || defined(Q_OS_ANDROID)
-  m_prefer_native_wav = true;
-#else
-  // Try to set up an audio probe to intercept the raw audio data
-  m_probe = new QAudioProbe(parent);
+AudioDecoder::AudioDecoder(QObject* parent) :
+  QMediaPlayer(parent),
+  m_commands(COMMAND_QUEUE_SIZE) {
+  // The playback device lives in the audio thread, and serves as the context
+  // for everything we run there
+  m_playback = new PlaybackDevice();
+  m_playback->moveToThread(&m_audio_thread);
+  connect(m_playback, SIGNAL(dataNeeded(qint64)),
+          this,       SLOT(handleDataNeeded(qint64)), Qt::DirectConnection);
+  m_audio_thread.start(QThread::TimeCriticalPriority);
+
+#if !defined(Q_OS_WIN) && !defined(Q_OS_ANDROID)
+  // Try to set up an audio probe to intercept the raw audio data of the files
+  // that we leave to the QMediaPlayer
+  m_probe = new QAudioProbe(this);
   if (m_probe->setSource(this)) {
     connect(m_probe, SIGNAL(audioBufferProbed(QAudioBuffer)),
             this,    SLOT(handleBufferProbed(QAudioBuffer)));
     setVolume(0);
   } else {
-    // If we cannot set up a probe, we will play wav files natively.
-    m_probe->deleteLater(); m_probe = NULL;
-    m_prefer_native_wav = true;
+    delete m_probe; m_probe = NULL;
   }
 #endif
+
+  m_clock_timer.start();
+  m_clock_segments.reserve(CLOCK_SEGMENTS_SIZE);
+
+  // We report the position while playing as often as we're asked to
+  m_status_timer.setInterval(notifyInterval());
+  connect(&m_status_timer, SIGNAL(timeout()), this, SLOT(handleStatus()));
+  connect(this,            SIGNAL(notifyIntervalChanged(int)),
+          &m_status_timer, SLOT(setInterval(int)));
 }
 
 AudioDecoder::~AudioDecoder() {
-  if (m_file)      m_file->deleteLater();
-  if (m_audio_out) m_audio_out->deleteLater();
-  if (m_probe)     m_probe->deleteLater();
+  closeFile();
+  runOnAudioThread([this]() {
+    if (m_audio_out) {
+      m_audio_out->stop();
+      delete m_audio_out;
+    }
+  });
+  m_audio_thread.quit();
+  m_audio_thread.wait();
+  delete m_playback;
 }
 
 qint64 AudioDecoder::duration() const {
-  if (m_is_native_wav) {
+  if (m_is_native) {
     return m_duration;
   }
   return QMediaPlayer::duration();
 }
 
 qint64 AudioDecoder::position() const {
-  if (m_is_native_wav) {
-    return m_time;
+  if (m_is_native) {
+    return clockTime();
   }
   return QMediaPlayer::position();
 }
 
 QMediaPlayer::State AudioDecoder::state() const {
-  if (m_is_native_wav) {
+  if (m_is_native) {
     return m_state_when_native;
   }
   return QMediaPlayer::state();
 }
 
 QMediaPlayer::MediaStatus AudioDecoder::mediaStatus() const {
-  if (m_is_native_wav) {
-    if (m_file->pos() == m_file->size()) {
+  if (m_is_native) {
+    if (!m_reader) {
+      return LoadingMedia; // The decoder hasn't produced anything yet
+    }
+    if (atEnd()) {
       return EndOfMedia;
     }
-    return LoadedMedia;  // If the m_is_native_wav flag is set, we have actually
-                         // loaded a file.
+    return LoadedMedia;
   }
   return QMediaPlayer::mediaStatus();
 }
 
 bool AudioDecoder::isAudioAvailable() const {
-  if (m_is_native_wav) return true;
+  if (m_is_native) return m_reader != NULL;
   return QMediaPlayer::isAudioAvailable();
 }
 
 bool AudioDecoder::isIntercepting() {
-  if (m_probe || m_is_native_wav) {
-    return true;
-  }
-  return false;
+  return m_is_native || m_probe != NULL;
+}
+
+bool AudioDecoder::isDecoding() const {
+  return m_decoder && !m_decoder->isDone();
 }
 
 QString AudioDecoder::getMediaPath() {
-  if (m_is_native_wav) {
-    if (m_file) {
-      return QFileInfo(*m_file).absoluteFilePath();
-    }
+  if (m_is_native) {
+    return QFileInfo(m_media_path).absoluteFilePath();
   } else {
     if (!media().isNull()) {
       QUrl url = media().canonicalUrl();
@@ -88,70 +112,87 @@ QString AudioDecoder::getMediaPath() {
 void AudioDecoder::setMedia(const QUrl& path) {
   pause();
 
+  // Reset all persistent data
+  closeFile();
+  m_is_native     = false;
   m_is_native_wav = false;
+  m_media_path    = path.toLocalFile();
+  m_time          = 0;
+  m_duration      = 0;
+  m_data_offset   = 0;
+  m_data_size     = 0;
+  m_data_pos      = 0;
 
-  // Reset the audio device
-  if (m_audio_out) {
-    m_audio_out->deleteLater();
-    m_audio_out = NULL;
-    m_audio_out_device = NULL;
-  }
+  resetOutput();
 
-  // Try to load native wav
-  if (m_prefer_native_wav) {
-    // Reset all persistent data
-    m_time        = 0;
-    m_duration    = 0;
-    m_data_offset = 0;
-    if (m_file) {
-      if (m_file->isOpen()) {
-        m_file->close();
-      }
-      m_file->deleteLater(); m_file = NULL;
-    }
+  if (parseHeader(m_media_path)) {
+    // A wav file that we can read directly
+    m_is_native     = true;
+    m_is_native_wav = true;
+    m_reader = new PcmReader(m_media_path, m_data_offset, m_data_size,
+                             m_header.encoding(), m_use_mmap);
+    m_data_size = m_reader->size();
+    startReading();
 
-    // Open the file
-    m_file = new QFile(path.toLocalFile());
-    if (m_file->open(QIODevice::ReadOnly)) {
-      if (parseHeader()) {
-        m_is_native_wav = true;
-        m_file->seek(m_data_offset);
-        emit positionChanged(0);
-        initAudioOutput(m_format, true);
-        emit durationChanged(m_duration);
-        emit mediaStatusChanged(LoadedMedia);
-      }
-    }
-  }
+    m_last_position = 0;
+    emit positionChanged(0);
+    initAudioOutput(m_format);
+    emit durationChanged(m_duration);
+    emit metaDataChanged();
+    emit mediaStatusChanged(LoadedMedia);
+  } else if (DecodeThread::canDecode(m_media_path)) {
+    // Decode the file in the background. We can start playing as soon as the
+    // format is known.
+    m_is_native = true;
+    m_decoder   = new DecodeThread(m_media_path);
+    connect(m_decoder, SIGNAL(formatKnown(QAudioFormat)),
+            this,      SLOT(handleDecodeFormat(QAudioFormat)));
+    connect(m_decoder, SIGNAL(durationKnown(qint64)),
+            this,      SLOT(handleDecodeDuration(qint64)));
+    connect(m_decoder, SIGNAL(done()),
+            this,      SLOT(handleDecodeDone()));
+    connect(m_decoder, SIGNAL(failed(QString)),
+            this,      SLOT(handleDecodeFailed()));
+    m_decoder->start();
 
-  // Fall back on the QMediaPlayer if we couldn't or didn't want to open the
-  // file natively.
-  if (!m_is_native_wav) {
+    m_last_position = 0;
+    emit positionChanged(0);
+    emit metaDataChanged();
+    emit mediaStatusChanged(LoadingMedia);
+  } else {
+    // Let the QMediaPlayer play the file
     QMediaPlayer::setMedia(path);
   }
 }
 
 void AudioDecoder::pause() {
-  if (m_is_native_wav) {
+  if (m_is_native) {
     m_state_when_native = QMediaPlayer::PausedState;
-    m_audio_out->suspend();
+    if (m_is_attached) sendCommand(Command::Pause);
+    m_status_timer.stop();
+    handleStatus();
+    if (m_wakeup_timer.isValid()) {
+      m_wakeup_time = m_wakeup_timer.elapsed();
+      m_wakeup_timer.invalidate();
+    }
   } else if (isAudioAvailable()) {
     QMediaPlayer::pause();
+    flushProbed();
   }
 }
 
 void AudioDecoder::play() {
-  if (m_is_native_wav) {
-    if (m_audio_out != NULL) {
+  if (m_is_native) {
+    if (m_audio_out_device != NULL) {
       m_state_when_native = QMediaPlayer::PlayingState;
-      if (m_audio_out->state() == QAudio::SuspendedState) {
-        // We're unpausing
-        m_audio_out->resume();
-      } else {
-        // We start the playback by simply checking if we need to write data to
-        // the buffer.
-        checkBuffer();
-      }
+      m_num_wakeups = 0;
+      m_wakeup_timer.start();
+
+      // From now on, the audio thread reads the audio data
+      m_clock_fallback = m_time;
+      m_is_attached    = true;
+      sendCommand(Command::Play);
+      m_status_timer.start();
     }
   } else if (isAudioAvailable()) {
     QMediaPlayer::play();
@@ -159,183 +200,847 @@ void AudioDecoder::play() {
 }
 
 void AudioDecoder::setPosition(qint64 position) {
-  if (m_is_native_wav) {
+  if (m_is_native) {
     if (position > m_duration) { // Cap
       position = m_duration;
+    } else if (position < 0) {
+      position = 0;
     }
 
-    // Set the position in the file to the desired location
-    int file_pos = m_data_offset + m_format.bytesForDuration(position * 1000);
-    m_file->seek(file_pos);
+    // Set the position in the data to the desired location. While decoding, we
+    // may end up beyond what's decoded; the decoder will go there first if it
+    // can, otherwise we'll just have to wait for it.
+    qint64 data_pos;
+    if (position == m_duration && !isDecoding()) {
+      data_pos = dataSize();
+    } else {
+      data_pos = bytesForTime(position);
+    }
 
-    m_time = position;
+    // QAudioDecoder can't skip ahead, so getting far beyond what it has
+    // decoded would take a long time. The QMediaPlayer can go there right
+    // away, so we leave the rest of the file to it.
+    if (isDecoding() && m_decoder->isSequential() &&
+        data_pos > m_decoder->available(0) +
+                   bytesForTime(MAX_UNDECODED_SEEK_TIME)) {
+      leaveToMediaPlayer(position);
+      return;
+    }
+
+    // Until the audio thread knows about it, the clock doesn't count
+    m_clock_generation++;
+    m_clock_fallback = position;
+    m_time           = position;
+    if (m_is_attached) {
+      sendCommand(Command::Seek, data_pos, position);
+    } else {
+      seekData(data_pos, position);
+    }
+    m_last_position = position;
     emit positionChanged(position);
+  } else {
+    QMediaPlayer::setPosition(position);
+    flushProbed();
   }
-  QMediaPlayer::setPosition(position);
+}
+
+void AudioDecoder::seekData(qint64 data_pos, qint64 time) {
+  if (m_rewind.capacity() > 0) {
+    if (isInRewind(data_pos)) {
+      m_rewind_hits++;
+    } else {
+      m_rewind_misses++;
+    }
+  }
+  moveData(data_pos, time);
+}
+
+void AudioDecoder::moveData(qint64 data_pos, qint64 time) {
+  m_data_pos = data_pos;
+  m_time     = time;
+
+  // Whatever the audio output hasn't pulled yet is from the old position
+  m_playback->clear();
+
+  // The audio that's still in the buffer of the audio output doesn't count
+  // for the clock anymore
+  m_clock_segments.clear();
+  addClockSegment(data_pos);
+
+  // If we can replay the audio from memory, the read-ahead thread can just
+  // continue where it was
+  if (!isInRewind(data_pos)) {
+    m_rewind.reset(data_pos);
+    if (m_decoder) {
+      m_decoder->requestPosition(data_pos);
+    }
+    if (m_read_ahead) {
+      m_read_ahead->seek(data_pos);
+    }
+  }
+}
+
+bool AudioDecoder::isInRewind(qint64 data_pos) const {
+  return m_rewind.capacity() > 0 &&
+         data_pos >= m_rewind.startPosition() &&
+         data_pos <= m_rewind.endPosition();
+}
+
+void AudioDecoder::sendCommand(Command::Type type, qint64 data_pos,
+                               qint64 time) {
+  Command command;
+  command.type       = type;
+  command.data_pos   = data_pos;
+  command.time       = time;
+  command.generation = m_clock_generation;
+  command.stamp      = m_clock_timer.nsecsElapsed();
+  if (!m_commands.push(command)) {
+    qWarning() << "The audio thread doesn't keep up with its commands";
+    return;
+  }
+
+  // The audio thread handles the queue whenever the audio output wakes it up,
+  // but it may not be doing that right now
+  QTimer::singleShot(0, m_playback, [this]() {processCommands();});
+}
+
+void AudioDecoder::processCommands() {
+  Command command;
+  while (m_commands.pop(command)) {
+    m_audio_generation = command.generation;
+    switch (command.type) {
+      case Command::Play:
+        m_is_playing = true;
+        if (!m_audio_out) break;
+        if (m_audio_out->state() == QAudio::SuspendedState) {
+          // We're unpausing
+          m_audio_out->resume();
+        } else if (m_is_pulling) {
+          // Once started, the audio output asks for data by itself
+          if (m_audio_out->state() == QAudio::StoppedState) {
+            startOutput();
+          }
+        } else {
+          // The audio output is stopped after a pause
+          if (m_audio_out->state() == QAudio::StoppedState) {
+            startOutput();
+          }
+
+          // We start the playback by simply checking if we need to write data
+          // to the buffer.
+          checkBuffer();
+        }
+        break;
+      case Command::Pause:
+        m_is_playing = false;
+        if (m_audio_out) flushOutput();
+        m_pause_latency = (m_clock_timer.nsecsElapsed() - command.stamp) / 1000;
+        break;
+      case Command::Seek:
+        seekData(command.data_pos, command.time);
+        break;
+    }
+    updateClock();
+  }
+}
+
+qint64 AudioDecoder::outputPosition() const {
+  if (m_is_pulling) return m_playback->writePosition() - m_output_start;
+  return m_num_pushed;
+}
+
+void AudioDecoder::addClockSegment(qint64 data_pos) {
+  qint64 output_pos = outputPosition();
+  if (!m_clock_segments.empty()) {
+    const ClockSegment& last = m_clock_segments.back();
+    if (last.data_pos + (output_pos - last.output_pos) == data_pos) {
+      return; // We just continue the last segment
+    }
+    if (m_clock_segments.size() >= CLOCK_SEGMENTS_SIZE) {
+      m_clock_segments.erase(m_clock_segments.begin());
+    }
+  }
+  ClockSegment segment;
+  segment.output_pos = output_pos;
+  segment.data_pos   = data_pos;
+  m_clock_segments.push_back(segment);
+}
+
+void AudioDecoder::flushOutput() {
+  // Whatever the audio output still has in its buffer, we play again later
+  bool   is_started;
+  qint64 data_pos = audiblePosition(is_started);
+  m_audio_out->reset();
+
+  // Not every backend stops the audio output on a reset, but the next play
+  // command needs it stopped to start a new session. With its buffer empty,
+  // this doesn't wait for anything.
+  if (m_audio_out->state() != QAudio::StoppedState) m_audio_out->stop();
+
+  // The next audio output session starts from scratch. Going back to what
+  // was audible isn't a seek of the user, so it doesn't count for the rewind
+  // cache.
+  m_playback->clear();
+  m_output_start = m_playback->writePosition();
+  m_num_pushed   = 0;
+  moveData(data_pos, timeForBytes(data_pos));
+}
+
+qint64 AudioDecoder::audiblePosition(bool& is_started) {
+  // The audio output has taken processedUSecs() worth of audio from us, of
+  // which the part in its buffer isn't audible yet. Once stopped, it starts
+  // from scratch.
+  qint64 audible = 0;
+  if (m_audio_out->state() != QAudio::StoppedState) {
+    qint64 processed = m_audio_out->processedUSecs() * m_format.sampleRate() /
+                       1000000 * m_format.bytesPerFrame();
+    qint64 in_buffer = m_audio_out->bufferSize() - m_audio_out->bytesFree();
+    audible = qMax((qint64)0, processed - qMax((qint64)0, in_buffer));
+    audible -= audible % m_format.bytesPerFrame();
+  }
+
+  // Find the audio data that belongs to it. Older segments have been played
+  // completely, so we can forget them.
+  while (m_clock_segments.size() > 1 &&
+         m_clock_segments[1].output_pos <= audible) {
+    m_clock_segments.erase(m_clock_segments.begin());
+  }
+  const ClockSegment& segment = m_clock_segments.front();
+  is_started = audible >= segment.output_pos;
+  return segment.data_pos + qMax((qint64)0, audible - segment.output_pos);
+}
+
+void AudioDecoder::updateClock() {
+  if (!m_audio_out || m_clock_segments.empty() ||
+      m_format.bytesPerFrame() <= 0) {
+    return;
+  }
+
+  bool   is_started;
+  qint64 data_pos   = audiblePosition(is_started);
+  qint64 num_frames = data_pos / m_format.bytesPerFrame();
+  qint64 time       = num_frames * 1000000 / m_format.sampleRate();
+  bool   is_running = m_is_playing && is_started &&
+                      m_audio_out->state() == QAudio::ActiveState;
+
+  // Publish the new reference point. Readers retry if the sequence number is
+  // odd or has changed while they were reading.
+  quint32 sequence = m_clock_sequence.load(std::memory_order_relaxed);
+  m_clock_sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  m_clock_time.store(time, std::memory_order_relaxed);
+  m_clock_stamp.store(m_clock_timer.nsecsElapsed(), std::memory_order_relaxed);
+  m_clock_is_running.store(is_running, std::memory_order_relaxed);
+  m_clock_valid_for.store(m_audio_generation, std::memory_order_relaxed);
+  m_clock_sequence.store(sequence + 2, std::memory_order_release);
+}
+
+qint64 AudioDecoder::clockTime() const {
+  quint32 sequence;
+  qint64  time, stamp;
+  bool    is_running;
+  int     valid_for;
+  do {
+    sequence   = m_clock_sequence.load(std::memory_order_acquire);
+    time       = m_clock_time.load(std::memory_order_relaxed);
+    stamp      = m_clock_stamp.load(std::memory_order_relaxed);
+    is_running = m_clock_is_running.load(std::memory_order_relaxed);
+    valid_for  = m_clock_valid_for.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((sequence & 1) ||
+           sequence != m_clock_sequence.load(std::memory_order_relaxed));
+
+  // If the audio thread hasn't caught up with a seek yet, we take the position
+  // we're heading for. If the audio isn't played by it, the read position is
+  // all we've got.
+  if (valid_for != m_clock_generation || sequence == 0) {
+    return m_is_attached ? m_clock_fallback.load() : m_time.load();
+  }
+
+  // Move along with the audio since the last reference point, but never
+  // beyond what's actually been handed out
+  if (is_running) {
+    time += (m_clock_timer.nsecsElapsed() - stamp) / 1000;
+  }
+  return qMin(time / 1000, m_time.load());
+}
+
+void AudioDecoder::handleStatus() {
+  bool has_position = m_has_moved.exchange(false);
+  if (m_has_ended.exchange(false) &&
+      m_state_when_native == QMediaPlayer::PlayingState) {
+    m_state_when_native = QMediaPlayer::StoppedState;
+    m_status_timer.stop();
+    m_last_position = m_time;
+    emit positionChanged(m_time);
+    emit mediaStatusChanged(EndOfMedia);
+    has_position = false;
+  }
+
+  // We only need to report the latest position, and only if it moved
+  if (has_position) {
+    qint64 pos = position();
+    if (pos != m_last_position) {
+      m_last_position = pos;
+      emit positionChanged(pos);
+    }
+  }
+}
+
+void AudioDecoder::detachAudio() {
+  if (!m_is_attached) return;
+
+  // Let the audio thread finish its commands, and make sure that the audio
+  // output won't ask for data anymore
+  runOnAudioThread([this]() {
+    processCommands();
+    m_is_playing = false;
+    if (m_audio_out && m_audio_out->state() != QAudio::StoppedState) {
+      m_audio_out->suspend();
+    }
+  });
+  m_is_attached = false;
+
+  // The clock is of no use to whoever reads the audio data now
+  m_clock_generation++;
+}
+
+void AudioDecoder::runOnAudioThread(const std::function<void()>& function) {
+  QSemaphore done;
+  QTimer::singleShot(0, m_playback, [&function, &done]() {
+    function();
+    done.release();
+  });
+  done.acquire();
 }
 
 void AudioDecoder::checkBuffer() {
-  if (m_audio_out != NULL && m_state_when_native == QMediaPlayer::PlayingState) {
+  if (m_audio_out != NULL && m_is_playing) {
+    m_num_wakeups++;
+    processCommands();
+    updateClock();
 
-    while (m_audio_out->bytesFree() >= m_audio_out->periodSize()) {
+    while (m_is_playing &&
+           m_audio_out->bytesFree() >= m_audio_out->periodSize()) {
       // We can append data to the buffer, so send some new data
-      QByteArray data = m_file->read(m_audio_out->periodSize());
-      if (data.length() > 0) {
-        QAudioBuffer buffer(data, m_format, m_time);
-        m_time += (m_format.durationForBytes(data.length()) / 1000);
-        emit bufferReady(buffer);
-        emit positionChanged(m_time); // TODO: Fire less often
-      }
-      if (data.length() < m_audio_out->periodSize()) {
-        emit mediaStatusChanged(EndOfMedia);
-        m_state_when_native = QMediaPlayer::StoppedState;
+      qint64 num_sent = sendBuffer(m_audio_out->periodSize());
+      if (num_sent < 0) break;
+      if (num_sent == 0) {
+        // The read-ahead thread or the decoder hasn't caught up with us. We
+        // can't count on the notify() signal if the output runs dry, so try
+        // again shortly.
+        QTimer::singleShot(STALL_RETRY_TIME, m_playback,
+                           [this]() {checkBuffer();});
         break;
       }
     }
   }
 }
 
-void AudioDecoder::handleBufferProbed(const QAudioBuffer& buffer) {
-  // There is no other way to get the audio format using QAudioProbe than to
-  // wait for a buffer. The first time we get it, we can open the QAudioDevice.
-  if (m_audio_out == NULL) {
-    initAudioOutput(buffer.format(), false);
+void AudioDecoder::handleDataNeeded(qint64 num_bytes) {
+  processCommands();
+  if (!m_is_playing) return;
+  m_num_wakeups++;
+  updateClock();
+
+  // If the data isn't there yet, the audio output gets less than it asked for
+  // and will ask again soon enough
+  qint64 num_sent = 0;
+  while (num_bytes - num_sent >= m_format.bytesPerFrame()) {
+    qint64 num_bytes_sent = sendBuffer(
+          (int)qMin(num_bytes - num_sent,
+                    (qint64)std::numeric_limits<int>::max()));
+    if (num_bytes_sent <= 0) break;
+    num_sent += num_bytes_sent;
   }
-  emit bufferReady(buffer);
 }
 
-void AudioDecoder::initAudioOutput(const QAudioFormat& format,
-                                   bool connect_notify) {
-  if (m_audio_out) {
-    m_audio_out->deleteLater();
-  }
-  m_audio_out = new QAudioOutput(format);
-  m_audio_out_device = m_audio_out->start();
+qint64 AudioDecoder::sendBuffer(int max_bytes) {
+  // Read a period of audio into memory from the pool
+  char* data = m_pool.acquire();
+  if (data == NULL) return 0;
+  qint64 data_pos   = m_data_pos;
+  qint64 start_time = m_time;
+  qint64 num_read   = read(data, qMin(max_bytes, m_pool.bufferSize()));
+  if (num_read > 0) {
+    addClockSegment(data_pos);
 
-  if (connect_notify) {
-    // We need to check and fill the buffer a bit faster than we send data to it
-    // to make sure it is kept full. Therefore, we connect to the notify() signal
-    // and set the interval time to half that of the amount of time we sent with
-    // each buffer.
-    // We specifically ask for a QueuedConnection because we don't want checkBuffer()
-    // to be called when it is still running.
-    connect(m_audio_out, SIGNAL(notify()),
-            this,        SLOT(checkBuffer()), Qt::QueuedConnection);
-    m_audio_out->setNotifyInterval(
-            m_format.durationForBytes(m_audio_out->periodSize()) / 20000); // us->ms
+    // The handlers are done with the buffer once the signal returns, so it
+    // can just point to our memory. Only the observers get it; they go first,
+    // so that they see the audio before the sink modifies it.
+    static const QMetaMethod buffer_ready =
+      QMetaMethod::fromSignal(&AudioDecoder::bufferReady);
+    if (isSignalConnected(buffer_ready)) {
+      emit bufferReady(QAudioBuffer(QByteArray::fromRawData(data,
+                                                            (int)num_read),
+                                    m_format, start_time));
+    }
+    Sink* sink = m_sink;
+    if (sink) sink->processAudio(data, (int)num_read, m_format);
+    if (!m_is_pulling) m_num_pushed += num_read;
+    m_has_moved = true;
+  }
+  m_pool.release(data);
+  if (atEnd()) {
+    // Let the GUI thread know right away, instead of on its next check
+    m_is_playing = false;
+    m_has_ended  = true;
+    QMetaObject::invokeMethod(this, "handleStatus", Qt::QueuedConnection);
+    return -1;
   }
+  return qMax((qint64)0, num_read);
 }
 
-bool AudioDecoder::parseHeader() {
-  m_file->seek(0);
-  m_data_offset = 0;
+qreal AudioDecoder::wakeupRate() const {
+  qint64 time = m_wakeup_timer.isValid() ? m_wakeup_timer.elapsed() :
+                                           m_wakeup_time;
+  if (time <= 0) return 0.0;
+  return (m_num_wakeups * 1000.0) / time;
+}
 
-  QByteArray bytes;
+void AudioDecoder::setLatencyProfile(LatencyProfile profile) {
+  if (profile == m_latency_profile) return;
+  m_latency_profile = profile;
 
-  bytes = m_file->read(4);
-  if (bytes.length() != 4) return false;
-  if (bytes == RIFF) { // WAV file
-    m_format.setByteOrder(QAudioFormat::LittleEndian);
-  } else {
-    // Not an actual wave file
-    return false;
+  // Set up the audio output again, and continue where we were
+  if (m_is_native && m_audio_out_device != NULL &&
+      m_state_when_native != QMediaPlayer::PlayingState) {
+    qint64 time = m_time;
+    initAudioOutput(m_format);
+    setPosition(time);
   }
+}
+
+qint64 AudioDecoder::outputLatency() const {
+  return timeForBytes(m_buffer_size);
+}
 
-  // Sanity check for the lenght of the file
-  qint32 remainder = readNumber<qint32>();
-  if (m_file->size() != remainder + 8) {
-    return false;
+void AudioDecoder::profileTimes(LatencyProfile profile, int& buffer_time,
+                                int& notify_interval) {
+  switch (profile) {
+    case LowLatency:
+      buffer_time     = 40;
+      notify_interval = 10;
+      break;
+    case Balanced:
+      buffer_time     = 200;
+      notify_interval = 50;
+      break;
+    case PowerSaver:
+      buffer_time     = 1000;
+      notify_interval = 250;
+      break;
   }
+}
 
-  // Last part of the signature
-  bytes = m_file->read(4);
-  if (bytes.length() != 4) return false;
-  if (bytes != WAVE) return false;
+QAudioBuffer AudioDecoder::readBuffer(int max_bytes) {
+  if (!m_reader || max_bytes < m_format.bytesPerFrame()) return QAudioBuffer();
 
-  if (findSubChunk(FMT)) {
-    m_file->seek(m_file->pos() + 4);
+  qint64     start_time = m_time;
+  QByteArray data(max_bytes - max_bytes % m_format.bytesPerFrame(),
+                  Qt::Uninitialized);
+  qint64 num_read = read(data.data(), data.size());
+  if (num_read <= 0) return QAudioBuffer();
+  data.resize((int)num_read);
+  return QAudioBuffer(data, m_format, start_time);
+}
 
-    if (readNumber<qint32>() != 16) {
-      // No PCM data
-      return false;
-    } else {
-      m_format.setCodec("audio/pcm");
+qint64 AudioDecoder::read(char* data, qint64 max_bytes) {
+  if (!m_reader) return 0;
+
+  // Audio that was played recently comes straight from memory
+  if (m_rewind.contains(m_data_pos)) {
+    qint64 num_bytes = qMin(max_bytes, m_rewind.endPosition() - m_data_pos);
+    num_bytes -= num_bytes % m_format.bytesPerFrame();
+    if (num_bytes > 0) {
+      m_rewind.read(m_data_pos, data, num_bytes);
+      m_data_pos += num_bytes;
+      m_time      = timeForBytes(m_data_pos);
+      return num_bytes;
     }
-    if (readNumber<qint16>() != 1) return false; // Compressed
+  }
 
-    qint16 num_channels = readNumber<qint16>();
-    if (num_channels == -1) {
-      return false;
-    } else {
-      m_format.setChannelCount(num_channels);
+  // Only hand out whole frames, and never read beyond the data chunk (there
+  // might be other chunks trailing it) or what's decoded so far.
+  qint64 num_bytes = qMin(max_bytes, dataSize() - m_data_pos);
+  if (m_read_ahead) {
+    // Only take what's already there
+    num_bytes = qMin(num_bytes, (qint64)m_read_ahead->bytesAvailable());
+  } else if (isDecoding()) {
+    num_bytes = qMin(num_bytes, m_reader->available(m_data_pos));
+  }
+  num_bytes -= num_bytes % m_format.bytesPerFrame();
+  if (num_bytes <= 0) {
+    if (m_read_ahead && !atEnd()) {
+      if (!isDecoding() && m_data_pos >= m_read_ahead->endPosition()) {
+        // The thread couldn't read any further, so this is the end
+        m_data_size = m_data_pos;
+      } else {
+        m_read_ahead->registerStall();
+      }
     }
+    return 0;
+  }
 
-    qint32 sample_rate = readNumber<qint32>();
-    if (sample_rate == -1) {
-      return false;
-    } else {
-      m_format.setSampleRate(sample_rate);
+  // Read the data straight into the caller's memory, so that this is the only
+  // copy we make.
+  qint64 num_read;
+  if (m_read_ahead) {
+    num_read = m_read_ahead->read(data, num_bytes);
+  } else {
+    num_read = m_reader->read(m_data_pos, data, num_bytes);
+    if (num_read < num_bytes) {
+      // The file is shorter than it claims to be. Take what we got and make
+      // this the end of the data.
+      num_read    = qMax((qint64)0, num_read);
+      num_read   -= num_read % m_format.bytesPerFrame();
+      m_data_size = m_data_pos + num_read;
+      if (num_read == 0) return 0;
     }
+  }
 
-    m_file->seek(m_file->pos() + 6); // These bytes aren't that interesting,
-                                     // they are products of the other
-                                     // parameters.
-    qint16 bits_per_sample = readNumber<qint16>();
-    if (bits_per_sample == -1) {
-      return false;
+  // Keep it around for when the user skips back
+  m_rewind.append(m_data_pos, data, num_read);
+
+  // Derive the time from the position, so that rounding errors don't add up
+  m_data_pos += num_read;
+  m_time      = timeForBytes(m_data_pos);
+  return num_read;
+}
+
+QVector<AudioDecoder::Marker> AudioDecoder::markers() const {
+  QVector<Marker> markers;
+  if (m_is_native_wav) {
+    for (const WavHeader::CuePoint& cue_point : m_header.cuePoints()) {
+      Marker marker;
+      marker.position = (cue_point.frame * 1000) / m_header.sampleRate();
+      marker.label    = cue_point.label;
+      markers.append(marker);
+    }
+  }
+  return markers;
+}
+
+QDateTime AudioDecoder::recordingTime() const {
+  if (m_is_native_wav) return m_header.originationTime();
+  return QDateTime();
+}
+
+qreal AudioDecoder::readAheadFillLevel() const {
+  if (m_read_ahead) return m_read_ahead->fillLevel();
+  return 0.0;
+}
+
+int AudioDecoder::readAheadStalls() const {
+  if (m_read_ahead) return m_read_ahead->numStalls();
+  return 0;
+}
+
+void AudioDecoder::handleDecodeFormat(const QAudioFormat& format) {
+  // Signals from the decoder of a previous file might still be underway
+  if (sender() != m_decoder) return;
+
+  PcmReader::Encoding encoding;
+  if (!PcmReader::encodingForFormat(format, encoding)) return;
+  setFormat(format.channelCount(), format.sampleRate(), encoding);
+
+  // The size of the data isn't known until the decoder is done
+  m_data_size = std::numeric_limits<qint64>::max();
+  m_reader = new PcmReader(m_decoder->cachePath(), 0, 0, encoding, false);
+  m_reader->setSource(m_decoder);
+  startReading();
+
+  initAudioOutput(m_format);
+  emit durationChanged(m_duration);
+  emit audioAvailableChanged(true);
+  emit mediaStatusChanged(LoadedMedia);
+}
+
+void AudioDecoder::handleDecodeDuration(qint64 duration) {
+  if (sender() == m_decoder && isDecoding()) {
+    m_duration = duration;
+    emit durationChanged(m_duration);
+  }
+}
+
+void AudioDecoder::handleDecodeDone() {
+  if (sender() != m_decoder) return;
+  if (!m_reader) {
+    // The decoder didn't find any audio
+    handleDecodeFailed();
+    return;
+  }
+
+  // Now we know exactly how much audio there is
+  m_data_size = m_reader->size();
+  m_duration  = timeForBytes(m_data_size);
+  if (m_time > m_duration) {
+    setPosition(m_duration);
+  }
+  emit durationChanged(m_duration);
+}
+
+void AudioDecoder::handleDecodeFailed() {
+  if (sender() != m_decoder) return;
+
+  // If the file is too long to decode, we may have played part of it already
+  leaveToMediaPlayer(m_reader ? position() : 0);
+}
+
+void AudioDecoder::initAudioOutput(const QAudioFormat& format) {
+  detachAudio();
+  m_is_pulling = m_use_pull;
+
+  // The audio output is created in the audio thread, so that it does all of
+  // its work there
+  int buffer_time, notify_interval;
+  profileTimes(m_latency_profile, buffer_time, notify_interval);
+
+  runOnAudioThread([this, format, buffer_time, notify_interval]() {
+    bool is_reused = m_audio_out != NULL &&
+                     m_audio_out->format() == format &&
+                     m_output_is_pulling == m_is_pulling &&
+                     m_output_buffer_time == buffer_time;
+    if (is_reused) {
+      // Opening an audio device can be slow, so we only stop the one we've
+      // got
+      if (m_audio_out->state() != QAudio::StoppedState) m_audio_out->reset();
     } else {
-      m_format.setSampleSize(bits_per_sample);
-      if (bits_per_sample == 8) {
-        m_format.setSampleType(QAudioFormat::UnSignedInt);
-      } else if (bits_per_sample == 16) {
-        m_format.setSampleType(QAudioFormat::SignedInt);
-      } else {
-        return false;
+      if (m_audio_out) {
+        m_audio_out->stop();
+        delete m_audio_out;
       }
+      QElapsedTimer timer;
+      timer.start();
+      m_audio_out = new QAudioOutput(format);
+      m_audio_out->setBufferSize(format.bytesForDuration(buffer_time * 1000));
+      m_create_time        = timer.nsecsElapsed() / 1000;
+      m_output_is_pulling  = m_is_pulling;
+      m_output_buffer_time = buffer_time;
+      m_num_outputs_created++;
     }
+    m_buffer_size = 0;
+    m_playback->clear();
 
-    // Now find the data chunk and set the file position to it
-    if (findSubChunk(DATA)) {
-      m_data_offset = m_file->pos() + 8;
+    // Allocate the memory for playback up front: the periods we read, and
+    // what waits in m_playback for the audio output, which is at most its
+    // own buffer plus the period that we write in one go.
+    int period_size = format.bytesForDuration(POOL_BUFFER_TIME * 1000);
+    m_pool.reset(NUM_POOL_BUFFERS, period_size);
+    m_playback->reserve(format.bytesForDuration(buffer_time * 1000) +
+                        period_size);
+    Sink* sink = m_sink;
+    if (sink) sink->prepare(format);
 
-      // Calculate the length of the file
-      m_file->seek(m_data_offset - 4);
-      qint64 num_bytes = (qint64)readNumber<qint32>();
-      m_duration = (num_bytes * 1000) / (num_channels * sample_rate * (bits_per_sample / 8));
-      return true;
+    // The clock counts from the start of this audio output
+    m_output_start = m_playback->writePosition();
+    m_num_pushed   = 0;
+    m_clock_segments.clear();
+    addClockSegment(m_data_pos);
+
+    if (m_is_pulling) {
+      // The audio output reads from m_playback by itself once it is started,
+      // and we fill it on demand in handleDataNeeded().
+      m_audio_out_device = m_playback;
+    } else {
+      startOutput();
+
+      // We need to check and fill the buffer well within the time it takes to
+      // play it, so that it is kept full. Therefore, we connect to the
+      // notify() signal and set the interval time from the profile.
+      // We specifically ask for a QueuedConnection because we don't want
+      // checkBuffer() to be called when it is still running.
+      if (!is_reused) {
+        connect(m_audio_out, &QAudioOutput::notify,
+                m_playback,  [this]() {checkBuffer();}, Qt::QueuedConnection);
+        m_audio_out->setNotifyInterval(notify_interval);
+      }
     }
+  });
+}
+
+void AudioDecoder::startOutput() {
+  QElapsedTimer timer;
+  timer.start();
+  if (m_is_pulling) {
+    m_audio_out->start(m_playback);
+  } else {
+    m_audio_out_device = m_audio_out->start();
   }
-  return false;
+  m_buffer_size = m_audio_out->bufferSize();
+
+  // The time it took to create the output only counts for its first start
+  m_open_latency = m_create_time + timer.nsecsElapsed() / 1000;
+  m_create_time  = 0;
 }
 
-bool AudioDecoder::findSubChunk(const QString identifier) {
-  // Read the identifier of the current chunk
-  QByteArray bytes = m_file->read(4);
-  if (bytes.length() != 4) return false;
+void AudioDecoder::setFormat(int num_channels, int sample_rate,
+                             PcmReader::Encoding encoding) {
+  m_format.setByteOrder(QAudioFormat::LittleEndian);
+  m_format.setCodec("audio/pcm");
+  m_format.setChannelCount(num_channels);
+  m_format.setSampleRate(sample_rate);
 
-  while (bytes != identifier) {
-    // Seek to the next subchunk and read its signature, or return false if
-    // we're at the end
-    qint32 remainder = readNumber<qint32>();
-    if (remainder == -1) return false;
-    m_file->seek(m_file->pos() + remainder);
-    bytes = m_file->read(4);
-    if (bytes.length() != 4) return false;
+  // Everything but 8 bit data is handed out as 16 bit data
+  if (encoding == PcmReader::UnsignedInt8) {
+    m_format.setSampleSize(8);
+    m_format.setSampleType(QAudioFormat::UnSignedInt);
+  } else {
+    m_format.setSampleSize(16);
+    m_format.setSampleType(QAudioFormat::SignedInt);
   }
+}
+
+void AudioDecoder::startReading() {
+  m_rewind.setCapacity((int)qMin(bytesForTime(m_rewind_time),
+                                 (qint64)std::numeric_limits<int>::max()));
+  m_rewind.reset(0);
+  m_rewind_hits   = 0;
+  m_rewind_misses = 0;
+
+  if (m_read_ahead_time > 0) {
+    m_read_ahead = new ReadAheadThread(
+          m_reader,
+          m_format.bytesForDuration((qint64)m_read_ahead_time * 1000),
+          m_format.bytesForDuration(READ_AHEAD_CHUNK_TIME * 1000));
+    m_read_ahead->start();
+  }
+}
 
-  // If the identifier matches, rewind 4 bytes and report success
-  m_file->seek(m_file->pos() - 4);
+bool AudioDecoder::parseHeader(const QString& path) {
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly)) return false;
+  if (!m_header.parse(&file)) return false;
+
+  setFormat(m_header.channelCount(), m_header.sampleRate(),
+            m_header.encoding());
+
+  m_data_offset = m_header.dataOffset();
+  m_data_size   = m_header.dataSize();
+  m_duration    = (m_data_size * 1000) /
+                  (m_header.sampleRate() * m_header.bytesPerFrame());
   return true;
 }
 
-template <typename word>
-word AudioDecoder::readNumber() {
-  QByteArray bytes = m_file->read(sizeof(word));
-  if (bytes.length() != sizeof(word)) {
-    return -1;
+qint64 AudioDecoder::bytesForTime(qint64 ms) const {
+  qint64 num_frames = (ms * m_format.sampleRate()) / 1000;
+  return num_frames * m_format.bytesPerFrame();
+}
+
+qint64 AudioDecoder::timeForBytes(qint64 num_bytes) const {
+  qint64 num_frames = num_bytes / m_format.bytesPerFrame();
+  return (num_frames * 1000) / m_format.sampleRate();
+}
+
+qint64 AudioDecoder::dataSize() const {
+  if (m_reader) return qMin(m_data_size.load(), m_reader->size());
+  return 0;
+}
+
+bool AudioDecoder::atEnd() const {
+  return !isDecoding() && m_data_pos >= dataSize();
+}
+
+void AudioDecoder::closeFile() {
+  detachAudio();
+
+  // Stop the threads before pulling the reader and the cache file from under
+  // them
+  if (m_read_ahead) {
+    m_read_ahead->stop();
+    delete m_read_ahead; m_read_ahead = NULL;
   }
+  if (m_reader) {
+    delete m_reader; m_reader = NULL;
+  }
+  if (m_decoder) {
+    m_decoder->stop();
+    delete m_decoder; m_decoder = NULL;
+  }
+}
+
+void AudioDecoder::resetOutput() {
+  runOnAudioThread([this]() {
+    if (m_audio_out && m_audio_out->state() != QAudio::StoppedState) {
+      m_audio_out->reset();
+    }
+    m_audio_out_device = NULL;
+  });
+  m_buffer_size = 0;
+}
 
-  const word* interpreted = reinterpret_cast<const word*>(bytes.constData());
-  return qFromLittleEndian(interpreted[0]);
+void AudioDecoder::leaveToMediaPlayer(qint64 position) {
+  bool is_playing = m_state_when_native == QMediaPlayer::PlayingState;
+  pause();
+  closeFile();
+  resetOutput();
+  m_is_native         = false;
+  m_state_when_native = QMediaPlayer::StoppedState;
+
+  // The QMediaPlayer holds on to the position until the file is loaded
+  QMediaPlayer::setMedia(QUrl::fromLocalFile(m_media_path));
+  QMediaPlayer::setPosition(position);
+  if (is_playing) QMediaPlayer::play();
+
+  // Without a probe, the audio can't be boosted anymore, and the user should
+  // know
+  if (!isIntercepting()) emit interceptingChanged(false);
 }
 
+void AudioDecoder::handleBufferProbed(const QAudioBuffer& buffer) {
+  if (m_is_native || !buffer.isValid()) return;
+
+  // There is no other way to get the audio format using QAudioProbe than to
+  // wait for a buffer. The first time we get it, we set up the audio output.
+  if (m_audio_out_device == NULL || buffer.format() != m_format) {
+    m_format = buffer.format();
+    initAudioOutput(m_format);
+  }
+  QTimer::singleShot(0, m_playback, [this, buffer]() {playProbed(buffer);});
+}
+
+void AudioDecoder::playProbed(const QAudioBuffer& buffer) {
+  // The buffer may have been underway while another file was loaded
+  if (!m_audio_out || m_is_playing ||
+      buffer.format() != m_audio_out->format()) {
+    return;
+  }
+  if (m_audio_out->state() == QAudio::StoppedState) startOutput();
+
+  // The probe only lends us the data, so we copy it into memory of our own
+  // that the sink may modify
+  const char* data      = (const char*)buffer.constData();
+  int         num_bytes = buffer.byteCount();
+  while (num_bytes > 0) {
+    char* period = m_pool.acquire();
+    if (period == NULL) return;
+    int size = qMin(num_bytes, m_pool.bufferSize());
+    memcpy(period, data, size);
+
+    static const QMetaMethod buffer_ready =
+      QMetaMethod::fromSignal(&AudioDecoder::bufferReady);
+    if (isSignalConnected(buffer_ready)) {
+      emit bufferReady(QAudioBuffer(QByteArray::fromRawData(period, size),
+                                    buffer.format(), buffer.startTime()));
+    }
+    Sink* sink = m_sink;
+    if (sink) sink->processAudio(period, size, buffer.format());
+    m_pool.release(period);
+
+    data      += size;
+    num_bytes -= size;
+  }
+}
+
+void AudioDecoder::flushProbed() {
+  if (!m_probe) return;
+  QTimer::singleShot(0, m_playback, [this]() {
+    // By now, we may be playing a file of our own
+    if (m_audio_out && !m_is_playing &&
+        m_audio_out->state() != QAudio::StoppedState) {
+      m_audio_out->reset();
+      m_audio_out->stop();
+      m_playback->clear();
+    }
+  });
+}
@@ -9,31 +9,73 @@
 #include <QAudioBuffer>
 #include <QAudioFormat>
 #include <QAudioProbe>
+#include <QDateTime>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QFileInfo>
 #include <QMediaContent>
+#include <QMetaMethod>
+#include <QSemaphore>
+#include <QThread>
+#include <QTimer>
 #include <QUrl>
-#include <QtEndian>
+#include <QVector>
+
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <vector>
+
+#include "audiobufferpool.h"
+#include "decodethread.h"
+#include "pcmreader.h"
+#include "playbackdevice.h"
+#include "readaheadthread.h"
+#include "rewindcache.h"
+#include "spscqueue.h"
+#include "wavheader.h"
 
 /** A QMediaPlayer extension that is meant to sent out raw audio data so that
  *  the audio can be manipulated before playing. When this is not possible, this
  *  class acts as a normal QMediaPlayer.
- *  Users of this class should subscribe to the bufferReady() signal, which
- *  sends audio data as a QAudioBuffer. When you're done manipulating it, you
- *  can write the data to the audiodevice obtained by playbackDevice().
+ *  The user of this class that plays the audio should implement the Sink
+ *  interface and register itself with setSink(); it is handed every period of
+ *  audio data directly. When you're done manipulating it, you can write the
+ *  data to the audiodevice obtained by playbackDevice(). Others that just want
+ *  to look at the audio can subscribe to the bufferReady() signal, which
+ *  sends the audio data as a QAudioBuffer.
  *  If data cannot be intercepted, audio is played directly.
  *
- *  To intercept the data, we use a bit of a dirty trick. Normally, one would
- *  use the QAudioDecoder class for this use case, but that doesn't allow
- *  seeking.
- *  Instead we set the volume of the QMediaPlayer to 0 and attach a QAudioProbe
- *  to it, which hands out readonly data - QAudioProbe is meant to monitor the
- *  audio data, not to modify it. We resend that data in the bufferReady()
- *  signal, where a copy of it can be modified before playback.
+ *  Wav files are parsed natively. Other files are decoded by a DecodeThread,
+ *  with our own FlacDecoder for FLAC files or with QAudioDecoder for the rest
+ *  (or a MediaCodecDecoder on Android).
+ *  Each file is decoded exactly once into a cache file of raw audio data. The
+ *  decoders can't seek, but the cache can, so from then on both kinds of
+ *  files are handled the same: the audio data is read
+ *  ahead of playback by a ReadAheadThread, so that the GUI thread never has to
+ *  wait for the storage, and seeking is just a matter of reading from another
+ *  position. The most recently played audio is kept in a RewindCache, so that
+ *  skipping back a few seconds can start right away.
  *
- *  On Android, neither QAudioDecoder nor QAudioProbe are supported. To have at
- *  least some form of modifyable audio, this class adds the possibility to
- *  play .wav files natively. */
+ *  The audio output and everything that feeds it live in a separate audio
+ *  thread, so a busy GUI thread can't interrupt the playback. This means that
+ *  the bufferReady() signal is sent from the audio thread; its handlers should
+ *  be connected with Qt::DirectConnection and shouldn't block. The GUI thread
+ *  controls the playback by sending commands to the audio thread over a
+ *  lock-free queue, and learns about the progress through atomic flags, which
+ *  can't overflow no matter how long the GUI thread is busy.
+ *
+ *  Only if QAudioDecoder is not available or it can't handle a file that
+ *  isn't a wav or FLAC file (or Android can't decode it), the QMediaPlayer
+ *  plays it itself. The same goes for files that are too long to decode into the
+ *  cache, and, from then on, for files that the user seeks far beyond what
+ *  QAudioDecoder has decoded: it can only decode from start to end, while
+ *  QMediaPlayer can go there right away.
+ *  Where we can, we still intercept the audio of the QMediaPlayer with a bit
+ *  of a dirty trick: we set its volume to 0 and attach a QAudioProbe to it,
+ *  which hands out readonly copies of the audio data. We play those in the
+ *  audio thread like our own audio. Otherwise, the interceptingChanged()
+ *  signal tells that the audio can't be intercepted anymore. */
 class AudioDecoder : public QMediaPlayer {
   Q_OBJECT
 
@@ -42,6 +84,12 @@ public:
   ~AudioDecoder();
 
   qint64 duration() const;
+
+  /** The position of the audio that is audible right now, in ms. While the
+   *  audio thread is playing, it is derived from the amount of audio that the
+   *  audio output has processed minus what's still in its buffer, and it is
+   *  interpolated in between the wakeups of the audio thread. Otherwise it is
+   *  the position we read from. */
   qint64 position() const;
   QMediaPlayer::State state() const;
 
@@ -51,16 +99,146 @@ public:
   bool isAudioAvailable() const;
 
   /** Return an opened QIODevice where raw audio data can be written to to play
-   *  it back. */
-  QIODevice* playbackDevice() {return m_audio_out_device;}
-
-  /** Indicate whether we're sending raw audio with the bufferReady() signal, or
-   *  whether audio is played directly. */
+   *  it back. This should be done right away from the handler of the
+   *  bufferReady() signal, in the audio thread. */
+  QIODevice* playbackDevice() {return m_audio_out_device.load();}
+
+  /** Processes the audio data that we read, in the audio thread. Unlike the
+   *  bufferReady() signal, this doesn't go through the meta object system
+   *  and doesn't wrap the data in a QAudioBuffer, so it is the cheapest way
+   *  to get the audio to the audio output. */
+  class Sink {
+  public:
+    virtual ~Sink() {}
+
+    /** Get ready for audio data in the given format. This is called in the
+     *  audio thread when a file is loaded, before its audio data is handed
+     *  out, so that the sink can set itself up for the format once. */
+    virtual void prepare(const QAudioFormat& format) = 0;
+
+    /** Handle num_bytes of audio data in the given format. The data is only
+     *  valid during the call, as its memory is reused for the next period,
+     *  but it may be modified in place. This is called in the audio thread
+     *  and shouldn't block. */
+    virtual void processAudio(char* data, int num_bytes,
+                              const QAudioFormat& format) = 0;
+  };
+
+  /** Set the sink that the audio data is handed to, or NULL for none. The
+   *  sink gets the data after the handlers of the bufferReady() signal, and
+   *  should outlive this object. It should be set before a file is loaded,
+   *  so that it is prepared for the format. */
+  void setSink(Sink* sink) {m_sink = sink;}
+
+  /** Indicate whether we're sending raw audio to the sink and with the
+   *  bufferReady() signal, or whether audio is played directly. */
   bool isIntercepting();
 
   /** Return the full path of the loaded media file. */
   QString getMediaPath();
 
+  /** Select whether natively played wav files should be memory mapped (the
+   *  default) or read with regular file I/O. Memory mapping avoids a system
+   *  call and a heap allocation for each period of audio. If the file can't be
+   *  mapped, we silently fall back to reading it.
+   *  The setting takes effect the next time a file is loaded. */
+  void setMemoryMapping(bool use_mmap) {m_use_mmap = use_mmap;}
+
+  /** Indicate whether the currently loaded wav file is memory mapped. */
+  bool isMemoryMapped() const {return m_reader && m_reader->isMemoryMapped();}
+
+  /** Set the amount of audio that is read ahead of playback for natively
+   *  played wav files and decoded files, in ms. If set to 0, no separate
+   *  thread is used and the audio is read on demand. The setting takes effect
+   *  the next time a file is loaded. */
+  void setReadAheadTime(int ms) {m_read_ahead_time = qMax(0, ms);}
+  int  readAheadTime() const {return m_read_ahead_time;}
+
+  /** The fill level of the read-ahead buffer, between 0.0 and 1.0. This is 0.0
+   *  if we're not reading ahead. */
+  qreal readAheadFillLevel() const;
+
+  /** The number of times the audio output needed data that the read-ahead
+   *  thread hadn't read yet, since the file was loaded. If this happens a lot,
+   *  the read-ahead time should probably be increased. */
+  int readAheadStalls() const;
+
+  /** Select whether the audio output pulls the audio data from us when it
+   *  needs it (the default), or whether we push it to the audio output when
+   *  it notifies us that there's room for it. Pulling wakes us up far less
+   *  often, and we don't depend on the timing of the notify() signal. The
+   *  setting takes effect the next time a file is loaded. */
+  void setPullMode(bool use_pull) {m_use_pull = use_pull;}
+  bool isPullMode() const {return m_is_pulling;}
+
+  /** The number of times per second the audio output woke us up to check
+   *  for or ask for audio data, since playback was last started. */
+  qreal wakeupRate() const;
+
+  /** Profiles for the audio output, which trade the time it takes for a pause
+   *  or a seek to be heard for the number of times we're woken up:
+   *  - LowLatency uses a small buffer and frequent wakeups
+   *  - Balanced is in between, and is the default
+   *  - PowerSaver uses a large buffer and rare wakeups, for laptops on
+   *    battery and phones */
+  enum LatencyProfile {LowLatency, Balanced, PowerSaver};
+
+  /** Select the latency profile for the audio output. If a file is loaded and
+   *  we're not playing, it takes effect right away; otherwise the next time
+   *  a file is loaded. */
+  void setLatencyProfile(LatencyProfile profile);
+  LatencyProfile latencyProfile() const {return m_latency_profile;}
+
+  /** The time it took for the last pause() to silence the audio output, in
+   *  us, or -1 if we haven't paused yet. The buffered audio is discarded on
+   *  pause, so this doesn't depend on the latency profile. */
+  qint64 pauseLatency() const {return m_pause_latency;}
+
+  /** The number of audio outputs that were created since construction. An
+   *  audio output is reused for the next file if it has the same format. */
+  int outputsCreated() const {return m_num_outputs_created;}
+
+  /** The time it took to get the audio output going the last time it was
+   *  started, in us. For a new output, this includes creating it. */
+  qint64 openLatency() const {return m_open_latency;}
+
+  /** The latency that the audio output actually achieved with the profile,
+   *  which is the duration of its buffer in ms. This is only known once
+   *  playback has started, and 0 before that. */
+  qint64 outputLatency() const;
+
+  /** Set the amount of recently played audio that is kept in memory, in ms,
+   *  so that skipping back within it doesn't have to wait for the file or the
+   *  decoder. If set to 0, nothing is kept. The setting takes effect the next
+   *  time a file is loaded. */
+  void setRewindTime(int ms) {m_rewind_time = qMax(0, ms);}
+  int  rewindTime() const {return m_rewind_time;}
+
+  /** The number of seeks that could be served from the recently played audio
+   *  and the number that couldn't, since the file was loaded. */
+  int rewindHits() const {return m_rewind_hits;}
+  int rewindMisses() const {return m_rewind_misses;}
+
+  /** A marker in the audio, taken from the cue points in a natively parsed
+   *  wav file. */
+  struct Marker {
+    qint64  position; // In ms
+    QString label;
+  };
+
+  /** Return the markers in the loaded media, sorted by position. Only natively
+   *  parsed wav files can have markers. */
+  QVector<Marker> markers() const;
+
+  /** Return the time the recording was started, if known. Only natively parsed
+   *  Broadcast Wave files contain this information; for other files an
+   *  invalid QDateTime is returned. */
+  QDateTime recordingTime() const;
+
+  /** Indicate whether the loaded file is still being decoded in the
+   *  background. Until it is done, the duration is an estimate. */
+  bool isDecoding() const;
+
 public slots:
   /** Load the specified file. This method returns immediately, but it sends out
    *  the durationChanged() and mediaStatusChanged() signals on success, or the
@@ -68,95 +246,431 @@ public slots:
    *  TODO: error signal. */
   void setMedia(const QUrl& path);
 
+  /** Pause the playback. The audio that the audio output has buffered is
+   *  discarded, so that it is silent right away, and the position moves back
+   *  to what was audible, so that nothing is skipped when we resume. */
   void pause();
   void play();
   void setPosition(qint64 position);
 
 signals:
-  /** Connect to this signal to receive the raw audio data. */
+  /** Sent when we stop intercepting the audio, because the loaded file is
+   *  left to the QMediaPlayer and it can't be probed. */
+  void interceptingChanged(bool is_intercepting);
+
+  /** Connect to this signal to receive the raw audio data. The data of the
+   *  buffer is only valid while the signal is handled, as its memory is
+   *  reused for the next period, so the handlers must be connected with
+   *  Qt::DirectConnection. The signal is only sent if it is connected, as it
+   *  has to wrap the data in a QAudioBuffer. */
   void bufferReady(const QAudioBuffer& buffer);
 
 private slots:
   /** Indicate that it's time to check the status of the QAudioOutput buffer
-   *  and send a much data to it that fits. This is the 'heartbeat' of the class,
-   *  and it is fired by the notify() signal of QAudioOutput. */
+   *  and send a much data to it that fits. In push mode, this is the
+   *  'heartbeat' of the class, and it is fired by the notify() signal of
+   *  QAudioOutput. */
   void checkBuffer();
 
-  /** Callback for the QAudioProbe when it received some data. It will open
-   *  the output device if needed, and send along the buffer using the
-   *  bufferReady() signal. */
+  /** Callback for when the audio output pulls more data from m_playback than
+   *  it has. We send out num_bytes of audio with the bufferReady() signal, if
+   *  we've got it. */
+  void handleDataNeeded(qint64 num_bytes);
+
+  /** Callbacks for the DecodeThread. When the format is known, we can start
+   *  reading from the cache file. */
+  void handleDecodeFormat(const QAudioFormat& format);
+  void handleDecodeDuration(qint64 duration);
+  void handleDecodeDone();
+
+  /** Callback for when the file can't be decoded, or is too long to decode.
+   *  We leave the file to the QMediaPlayer, which will either play it or
+   *  report an error. */
+  void handleDecodeFailed();
+
+  /** Callback for the QAudioProbe when it received some data from the
+   *  QMediaPlayer. It sets up the audio output if needed, and has the audio
+   *  thread play the data. */
   void handleBufferProbed(const QAudioBuffer& buffer);
 
+  /** Check the status flags set by the audio thread, and send out the
+   *  positionChanged() and mediaStatusChanged() signals accordingly. This is
+   *  fired by m_status_timer while playing, at the notifyInterval(), so that
+   *  the position is reported at that rate rather than for every period of
+   *  audio. */
+  void handleStatus();
+
 private:
-  /** Initialize the audio output device with the specified format.
-   *  @param format the audio format we're playing back in.
-   *  @param connect_notify if true, the notify() signal of QAudioOutput will
-   *                        be connected to checkBuffer(). This is only needed
-   *                        when we're decoding wav files directly. */
-  void initAudioOutput(const QAudioFormat& format, bool connect_notify);
-
-  /** Parse the header of a WAV file.
+  /** The tests read the audio data directly, with read() and readBuffer(),
+   *  and leave files to the QMediaPlayer with leaveToMediaPlayer(). */
+  friend class AudioDecoderTest;
+  friend class AudioPlayerTest;
+
+  /** Read at most max_bytes of audio data from the natively opened wav file
+   *  or the decoded audio into the memory at data, starting at the current
+   *  position, and advance the position accordingly. This doesn't allocate
+   *  any memory.
+   *  This is what feeds the bufferReady() signal in the audio thread, so it
+   *  may only be called from elsewhere while we're not playing.
+   *  @return the number of bytes read, which is 0 if there is no data
+   *          (yet). */
+  qint64 read(char* data, qint64 max_bytes);
+
+  /** Like read(), but return the audio data in a new buffer.
+   *  @return a buffer with the audio data, which is invalid if there is no
+   *          more data (or if we're not intercepting the audio). It is also
+   *          invalid if the read-ahead thread or the decoder hasn't caught up
+   *          yet; use mediaStatus() to tell the difference. */
+  QAudioBuffer readBuffer(int max_bytes);
+
+  /** A command from the GUI thread to the audio thread. */
+  struct Command {
+    enum Type {Play, Pause, Seek};
+    Type   type;
+    qint64 data_pos;   // For Seek
+    qint64 time;       // For Seek
+    int    generation; // Of the clock, see m_clock_generation
+    qint64 stamp;      // When it was sent, in ns of m_clock_timer
+  };
+
+  /** A part of the audio that was handed to the audio output: from
+   *  output_pos onwards (in bytes since the output was started), it plays the
+   *  audio data from data_pos onwards. */
+  struct ClockSegment {
+    qint64 output_pos;
+    qint64 data_pos;
+  };
+
+  /** Queue a command for the audio thread, and wake it up. */
+  void sendCommand(Command::Type type, qint64 data_pos = 0, qint64 time = 0);
+
+  /** Carry out the queued commands. Only for the audio thread. */
+  void processCommands();
+
+  /** Make the audio thread stop reading audio data, so that the current
+   *  thread can take over. Blocks until the audio thread has finished its
+   *  queued commands. */
+  void detachAudio();
+
+  /** Run function in the audio thread and wait for it to finish. */
+  void runOnAudioThread(const std::function<void()>& function);
+
+  /** Move the read position to data_pos, in bytes of m_format, which is at
+   *  the given time in ms, and let the decoder, the read-ahead thread, the
+   *  rewind cache and the clock know about it. Only for the thread that reads
+   *  the audio data. Counts as a hit or miss for the rewind cache. */
+  void seekData(qint64 data_pos, qint64 time);
+
+  /** Do the work of seekData(), but without counting it for the rewind
+   *  cache, for when we move the read position ourselves. */
+  void moveData(qint64 data_pos, qint64 time);
+
+  /** Whether the audio data at data_pos is in the rewind cache. */
+  bool isInRewind(qint64 data_pos) const;
+
+  /** The number of bytes that have been handed to the current audio output,
+   *  including what's still waiting in m_playback. */
+  qint64 outputPosition() const;
+
+  /** Note that the audio output gets the audio data from data_pos onwards
+   *  from the current output position on. */
+  void addClockSegment(qint64 data_pos);
+
+  /** The position in the audio data of what the audio output is playing
+   *  right now, in bytes of m_format. is_started is set to false if it is
+   *  still playing audio from before the last seek. Only for the audio
+   *  thread. */
+  qint64 audiblePosition(bool& is_started);
+
+  /** Work out what the audio output is playing right now, and publish it as
+   *  the new reference point for the clock. Only for the audio thread. */
+  void updateClock();
+
+  /** Start the audio output, and keep track of the time it takes. Only for
+   *  the audio thread. */
+  void startOutput();
+
+  /** Stop the audio output right away, discarding the audio in its buffer,
+   *  and move the read position back to what was audible, so that playback
+   *  continues from there. Only for the audio thread. */
+  void flushOutput();
+
+  /** The time of the clock in ms; see position(). */
+  qint64 clockTime() const;
+
+  /** Initialize the audio output device with the specified format and the
+   *  buffer size of the latency profile. The current device is reused if it
+   *  matches. In push mode, connect its notify()
+   *  signal to checkBuffer(); in pull mode, it reads from m_playback once it
+   *  is started on play(). */
+  void initAudioOutput(const QAudioFormat& format);
+
+  /** Read at most max_bytes of audio data and send it out with the
+   *  bufferReady() signal.
+   *  @return the number of bytes sent, which is 0 if the data isn't available
+   *          yet, or -1 if we've reached the end of the audio. */
+  qint64 sendBuffer(int max_bytes);
+
+  /** Set up m_format for audio data in the given encoding, which is handed
+   *  out as 8 bit unsigned or 16 bit signed data. */
+  void setFormat(int num_channels, int sample_rate,
+                 PcmReader::Encoding encoding);
+
+  /** Start reading audio data with m_reader, either ahead of time or on
+   *  demand. */
+  void startReading();
+
+  /** Parse the header of the WAV file at path into m_header, and set up
+   *  m_format and the other parameters of the data from it.
    *  @return bool if everything checks out, false if there was something wrong.
    */
-  bool parseHeader();
-
-  /** Search for a specified subchunk in m_file. If the subchunk is found, the
-   *  file position is set to the start of the chunk. The file position should
-   *  already be at the start of a subchunk and be before the subchunk to be
-   *  found.
-   *  @param identifier the four byte identifier of the subchunk
-   *  @return true if the subchunk was found, false otherwise. */
-  bool findSubChunk(const QString identifier);
-
-  /** Read a word in little endian format from m_file and return it. This
-   *  operation advances the m_file position by sizeof(word) bytes.
-   *  This operation uses a little hack for reporting failure; when parsing
-   *  headers, only positive values are expected but all variables are signed,
-   *  so we report an error by returning -1.
-   *  @return the length, or -1 on error. */
-  template <typename word>
-  word readNumber();
-
-  QAudioOutput* m_audio_out        = NULL;
-  QIODevice*    m_audio_out_device = NULL;
+  bool parseHeader(const QString& path);
 
-  QAudioProbe* m_probe = NULL;
+  /** Convert a time in ms to a number of bytes in m_format and vice versa.
+   *  Unlike the QAudioFormat methods, these work with 64 bit sizes. */
+  qint64 bytesForTime(qint64 ms) const;
+  qint64 timeForBytes(qint64 num_bytes) const;
+
+  /** The size of the audio data that can be read right now, in bytes of
+   *  m_format. While decoding, this is what has been decoded so far. */
+  qint64 dataSize() const;
+
+  /** Indicate whether we've read all audio data. */
+  bool atEnd() const;
+
+  /** Stop reading (and decoding) the loaded file. */
+  void closeFile();
 
-  /** Indicite if we prefer to parse wav files ourselves. This will become true
-   *  if QAudioProbe cannot connect to the QMediaPlayer (so we cannot intercept
-   *  the raw audio data). */
-  bool m_prefer_native_wav = false;
+  /** Silence the audio output and forget its device. It is kept around, as
+   *  the next file may well have the same format. */
+  void resetOutput();
 
-  /** Indicate if we're currently working with a wav file that we're playing
-   *  natively. Otherwise QMediaPlayer is playing the current file. */
+  /** Stop handling the audio of the loaded file ourselves, and let the
+   *  QMediaPlayer play it from the given position in ms instead. If we were
+   *  playing, it continues playing. */
+  void leaveToMediaPlayer(qint64 position);
+
+  /** Hand out a buffer of audio data from the QAudioProbe like our own audio
+   *  data, and start the audio output if it isn't playing yet. Only for the
+   *  audio thread. */
+  void playProbed(const QAudioBuffer& buffer);
+
+  /** Discard what the audio output has left of the probed audio, when the
+   *  QMediaPlayer pauses or seeks. */
+  void flushProbed();
+
+  QAudioOutput* m_audio_out = NULL;
+
+  /** The device that we write the audio data to. It is set in the audio
+   *  thread, but the GUI thread checks whether there is one. */
+  std::atomic<QIODevice*> m_audio_out_device{NULL};
+
+  /** The probe that intercepts the audio of the QMediaPlayer, or NULL if it
+   *  can't be probed. */
+  QAudioProbe* m_probe = NULL;
+
+  /** The device that the audio output pulls data from in pull mode. It lives
+   *  in the audio thread, and is used as the context for running things
+   *  there. */
+  PlaybackDevice* m_playback;
+
+  /** The thread that runs the audio output and reads, boosts and writes the
+   *  audio data. */
+  QThread m_audio_thread;
+
+  /** The memory for the periods of audio that we send out with the
+   *  bufferReady() signal. It is sized for the format in initAudioOutput(),
+   *  so that reading and sending the audio doesn't allocate memory. */
+  AudioBufferPool m_pool;
+
+  /** See setSink(). */
+  std::atomic<Sink*> m_sink{NULL};
+
+  /** The commands for the audio thread. */
+  SpscQueue<Command> m_commands;
+
+  /** Set by the audio thread when it has handed out audio, so that the
+   *  position has moved, and when it has reached the end of the audio. They
+   *  are cleared by handleStatus(). */
+  std::atomic<bool> m_has_moved{false};
+  std::atomic<bool> m_has_ended{false};
+
+  /** Fires handleStatus() in the GUI thread while playing, and the last
+   *  position it reported. */
+  QTimer m_status_timer;
+  qint64 m_last_position = -1;
+
+  /** The clock is only valid for the generation of the GUI thread in which
+   *  it was made. It is increased for each seek, and when the audio thread
+   *  stops reading. The audio thread learns about the current generation
+   *  from the commands it gets. */
+  std::atomic<int> m_clock_generation{0};
+  int              m_audio_generation = 0;
+
+  /** The position to report while the clock isn't valid for the current
+   *  generation, in ms. */
+  std::atomic<qint64> m_clock_fallback{0};
+
+  /** The reference point of the clock, written by the audio thread and
+   *  guarded by a sequence number that is odd while it is being written: the
+   *  time in us of the audio that was audible at m_clock_stamp (in ns of
+   *  m_clock_timer), whether it was running at the time and the generation
+   *  it is valid for. */
+  std::atomic<quint32> m_clock_sequence{0};
+  std::atomic<qint64>  m_clock_time{0};
+  std::atomic<qint64>  m_clock_stamp{0};
+  std::atomic<bool>    m_clock_is_running{false};
+  std::atomic<int>     m_clock_valid_for{0};
+  QElapsedTimer        m_clock_timer;
+
+  /** The parts of the audio that the audio output may still be playing, in
+   *  order. */
+  std::vector<ClockSegment> m_clock_segments;
+
+  /** The write position of m_playback when the audio output was started, and
+   *  the number of bytes pushed to the audio output in push mode. */
+  qint64 m_output_start = 0;
+  qint64 m_num_pushed   = 0;
+
+  /** Indicate if the audio thread reads the audio data, which is the case
+   *  from play() onwards. Only for the GUI thread. */
+  bool m_is_attached = false;
+
+  /** Indicate if the audio thread should be playing. Only for the audio
+   *  thread. */
+  bool m_is_playing = false;
+
+  /** The buffer time and notify interval of a latency profile, in ms. */
+  static void profileTimes(LatencyProfile profile, int& buffer_time,
+                           int& notify_interval);
+
+  /** The selected latency profile, and the buffer size in bytes that the
+   *  audio output ended up with, or 0 if it isn't started yet. */
+  LatencyProfile   m_latency_profile = Balanced;
+  std::atomic<int> m_buffer_size{0};
+
+  /** See pauseLatency(). */
+  std::atomic<qint64> m_pause_latency{-1};
+
+  /** Whether the current audio output pulls its data, and its buffer time in
+   *  ms, which together with its format decide whether it can be reused. */
+  bool m_output_is_pulling  = false;
+  int  m_output_buffer_time = 0;
+
+  /** See outputsCreated() and openLatency(). The time it took to create the
+   *  current audio output (in us) is added to the open latency of its first
+   *  start. */
+  std::atomic<int>    m_num_outputs_created{0};
+  std::atomic<qint64> m_open_latency{0};
+  qint64              m_create_time = 0;
+
+  /** Indicate if we should use pull mode for the next audio output, and if
+   *  the current one uses it. */
+  bool m_use_pull   = true;
+  bool m_is_pulling = false;
+
+  /** The number of times the audio output woke us up since playback started,
+   *  and the time we've been playing. The timer is invalid while we're
+   *  paused, in which case the time is kept in m_wakeup_time. */
+  std::atomic<int> m_num_wakeups{0};
+  QElapsedTimer    m_wakeup_timer;
+  qint64           m_wakeup_time = 0;
+
+  /** Indicate if we're currently handling the audio of the loaded file
+   *  ourselves, either as a native wav file or by decoding it. Otherwise
+   *  QMediaPlayer is playing the current file. */
+  bool m_is_native = false;
+
+  /** Indicate if the loaded file is a wav file that we parsed natively. */
   bool m_is_native_wav = false;
 
-  /** The QMediaPlayer::State when doing native wav processing. */
+  /** The full path of the loaded file. */
+  QString m_media_path;
+
+  /** The QMediaPlayer::State when we're handling the audio ourselves. */
   QMediaPlayer::State m_state_when_native = QMediaPlayer::StoppedState;
 
-  /** The format parameters of the audio file, if we parsed a wav file natively.
-   */
+  /** The format parameters of the audio we hand out, if we're handling the
+   *  audio ourselves. This is the format of the file, except for formats that
+   *  PcmReader converts to 16 bit. */
   QAudioFormat m_format;
 
-  /** The wav file that we've opened. */
-  QFile* m_file = NULL;
+  /** The parsed header of a native wav file. */
+  WavHeader m_header;
+
+  /** The thread that decodes a compressed file, or NULL if we're not decoding.
+   */
+  DecodeThread* m_decoder = NULL;
+
+  /** Indicate if we should try to memory map wav files. */
+  bool m_use_mmap = true;
+
+  /** The reader for the raw audio data, in a wav file or the cache file of
+   *  m_decoder. */
+  PcmReader* m_reader = NULL;
+
+  /** The amount of audio to read ahead, in ms. */
+  int m_read_ahead_time = 2000;
+
+  /** The thread that reads audio data from m_reader ahead of playback, or NULL
+   *  if we're reading on demand. */
+  ReadAheadThread* m_read_ahead = NULL;
+
+  /** The amount of recently played audio to keep, in ms. */
+  int m_rewind_time = 60000;
+
+  /** The recently played audio. Its end position is always where m_read_ahead
+   *  is reading, so that we can continue with the read-ahead data once we've
+   *  replayed what's in here. */
+  RewindCache      m_rewind;
+  std::atomic<int> m_rewind_hits{0};
+  std::atomic<int> m_rewind_misses{0};
 
-  /** The starting position in m_file of the raw audio data in a wav file, if we
-   *  parsed it natively. */
-  int m_data_offset = 0;
+  /** The starting position in the file of the raw audio data in a wav file, if
+   *  we parsed it natively. */
+  qint64 m_data_offset = 0;
 
-  /** The current time in the audio playback if we're playing a wav file
-   *  natively. */
-  qint64 m_time = 0;
+  /** The size of the raw audio data in bytes, in m_format. While decoding, the
+   *  size isn't known yet and this is the maximum qint64. */
+  std::atomic<qint64> m_data_size{0};
 
-  /** The duration of the loaded file if we parsed it natively. */
+  /** The read position in the raw audio data, in bytes of m_format. */
+  std::atomic<qint64> m_data_pos{0};
+
+  /** The current time in the audio playback if we're handling the audio
+   *  ourselves. */
+  std::atomic<qint64> m_time{0};
+
+  /** The duration of the loaded file if we're handling the audio ourselves.
+   *  While decoding, this is the estimate of the decoder. */
   qint64 m_duration = 0;
 
-  /** Markers for the chunks and suchunks of WAV files. */
-  const QString RIFF = "RIFF";
-  const QString WAVE = "WAVE";
-  const QString FMT  = "fmt ";
-  const QString DATA = "data";
+  /** The amount of audio beyond what QAudioDecoder has decoded that we can
+   *  seek to and wait for it, in ms. It decodes much faster than real time,
+   *  so that doesn't take long; beyond it, we leave the file to QMediaPlayer.
+   */
+  const int MAX_UNDECODED_SEEK_TIME = 10000;
+
+  /** The time to wait before trying again if the read-ahead thread or the
+   *  decoder hasn't caught up with playback, in ms. */
+  const int STALL_RETRY_TIME = 5;
+
+  /** The maximum amount of audio the read-ahead thread reads in one go, in
+   *  ms. */
+  const int READ_AHEAD_CHUNK_TIME = 100;
+
+  /** The number of buffers in m_pool, and the amount of audio each holds in
+   *  ms. We only need one at a time, but a spare doesn't hurt. This is also
+   *  the largest period that is sent out at once. */
+  const int NUM_POOL_BUFFERS = 2;
+  const int POOL_BUFFER_TIME = 100;
+
+  /** The size of the command queue for the audio thread. */
+  const int COMMAND_QUEUE_SIZE = 64;
+
+  /** The maximum number of clock segments. There are only a few, unless the
+   *  user seeks like crazy within the latency of the audio output. */
+  const size_t CLOCK_SEGMENTS_SIZE = 64;
 };
 
 #endif // AUDIODECODER_H
@@ -1,10 +1,12 @@
 #include "audioplayer.h"
 
+const int AudioPlayer::REFRESH_RATE_MIN;
+const int AudioPlayer::REFRESH_RATE_MAX;
+
 AudioPlayer::AudioPlayer(QObject* parent) : QObject(parent) {
 
   m_state = PlayerState::PAUSED;
 
-  m_decoder.setNotifyInterval(1000); // We're working with second precision
   connect(&m_decoder, SIGNAL(positionChanged(qint64)),
           this,       SLOT(handleMediaPositionChanged(qint64)));
   connect(&m_decoder, SIGNAL(durationChanged(qint64)),
@@ -15,17 +17,47 @@ AudioPlayer::AudioPlayer(QObject* parent) : QObject(parent) {
           this,       SLOT(handleMediaError()));
   connect(&m_decoder, SIGNAL(mediaStatusChanged(QMediaPlayer::MediaStatus)),
           this,       SLOT(handleMediaStatusChanged(QMediaPlayer::MediaStatus)));
-  connect(&m_decoder, SIGNAL(bufferReady(QAudioBuffer)),
-          this,       SLOT(handleAudioBuffer(QAudioBuffer)));
+  // The audio data is handed to us in the audio thread, and should be handled
+  // there too
+  m_decoder.setSink(this);
+  connect(&m_decoder, SIGNAL(metaDataChanged()),
+          this,       SIGNAL(metaDataChanged()));
+  connect(&m_decoder, SIGNAL(interceptingChanged(bool)),
+          this,       SLOT(handleInterceptingChanged(bool)));
+
+  m_seek_timer.setSingleShot(true);
+  m_seek_timer.setInterval(SEEK_INTERVAL);
+  connect(&m_seek_timer, SIGNAL(timeout()),
+          this,          SLOT(handleSeekTimer()));
+
+  // Load the latency profile and the refresh rate
+  QSettings settings;
+  settings.beginGroup(CFG_GROUP);
+  int profile = settings.value(CFG_LATENCY_PROFILE,
+                               DEFAULT_LATENCY_PROFILE).toInt();
+  m_refresh_rate = settings.value(CFG_REFRESH_RATE, REFRESH_RATE).toInt();
+  settings.endGroup();
+  if (profile < LOW_LATENCY || profile > POWER_SAVER) {
+    profile = DEFAULT_LATENCY_PROFILE;
+  }
+  m_decoder.setLatencyProfile((AudioDecoder::LatencyProfile)profile);
+  m_refresh_rate = qBound(REFRESH_RATE_MIN, m_refresh_rate, REFRESH_RATE_MAX);
+  m_decoder.setNotifyInterval(1000 / m_refresh_rate);
 }
 
 void AudioPlayer::openFile(const QString& path) {
   m_sonic_booster.resetLevel();
-  m_can_boost = true;
+  m_can_boost    = true;
+  m_is_boostable = true;
   emit canBoostChanged();
 
   m_error_handled = false;
 
+  // Seeks in the previous file are of no use anymore
+  m_seek_timer.stop();
+  m_pending_seek = -1;
+  m_num_seeks    = 0;
+
   setState(PlayerState::PAUSED);
   m_decoder.setMedia(QUrl::fromLocalFile(path));
 }
@@ -50,16 +82,101 @@ uint AudioPlayer::getDuration() {
 }
 
 uint AudioPlayer::getPosition() {
-  return ((m_decoder.position() + 500) / 1000);
+  return ((targetPosition() + 500) / 1000);
+}
+
+qint64 AudioPlayer::getPositionMs() {
+  return targetPosition();
+}
+
+int AudioPlayer::getRefreshRate() {
+  return m_refresh_rate;
+}
+
+void AudioPlayer::setRefreshRate(int rate) {
+  rate = qBound(REFRESH_RATE_MIN, rate, REFRESH_RATE_MAX);
+  if (rate != m_refresh_rate) {
+    m_refresh_rate = rate;
+    m_decoder.setNotifyInterval(1000 / rate);
+
+    QSettings settings;
+    settings.beginGroup(CFG_GROUP);
+    settings.setValue(CFG_REFRESH_RATE, rate);
+    settings.endGroup();
+
+    emit refreshRateChanged();
+  }
 }
 
 bool AudioPlayer::canBoost() {
   return m_can_boost;
 }
 
+QVariantList AudioPlayer::getMarkers() {
+  QVariantList markers;
+  for (const AudioDecoder::Marker& marker : m_decoder.markers()) {
+    QVariantMap item;
+    item["position"] = (uint)((marker.position + 500) / 1000);
+    item["label"]    = marker.label;
+    markers.append(item);
+  }
+  return markers;
+}
+
+QDateTime AudioPlayer::getRecordingTime() {
+  return m_decoder.recordingTime();
+}
+
+AudioPlayer::LatencyProfile AudioPlayer::getLatencyProfile() {
+  // Our profiles are in the same order as those of the decoder
+  return (LatencyProfile)m_decoder.latencyProfile();
+}
+
+void AudioPlayer::setLatencyProfile(LatencyProfile profile) {
+  if (profile != getLatencyProfile()) {
+    m_decoder.setLatencyProfile((AudioDecoder::LatencyProfile)profile);
+
+    QSettings settings;
+    settings.beginGroup(CFG_GROUP);
+    settings.setValue(CFG_LATENCY_PROFILE, (int)profile);
+    settings.endGroup();
+
+    emit latencyProfileChanged();
+  }
+}
+
+int AudioPlayer::getOutputLatency() {
+  return m_decoder.outputLatency();
+}
+
+qreal AudioPlayer::getWakeupRate() {
+  return m_decoder.wakeupRate();
+}
+
+void AudioPlayer::skipToMarker(bool is_forward) {
+  qint64 pos = targetPosition();
+  QVector<AudioDecoder::Marker> markers = m_decoder.markers();
+
+  if (is_forward) {
+    for (const AudioDecoder::Marker& marker : markers) {
+      if (marker.position > pos) {
+        seekTo(marker.position);
+        return;
+      }
+    }
+  } else {
+    for (int i = markers.size() - 1; i >= 0; i--) {
+      if (markers[i].position < pos - 1000) {
+        seekTo(markers[i].position);
+        return;
+      }
+    }
+  }
+}
+
 void AudioPlayer::skipSeconds(int seconds) {
   qint64 new_pos;
-  new_pos = m_decoder.position() + seconds * 1000;
+  new_pos = targetPosition() + seconds * 1000;
   if (new_pos < 0) {
     new_pos = 0;
   }
@@ -67,8 +184,35 @@ void AudioPlayer::skipSeconds(int seconds) {
     new_pos = m_decoder.duration();
   }
 
-  m_decoder.setPosition(new_pos);
-  emit positionChanged();
+  seekTo(new_pos);
+}
+
+void AudioPlayer::seekTo(qint64 ms) {
+  if (m_seek_timer.isActive()) {
+    // We've just seeked, so hold this one back
+    m_pending_seek = ms;
+  } else {
+    m_decoder.setPosition(ms);
+    m_num_seeks++;
+    m_seek_timer.start();
+  }
+  reportPosition();
+}
+
+qint64 AudioPlayer::targetPosition() {
+  if (m_pending_seek >= 0) return m_pending_seek;
+  return m_decoder.position();
+}
+
+void AudioPlayer::handleSeekTimer() {
+  if (m_pending_seek >= 0) {
+    m_decoder.setPosition(m_pending_seek);
+    m_pending_seek = -1;
+    m_num_seeks++;
+
+    // More seeks may follow, so keep holding them back for a while
+    m_seek_timer.start();
+  }
 }
 
 void AudioPlayer::handleMediaAvailabilityChanged() {
@@ -85,6 +229,34 @@ void AudioPlayer::handleMediaAvailabilityChanged() {
   }
 }
 
+void AudioPlayer::handleInterceptingChanged(bool is_intercepting) {
+  if (is_intercepting) return;
+
+  // If the user boosted the audio, it gets softer all of a sudden
+  if (m_sonic_booster.level() != 0) {
+    m_sonic_booster.resetLevel();
+    emit error(BOOST_UNSUPPORTED_MSG);
+  }
+  if (m_can_boost) {
+    m_can_boost = false;
+    emit canBoostChanged();
+  }
+}
+
+void AudioPlayer::handleBoostability(bool is_boostable) {
+  m_is_boostable = is_boostable;
+  if (is_boostable) return;
+
+  if (m_sonic_booster.level() != 0) {
+    m_sonic_booster.resetLevel();
+    emit error(BOOST_UNSUPPORTED_MSG);
+  }
+  if (m_can_boost) {
+    m_can_boost = false;
+    emit canBoostChanged();
+  }
+}
+
 void AudioPlayer::handleMediaError() {
   if (!m_error_handled) {
     m_error_handled = true;
@@ -106,7 +278,8 @@ void AudioPlayer::handleMediaStatusChanged(QMediaPlayer::MediaStatus status) {
 void AudioPlayer::setPosition(int seconds) {
   qint64 ms = seconds * 1000;
   if (ms > m_decoder.duration()) ms = m_decoder.duration(); // Cap
-  m_decoder.setPosition(ms);
+  if (ms < 0) ms = 0;
+  seekTo(ms);
 }
 
 void AudioPlayer::setState(PlayerState state) {
@@ -175,7 +348,7 @@ void AudioPlayer::toggleWaiting(bool should_wait) {
 }
 
 void AudioPlayer::boost(bool is_up) {
-  if (m_decoder.isIntercepting()) {
+  if (m_decoder.isIntercepting() && m_is_boostable) {
     if (is_up) {
       m_sonic_booster.increaseLevel();
     } else {
@@ -189,28 +362,29 @@ void AudioPlayer::boost(bool is_up) {
 }
 
 void AudioPlayer::handleMediaPositionChanged(qint64) {
-  emit positionChanged();
+  reportPosition();
 }
 
-void AudioPlayer::handleAudioBuffer(const QAudioBuffer& buffer) {
-  if (buffer.isValid()) {
-    if (m_sonic_booster.level() != 0) {
-      if (!m_sonic_booster.canBoost(buffer.format())) {
-        m_can_boost = false;
-        emit canBoostChanged();
-        emit error(BOOST_UNSUPPORTED_MSG);
-        m_sonic_booster.resetLevel();
-      }
-    }
-    bool is_modified = m_sonic_booster.boost(buffer);
+void AudioPlayer::reportPosition() {
+  emit positionMsChanged();
 
-    // Finally, play the audio
-    if (is_modified) {
-      int         boosted_buffer_size;
-      const char* boosted_buffer = m_sonic_booster.getBoostedBuffer(boosted_buffer_size);
-      m_decoder.playbackDevice()->write(boosted_buffer, boosted_buffer_size);
-    } else {
-      m_decoder.playbackDevice()->write((char*)buffer.constData(), buffer.byteCount());
-    }
+  // Most updates don't change what the user sees
+  uint position = getPosition();
+  if (position != m_reported_position) {
+    m_reported_position = position;
+    emit positionChanged();
   }
 }
+
+void AudioPlayer::prepare(const QAudioFormat& format) {
+  bool is_boostable = m_sonic_booster.setFormat(format);
+  QMetaObject::invokeMethod(this, "handleBoostability", Qt::QueuedConnection,
+                            Q_ARG(bool, is_boostable));
+}
+
+void AudioPlayer::processAudio(char* data, int num_bytes,
+                               const QAudioFormat&) {
+  // The data is ours to modify, so we boost it in place and play it
+  m_sonic_booster.boost(data, data, num_bytes);
+  m_decoder.playbackDevice()->write(data, num_bytes);
+}
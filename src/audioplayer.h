@@ -4,15 +4,22 @@
 #include <QObject>
 
 #include <QAudioOutput>
+#include <QDateTime>
 #include <QDebug>
+#include <QSettings>
 #include <QString>
+#include <QTimer>
+#include <QVariantList>
+#include <QVariantMap>
+
+#include <atomic>
 
 #include "sonicbooster.h"
 #include "audiodecoder.h"
 
 /** The 'back-end' class for playing audio files. It is complemented by a
  *  QML MediaControls element to interact with it. */
-class AudioPlayer : public QObject {
+class AudioPlayer : public QObject, public AudioDecoder::Sink {
   Q_OBJECT
 
 public:
@@ -60,6 +67,26 @@ public:
              READ getPosition
              NOTIFY positionChanged)
 
+  /** The position in the audio playback in ms. This is the audio that is
+   *  audible right now, rather than the audio that is read. While playing, it
+   *  is updated refresh_rate times per second. */
+  Q_PROPERTY(qint64 position_ms
+             READ getPositionMs
+             NOTIFY positionMsChanged)
+
+  /** The number of times per second that the position is updated while
+   *  playing. It is stored in the settings. */
+  Q_PROPERTY(int refresh_rate
+             READ getRefreshRate
+             WRITE setRefreshRate
+             NOTIFY refreshRateChanged)
+
+  /** The limits for the refresh rate. */
+  static const int REFRESH_RATE_MIN = 1;
+  static const int REFRESH_RATE_MAX = 60;
+  Q_PROPERTY(int refresh_rate_min MEMBER REFRESH_RATE_MIN CONSTANT)
+  Q_PROPERTY(int refresh_rate_max MEMBER REFRESH_RATE_MAX CONSTANT)
+
   /** Indicates if we can boost the current loaded audio *to the best of our
    *  current knowledge!* That is, we might think that we can boost the audio
    *  but it may turn out that we can't if we try. In that case, subsequent
@@ -68,6 +95,39 @@ public:
              READ canBoost
              NOTIFY canBoostChanged)
 
+  /** The markers in the audio file, as a list of objects with a 'position'
+   *  (in whole seconds) and a 'label' property. Markers are only available
+   *  for wav files with cue points. */
+  Q_PROPERTY(QVariantList markers
+             READ getMarkers
+             NOTIFY metaDataChanged)
+
+  /** The time the recording was started, if the audio file contains this
+   *  information (Broadcast Wave files do), or an invalid date otherwise. */
+  Q_PROPERTY(QDateTime recording_time
+             READ getRecordingTime
+             NOTIFY metaDataChanged)
+
+  /** The profiles for the audio output; see AudioDecoder::LatencyProfile. */
+  enum LatencyProfile {LOW_LATENCY, BALANCED, POWER_SAVER};
+  Q_ENUMS(LatencyProfile)
+
+  /** The latency profile of the audio output. It is stored in the settings. */
+  Q_PROPERTY(LatencyProfile latency_profile
+             READ getLatencyProfile
+             WRITE setLatencyProfile
+             NOTIFY latencyProfileChanged)
+
+  /** The latency that the audio output achieved with the profile in ms, and
+   *  the number of times per second it woke up the audio thread since
+   *  playback was last started. */
+  Q_PROPERTY(int output_latency
+             READ getOutputLatency
+             NOTIFY stateChanged)
+  Q_PROPERTY(qreal wakeup_rate
+             READ getWakeupRate
+             NOTIFY stateChanged)
+
   /** Open a new audio file.
    *  @param path the complete path to the new file. */
   void openFile(const QString &path);
@@ -78,8 +138,22 @@ public:
   PlayerState getState();
   uint getDuration();
   uint getPosition();
+  qint64 getPositionMs();
+  int getRefreshRate();
+  void setRefreshRate(int rate);
   bool isAvailable();
   bool canBoost();
+  QVariantList getMarkers();
+  QDateTime getRecordingTime();
+  LatencyProfile getLatencyProfile();
+  void setLatencyProfile(LatencyProfile profile);
+  int getOutputLatency();
+  qreal getWakeupRate();
+
+  /** The number of seeks that were actually carried out since the file was
+   *  opened. Seeks that follow each other quickly are coalesced; see
+   *  seekTo(). */
+  int seekCount() const {return m_num_seeks;}
 
 signals:
   /** Signals the the playing state has changed. */
@@ -89,17 +163,28 @@ signals:
    *  when a new audio file is loaded. */
   void durationChanged();
 
-  /** Signals that the position in the audio playback is changed. This usually
-   *  occurs every millisecond, even though the position property is measured
-   *  in whole seconds. */
+  /** Signals that the position in the audio playback in whole seconds has
+   *  changed. */
   void positionChanged();
 
+  /** Signals that the position in the audio playback in ms has changed. */
+  void positionMsChanged();
+
   /** Signals that the availability of the audio has changed. */
   void availabilityChanged();
 
   /** Signals that the ability to boost the audio has changed. */
   void canBoostChanged();
 
+  /** Signals that the markers or the recording time have changed. */
+  void metaDataChanged();
+
+  /** Signals that another latency profile was selected. */
+  void latencyProfileChanged();
+
+  /** Signals that another refresh rate was selected. */
+  void refreshRateChanged();
+
   /** Signals that the audio failed to load or play.
    *  @param message an error message that can be displayed to the user. */
   void error(const QString& message);
@@ -113,6 +198,13 @@ public slots:
    */
   void skipSeconds(int seconds);
 
+  /** Seek to the next or previous marker in the audio stream. When seeking
+   *  backwards, markers less than a second before the current position are
+   *  skipped, so that repeated calls don't get stuck on the same marker.
+   *  @param is_forward if true, seek to the next marker, otherwise to the
+   *                    previous one. */
+  void skipToMarker(bool is_forward);
+
   /** Switch between paused and playing states, depending on the current state:
    *  - if PLAYING of WAITING, switch to PAUSED
    *  - if PAUSED, switch to PLAYING
@@ -156,19 +248,61 @@ private slots:
    *  Needed to catch the end of audio situation. */
   void handleMediaStatusChanged(QMediaPlayer::MediaStatus status);
 
-  /** Callback for when the QAudioProbe received a new buffer. It will make
-      play back this buffer, possibly altered, to the m_playback_device. */
-  void handleAudioBuffer(const QAudioBuffer& buffer);
+  /** Carry out the seek that was held back by seekTo(), if any. */
+  void handleSeekTimer();
+
+  /** Callback for when the decoder stops intercepting the audio, so that it
+   *  can't be boosted anymore. */
+  void handleInterceptingChanged(bool is_intercepting);
+
+  /** Callback for when the SonicBooster is set up for the format of the
+   *  loaded file in the audio thread (see prepare()), with whether it can
+   *  amplify that format. */
+  void handleBoostability(bool is_boostable);
 
 private:
+  /** The tests check what happens in the audio thread of m_decoder. */
+  friend class AudioPlayerTest;
+
+  /** Reimplemented from AudioDecoder::Sink to set up the SonicBooster for the
+   *  format of the loaded file. This runs in the audio thread of the
+   *  AudioDecoder; the outcome is handed to handleBoostability() in the GUI
+   *  thread. */
+  void prepare(const QAudioFormat& format) override;
+
+  /** Reimplemented from AudioDecoder::Sink for when the AudioDecoder has new
+   *  audio data. It will play back this data, possibly altered, to the
+   *  playback device. This runs in the audio thread of the AudioDecoder. */
+  void processAudio(char* data, int num_bytes,
+                    const QAudioFormat& format) override;
+
   /** Set the PlayerState to the desired state. In response, the appriate
    *  signals will be sent.
    *  @param state the desired state */
   void setState(PlayerState state);
 
+  /** Seek to the given position in ms. Dragging the position slider or
+   *  holding down a skip key fires off seeks in rapid succession, so we only
+   *  carry out one seek per SEEK_INTERVAL; the others are held back and only
+   *  the last one of those is carried out when the interval has passed. The
+   *  reported position changes right away, though. */
+  void seekTo(qint64 ms);
+
+  /** The position in ms where we're heading: the position of a held back
+   *  seek, or the current position of the audio. */
+  qint64 targetPosition();
+
+  /** Send out the positionMsChanged() signal, and the positionChanged()
+   *  signal if the position in whole seconds differs from what we've reported
+   *  before. */
+  void reportPosition();
+
   /** The state that we're currently in. */
   PlayerState m_state;
 
+  /** The position in whole seconds that we've reported last. */
+  uint m_reported_position = 0;
+
   /** Initialize the audio device to which the audio data will be sent for the
    *  specific audio format. It needs to be called anytime the the audioformat
    *  changes, which is dictated by the QMediaPlayer but generally only happens
@@ -178,8 +312,37 @@ private:
   /** The main AudioDecoder instance for playing and seeking audio files. */
   AudioDecoder m_decoder;
 
-  /** The SonicBooster instance for amplifying the audio signal. */
+  /** The SonicBooster instance for amplifying the audio signal, and whether
+   *  it can amplify the format of the loaded file. The latter is only for
+   *  the GUI thread. */
   SonicBooster m_sonic_booster;
+  bool         m_is_boostable = false;
+
+  /** The timer for coalescing seeks, the position of the seek that is held
+   *  back (or -1 if there isn't one) and the number of seeks carried out. */
+  QTimer m_seek_timer;
+  qint64 m_pending_seek = -1;
+  int    m_num_seeks    = 0;
+
+  /** The minimum time between two seeks, in ms. */
+  const int SEEK_INTERVAL = 50;
+
+  /** The number of position updates per second, and the default. */
+  int       m_refresh_rate;
+  const int REFRESH_RATE = 10;
+
+  /** The latency profile to use if none was selected. Phones are better off
+   *  with large buffers. */
+#ifdef Q_OS_ANDROID
+  const LatencyProfile DEFAULT_LATENCY_PROFILE = POWER_SAVER;
+#else
+  const LatencyProfile DEFAULT_LATENCY_PROFILE = BALANCED;
+#endif
+
+  /** Keys for the settings. */
+  const QString CFG_GROUP           = "audio";
+  const QString CFG_LATENCY_PROFILE = "latency_profile";
+  const QString CFG_REFRESH_RATE    = "refresh_rate";
 
   /** When the audio fails to load, oftentimes multiple error messages are
    *  thrown by QMediaPlayer. We need to signal a problem just once to the end
@@ -188,18 +351,19 @@ private:
 
   /** Remember if we can boost the audio. We can get an indication for this from
    *  the AudioDecoded, but we can't know for sure until we actually try it. */
-  bool m_can_boost = false;
+  std::atomic<bool> m_can_boost{false};
 
   /** Message to display to the user if he tries to boost the audio, but this
    *  isn't possible.
    *  Unfortunately this check is somewhat complicated, because it depends on
    *  two factors; one, is the AudioDecoder sending raw audio data (vs. playing
    *  directly), and two, can the SonicBooster amplify this format. The second
-   *  question can only be answered when we're receiving a QAudioBuffer, but
+   *  question can only be answered when we're receiving audio data, but
    *  this doesn't happen at all if the first condition isn't met. So we're
    *  checking in two places: the boost() method when the user adjusts the
-   *  boost factor for the first condition, and the handleAudioBuffer() method
-   *  for the second factor. The we can use this message to report the error. */
+   *  boost factor for the first condition, and the handleBoostability()
+   *  method for the second factor. The we can use this message to report the
+   *  error. */
 #ifdef Q_OS_ANDROID
   const QString BOOST_UNSUPPORTED_MSG = tr("Sorry, but only .wav files can be amplified.");
 #else
@@ -0,0 +1,420 @@
+#include "decodethread.h"
+
+DecodeThread::DecodeThread(const QString& path, QObject* parent) :
+  QThread(parent),
+  m_path(path),
+  m_is_flac(FlacDecoder::isFlac(path)),
+  m_total_size(0),
+  m_requested_pos(-1),
+  m_is_done(false),
+  m_should_stop(false) {
+  qRegisterMetaType<QAudioFormat>();
+
+  if (m_cache.open()) {
+    m_cache_path = m_cache.fileName();
+    m_writer.setFileName(m_cache_path);
+    m_writer.open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+  }
+}
+
+DecodeThread::~DecodeThread() {
+  stop();
+}
+
+bool DecodeThread::canDecode(const QString& path) {
+#ifdef Q_OS_ANDROID
+  // If Android can't decode the file after all, the thread fails and the file
+  // is left to QMediaPlayer
+  Q_UNUSED(path);
+  return true;
+#else
+  static bool has_qt_decoder = QAudioDecoder().availability() ==
+                               QMultimedia::Available;
+  return has_qt_decoder || FlacDecoder::isFlac(path);
+#endif
+}
+
+qint64 DecodeThread::size() const {
+  qint64 total_size = m_total_size.load();
+  if (total_size > 0) return total_size;
+  return available(0);
+}
+
+qint64 DecodeThread::available(qint64 pos) const {
+  QMutexLocker locker(&m_ranges_mutex);
+  auto it = m_ranges.upperBound(pos);
+  if (it == m_ranges.constBegin()) return 0;
+  it--;
+  return qMax((qint64)0, it.value() - pos);
+}
+
+qint64 DecodeThread::decodedEnd() const {
+  QMutexLocker locker(&m_ranges_mutex);
+  if (m_ranges.isEmpty()) return 0;
+  return m_ranges.last();
+}
+
+void DecodeThread::stop() {
+  m_should_stop = true;
+  quit();
+  wait();
+}
+
+void DecodeThread::run() {
+  if (!m_writer.isOpen()) {
+    emit failed(tr("Can't create a cache file for decoding."));
+    return;
+  }
+
+  if (m_is_flac) {
+    decodeFlac();
+  } else {
+#ifdef Q_OS_ANDROID
+    decodeWithMediaCodec();
+#else
+    decodeWithQt();
+#endif
+  }
+}
+
+void DecodeThread::decodeFlac() {
+  FlacDecoder decoder(m_path);
+  if (!decoder.open()) {
+    emit failed(tr("The FLAC file can't be decoded."));
+    return;
+  }
+
+  m_encoding = PcmReader::SignedInt16;
+  m_format.setByteOrder(QAudioFormat::LittleEndian);
+  m_format.setCodec("audio/pcm");
+  m_format.setChannelCount(decoder.channelCount());
+  m_format.setSampleRate(decoder.sampleRate());
+  m_format.setSampleSize(16);
+  m_format.setSampleType(QAudioFormat::SignedInt);
+  int bytes_per_frame = m_format.bytesPerFrame();
+  m_total_size = decoder.numFrames() * bytes_per_frame;
+  emit formatKnown(m_format);
+  if (decoder.numFrames() > 0) {
+    emit durationKnown((decoder.numFrames() * 1000) / decoder.sampleRate());
+  }
+
+  // With a stored index, we can decode the parts that are needed first.
+  // Otherwise, we build the index while decoding from start to end.
+  bool   has_index        = m_index.load(m_path);
+  qint64 index_interval   = qMax(1, decoder.sampleRate() * INDEX_INTERVAL /
+                                    1000);
+  qint64 next_index_frame = 0;
+
+  // The position we're heading for after a jump. Until we get there, the
+  // decoder may run into parts that are decoded already.
+  qint64 target_pos = 0;
+
+  std::vector<qint16> samples;
+  bool is_complete = false;
+  while (!m_should_stop) {
+    // Go to the part that playback needs, if it isn't decoded yet
+    qint64 requested_pos = m_requested_pos.exchange(-1);
+    if (has_index && requested_pos >= 0 && available(requested_pos) == 0) {
+      requested_pos -= requested_pos % bytes_per_frame;
+      if (jumpTo(decoder, requested_pos / bytes_per_frame)) {
+        target_pos = requested_pos;
+      }
+    }
+
+    // FLAC frames are small, so we collect a few before writing them out
+    samples.clear();
+    qint64 first_frame = -1;
+    int    num_decoded = 0;
+    bool   has_error   = false;
+    for (int i = 0; i < FLAC_FRAMES_PER_WRITE && !has_error; i++) {
+      size_t prev_size = samples.size();
+      num_decoded = decoder.decodeFrame(samples);
+      if (num_decoded <= 0) break;
+
+      if (first_frame < 0) {
+        first_frame = decoder.frameSample();
+      } else if (decoder.frameSample() !=
+                 first_frame + (qint64)prev_size / decoder.channelCount()) {
+        // A corrupt frame was skipped, so this one goes elsewhere
+        has_error = !writeData(first_frame * bytes_per_frame,
+                               (const char*)samples.data(),
+                               prev_size * sizeof(qint16));
+        samples.erase(samples.begin(), samples.begin() + prev_size);
+        first_frame = decoder.frameSample();
+      }
+
+      if (!has_index && decoder.frameSample() >= next_index_frame) {
+        m_index.add(decoder.frameSample(), decoder.framePos());
+        next_index_frame = decoder.frameSample() + index_interval;
+      }
+    }
+    if (has_error || num_decoded < 0) break;
+
+    qint64 end_pos = 0;
+    if (first_frame >= 0) {
+      end_pos = first_frame * bytes_per_frame +
+                (qint64)samples.size() * sizeof(qint16);
+      if (!writeData(first_frame * bytes_per_frame,
+                     (const char*)samples.data(),
+                     samples.size() * sizeof(qint16))) {
+        break;
+      }
+    }
+
+    // When we reach the end of the file, we continue with the first part that
+    // isn't decoded yet, and we're done if there isn't any. When we catch up
+    // with a part that we decoded before, we skip over it.
+    qint64 gap_pos = -1;
+    if (num_decoded == 0) {
+      gap_pos = available(0);
+      if (gap_pos >= decodedEnd()) {
+        is_complete = true;
+        break;
+      }
+    } else if (end_pos >= target_pos && available(end_pos) > 0) {
+      gap_pos = end_pos + available(end_pos);
+      if (m_total_size > 0 && gap_pos >= m_total_size) {
+        gap_pos = available(0);
+        if (gap_pos >= m_total_size) {
+          is_complete = true;
+          break;
+        }
+      }
+    }
+    if (gap_pos >= 0) {
+      if (!jumpTo(decoder, gap_pos / bytes_per_frame)) break;
+      target_pos = gap_pos;
+    }
+  }
+
+  if (is_complete && !has_index) {
+    m_index.save(m_path);
+  }
+  finish();
+}
+
+bool DecodeThread::jumpTo(FlacDecoder& decoder, qint64 frame) {
+  SeekIndex::Entry entry;
+  if (!m_index.find(frame, entry)) return false;
+  decoder.seek(entry.offset);
+  return true;
+}
+
+#ifdef Q_OS_ANDROID
+void DecodeThread::decodeWithMediaCodec() {
+  MediaCodecDecoder decoder(m_path);
+  if (!decoder.open()) {
+    emit failed(tr("The file can't be decoded."));
+    return;
+  }
+
+  m_encoding = PcmReader::SignedInt16;
+  m_format.setByteOrder(QAudioFormat::LittleEndian);
+  m_format.setCodec("audio/pcm");
+  m_format.setChannelCount(decoder.channelCount());
+  m_format.setSampleRate(decoder.sampleRate());
+  m_format.setSampleSize(16);
+  m_format.setSampleType(QAudioFormat::SignedInt);
+  int bytes_per_frame = m_format.bytesPerFrame();
+  m_total_size = decoder.numFrames() * bytes_per_frame;
+  emit formatKnown(m_format);
+  if (decoder.numFrames() > 0) {
+    emit durationKnown((decoder.numFrames() * 1000) / decoder.sampleRate());
+  }
+
+  // The position we're heading for after a jump, and the audio frame we
+  // asked the decoder to go to for it
+  qint64 target_pos = 0;
+  qint64 seek_frame = 0;
+
+  std::vector<qint16> samples;
+  while (!m_should_stop) {
+    // Go to the part that playback needs, if it isn't decoded yet
+    qint64 requested_pos = m_requested_pos.exchange(-1);
+    if (requested_pos >= 0 && available(requested_pos) == 0) {
+      requested_pos -= requested_pos % bytes_per_frame;
+      seek_frame = requested_pos / bytes_per_frame;
+      decoder.seek(seek_frame);
+      target_pos = requested_pos;
+    }
+
+    samples.clear();
+    int num_decoded = decoder.decode(samples);
+    if (num_decoded < 0) break;
+
+    qint64 end_pos = 0;
+    if (num_decoded > 0) {
+      qint64 pos = decoder.frameSample() * bytes_per_frame;
+      if (pos > target_pos && seek_frame > 0 &&
+          available(target_pos) == 0) {
+        // The decoder landed beyond the part we need, which would leave a
+        // hole; try again a second earlier
+        seek_frame = qMax((qint64)0, seek_frame - decoder.sampleRate());
+        decoder.seek(seek_frame);
+        continue;
+      }
+      end_pos = pos + (qint64)samples.size() * sizeof(qint16);
+      if (!writeData(pos, (const char*)samples.data(),
+                     samples.size() * sizeof(qint16))) {
+        break;
+      }
+    }
+
+    // Like with FLAC files, we continue with the first part that isn't
+    // decoded yet when we reach the end of the file or catch up with a part
+    // that we decoded before
+    qint64 gap_pos = -1;
+    if (num_decoded == 0) {
+      gap_pos = available(0);
+      if (gap_pos >= decodedEnd()) break;
+    } else if (end_pos >= target_pos && available(end_pos) > 0) {
+      gap_pos = end_pos + available(end_pos);
+      if (m_total_size > 0 && gap_pos >= m_total_size) {
+        gap_pos = available(0);
+        if (gap_pos >= m_total_size) break;
+      }
+    }
+    if (gap_pos >= 0) {
+      seek_frame = gap_pos / bytes_per_frame;
+      decoder.seek(seek_frame);
+      target_pos = gap_pos;
+    }
+  }
+
+  finish();
+}
+#endif
+
+void DecodeThread::decodeWithQt() {
+  // The decoder lives in this thread, so its signals are handled here as well
+  QAudioDecoder decoder;
+  decoder.setSourceFilename(m_path);
+  connect(&decoder, &QAudioDecoder::bufferReady, [this, &decoder]() {
+    if (!writeBuffers(decoder)) finish();
+  });
+  connect(&decoder, &QAudioDecoder::durationChanged, [this](qint64 duration) {
+    if (duration <= 0) return;
+    m_duration = duration;
+    if (m_format.isValid() &&
+        !fitsInCache(m_format.bytesForDuration(duration * 1000))) {
+      return;
+    }
+    emit durationKnown(duration);
+  });
+  connect(&decoder, &QAudioDecoder::finished, [this, &decoder]() {
+    writeBuffers(decoder);
+    finish();
+  });
+  connect(&decoder,
+          static_cast<void (QAudioDecoder::*)(QAudioDecoder::Error)>(
+            &QAudioDecoder::error),
+          [this, &decoder]() {
+    if (m_format.isValid()) {
+      // We've got some audio, so make the best of it
+      finish();
+    } else {
+      emit failed(decoder.errorString());
+      quit();
+    }
+  });
+
+  decoder.start();
+  exec();
+  decoder.stop();
+}
+
+bool DecodeThread::writeBuffers(QAudioDecoder& decoder) {
+  while (decoder.bufferAvailable()) {
+    QAudioBuffer buffer = decoder.read();
+    if (!buffer.isValid()) continue;
+
+    if (!m_format.isValid()) {
+      if (!PcmReader::encodingForFormat(buffer.format(), m_encoding)) {
+        emit failed(tr("The decoded audio has an unsupported format."));
+        quit();
+        return false;
+      }
+      m_format = buffer.format();
+      if (m_encoding != PcmReader::UnsignedInt8) {
+        m_format.setSampleSize(16);
+        m_format.setSampleType(QAudioFormat::SignedInt);
+      }
+      if (m_duration > 0 &&
+          !fitsInCache(m_format.bytesForDuration(m_duration * 1000))) {
+        return false;
+      }
+      emit formatKnown(m_format);
+    } else if (buffer.format().sampleRate()   != m_format.sampleRate() ||
+               buffer.format().channelCount() != m_format.channelCount()) {
+      // We can't handle format changes halfway
+      continue;
+    }
+
+    const char* data      = (const char*)buffer.constData();
+    qint64      num_bytes = buffer.byteCount();
+    int sample_size = PcmReader::bytesPerSample(m_encoding);
+    if (sample_size > 2) {
+      qint64 num_samples = num_bytes / sample_size;
+      if ((qint64)m_converted.size() < num_samples) {
+        m_converted.resize(num_samples);
+      }
+      PcmReader::convert(m_encoding, (const uchar*)data, m_converted.data(),
+                         num_samples);
+      data      = (const char*)m_converted.data();
+      num_bytes = num_samples * 2;
+    }
+
+    if (!fitsInCache(m_write_pos + num_bytes)) return false;
+    if (!writeData(m_write_pos, data, num_bytes)) return false;
+    m_write_pos += num_bytes;
+  }
+  return true;
+}
+
+bool DecodeThread::writeData(qint64 pos, const char* data, qint64 num_bytes) {
+  if (num_bytes == 0) return true;
+
+  // The writer doesn't buffer, so the data is in the file before anyone may
+  // read it
+  if (!m_writer.seek(pos) || m_writer.write(data, num_bytes) != num_bytes) {
+    return false;
+  }
+
+  // Merge the new part with the parts it overlaps or touches
+  QMutexLocker locker(&m_ranges_mutex);
+  qint64 start = pos;
+  qint64 end   = pos + num_bytes;
+  auto it = m_ranges.upperBound(start);
+  if (it != m_ranges.begin() && (it - 1).value() >= start) {
+    it--;
+    start = it.key();
+    end   = qMax(end, it.value());
+    it    = m_ranges.erase(it);
+  }
+  while (it != m_ranges.end() && it.key() <= end) {
+    end = qMax(end, it.value());
+    it  = m_ranges.erase(it);
+  }
+  m_ranges.insert(start, end);
+  return true;
+}
+
+bool DecodeThread::fitsInCache(qint64 size) {
+  if (size <= MAX_CACHE_SIZE) return true;
+  if (m_is_too_long) return false; // We've said so already
+
+  m_is_too_long = true;
+  emit failed(tr("The file is too long to decode."));
+  quit();
+  return false;
+}
+
+void DecodeThread::finish() {
+  if (m_is_done || m_is_too_long) return;
+
+  // Only what's decoded from the start onwards counts
+  m_total_size = available(0);
+  m_is_done    = true;
+  emit done();
+  quit();
+}
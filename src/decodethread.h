@@ -0,0 +1,207 @@
+#ifndef DECODETHREAD_H
+#define DECODETHREAD_H
+
+#include <QThread>
+
+#include <QAudioBuffer>
+#include <QAudioDecoder>
+#include <QAudioFormat>
+#include <QFile>
+#include <QMap>
+#include <QMutex>
+#include <QString>
+#include <QTemporaryFile>
+
+#include <atomic>
+#include <vector>
+
+#include "flacdecoder.h"
+#include "pcmreader.h"
+#include "seekindex.h"
+#ifdef Q_OS_ANDROID
+#include "mediacodecdecoder.h"
+#endif
+
+/** A thread that decodes a compressed audio file into a temporary cache file
+ *  of raw audio data, once. FLAC files are decoded by our
+ *  own FlacDecoder, so that they can be handled on every platform; other
+ *  formats are decoded by QAudioDecoder, if the platform supports it. Android
+ *  doesn't, so there the MediaCodecDecoder does the job with the codecs of
+ *  the system.
+ *  The cache file is removed when the thread is deleted.
+ *  The cache can be read at random by a PcmReader (see PcmReader::setSource())
+ *  while the thread is still writing to it. This way every file is decoded
+ *  only once, no matter how often the user skips around, and playback can
+ *  start as soon as the first buffer is decoded.
+ *
+ *  While decoding a FLAC file for the first time, the thread builds a
+ *  SeekIndex of it. The next time the file is opened, the thread uses the
+ *  index to decode the part that is needed for playback first (see
+ *  requestPosition()), so there's no need to wait for the decoder to get
+ *  there. The audio data is stored at its own position in the cache file, so
+ *  the cache may have holes that are filled in later on. Other files aren't
+ *  indexed: QAudioDecoder can only decode from start to end (see
+ *  isSequential()), and the cache of the files it decodes is limited to
+ *  MAX_CACHE_SIZE; the thread fails on files that are longer. The
+ *  MediaCodecDecoder doesn't need an index, it can seek by itself.
+ *  Like PcmReader, the thread converts everything but 8 bit data to 16 bit
+ *  signed samples before writing it to the cache. This also keeps the cache
+ *  small for decoders that hand out floating point data. */
+class DecodeThread : public QThread, public PcmReader::Source {
+  Q_OBJECT
+
+public:
+  /** Prepare decoding the file at path. Decoding starts with start(). */
+  explicit DecodeThread(const QString& path, QObject* parent = 0);
+
+  /** Stop the thread and wait for it to finish. */
+  ~DecodeThread();
+
+  /** Indicate whether we may be able to decode the file at path; either
+   *  because it is a FLAC file or because QAudioDecoder or MediaCodecDecoder
+   *  is available on this platform. */
+  static bool canDecode(const QString& path);
+
+  /** Indicate whether the file is decoded by QAudioDecoder, which can only
+   *  decode from start to end. Getting to a position far beyond what's
+   *  decoded may take a long time then. */
+  bool isSequential() const {
+#ifdef Q_OS_ANDROID
+    return false;
+#else
+    return !m_is_flac;
+#endif
+  }
+
+  /** The path of the cache file, which contains the decoded audio data in the
+   *  format sent with the formatKnown() signal. */
+  QString cachePath() const {return m_cache_path;}
+
+  /** Reimplemented from PcmReader::Source. The size is the total size of the
+   *  decoded audio if the decoder knows it, or what's decoded from the start
+   *  so far otherwise. */
+  qint64 size() const override;
+  qint64 available(qint64 pos) const override;
+
+  /** Indicate that playback needs the audio data at pos in the cache file.
+   *  If it isn't decoded yet and we have a SeekIndex (or the decoder can seek
+   *  by itself), decoding continues from there. This may be called from any
+   *  thread. */
+  void requestPosition(qint64 pos) {m_requested_pos = pos;}
+
+  /** Indicate whether the file is completely decoded (or decoding ran into an
+   *  error after the first buffer). */
+  bool isDone() const {return m_is_done.load();}
+
+  /** Ask the thread to finish and wait until it does. */
+  void stop();
+
+signals:
+  /** Sent when the first buffer is decoded, with the format of the data in
+   *  the cache file. */
+  void formatKnown(const QAudioFormat& format);
+
+  /** Sent when the decoder knows (or changes its mind about) the duration of
+   *  the audio, in ms. */
+  void durationKnown(qint64 duration);
+
+  /** Sent when the complete file is decoded. */
+  void done();
+
+  /** Sent if the file can't be decoded at all, or if its decoded audio
+   *  doesn't fit in the cache. In the latter case, the part that is decoded
+   *  already can still be read. */
+  void failed(const QString& message);
+
+protected:
+  void run() override;
+
+private:
+  /** Decode the file with FlacDecoder, QAudioDecoder or MediaCodecDecoder. */
+  void decodeFlac();
+  void decodeWithQt();
+#ifdef Q_OS_ANDROID
+  void decodeWithMediaCodec();
+#endif
+
+  /** Write all buffers that QAudioDecoder has available to the cache file.
+   *  @return false if we can't continue. */
+  bool writeBuffers(QAudioDecoder& decoder);
+
+  /** Write num_bytes of audio data in m_format to the cache file at pos, and
+   *  make it available for reading.
+   *  @return false if the data can't be written. */
+  bool writeData(qint64 pos, const char* data, qint64 num_bytes);
+
+  /** Indicate whether audio data of the given size, in bytes of m_format,
+   *  fits in the cache of a file that QAudioDecoder decodes. If not, the
+   *  failed() signal is sent and the thread stops. */
+  bool fitsInCache(qint64 size);
+
+  /** The end of the last decoded part of the cache file. */
+  qint64 decodedEnd() const;
+
+  /** Let the FLAC decoder continue from the last index entry before the given
+   *  audio frame.
+   *  @return false if there's no such entry. */
+  bool jumpTo(FlacDecoder& decoder, qint64 frame);
+
+  /** Mark the cache file as complete and stop the event loop. */
+  void finish();
+
+  QString m_path;
+  bool    m_is_flac;
+
+  /** The cache file. It is written through m_writer, which doesn't buffer, so
+   *  that PcmReader sees the data as soon as it is written. Both are only
+   *  accessed from the thread itself. */
+  QTemporaryFile m_cache;
+  QFile          m_writer;
+  QString        m_cache_path;
+
+  /** The format and encoding of the decoded data, set on the first buffer. */
+  QAudioFormat        m_format;
+  PcmReader::Encoding m_encoding = PcmReader::SignedInt16;
+
+  /** Scratch space for converting buffers to 16 bit. */
+  std::vector<qint16> m_converted;
+
+  /** The position in the cache file where the next buffer of QAudioDecoder is
+   *  written, and the duration that it reported, in ms. */
+  qint64 m_write_pos = 0;
+  qint64 m_duration  = 0;
+
+  /** Indicate if the audio turned out not to fit in the cache. The decoding
+   *  isn't done then, it failed. */
+  bool m_is_too_long = false;
+
+  /** The parts of the cache file that are decoded, as a map from start to
+   *  end positions. Adjacent parts are merged. */
+  QMap<qint64, qint64> m_ranges;
+  mutable QMutex       m_ranges_mutex;
+
+  SeekIndex m_index;
+
+  /** The total size of the decoded audio, or 0 if it isn't known. */
+  std::atomic<qint64> m_total_size;
+
+  /** The position that playback needs, or -1 if there's no request. */
+  std::atomic<qint64> m_requested_pos;
+
+  std::atomic<bool> m_is_done;
+  std::atomic<bool> m_should_stop;
+
+  /** The number of FLAC frames we decode before writing to the cache file. */
+  const int FLAC_FRAMES_PER_WRITE = 8;
+
+  /** The amount of audio between the entries of the SeekIndex, in ms. */
+  const int INDEX_INTERVAL = 500;
+
+  /** The maximum size of the cache of a file that QAudioDecoder decodes, in
+   *  bytes. This is about 50 minutes of stereo audio at 44.1 kHz. The cache
+   *  may well be in memory, and longer files are better left to QMediaPlayer,
+   *  which can seek in them without decoding everything up to there. */
+  const qint64 MAX_CACHE_SIZE = 512 * 1024 * 1024;
+};
+
+#endif // DECODETHREAD_H
@@ -0,0 +1,471 @@
+#include "flacdecoder.h"
+
+FlacDecoder::FlacDecoder(const QString& path) : m_file(path) {}
+
+bool FlacDecoder::isFlac(const QString& path) {
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly)) return false;
+  return findStreamStart(file) >= 0;
+}
+
+qint64 FlacDecoder::findStreamStart(QIODevice& file) {
+  if (!file.seek(0)) return -1;
+  QByteArray header = file.read(10);
+  qint64 pos = 0;
+  if (header.size() == 10 && header.startsWith("ID3")) {
+    // Skip the ID3v2 tag. Its size is stored in four 7 bit bytes, and it may
+    // be followed by a footer.
+    const uchar* data = (const uchar*)header.constData();
+    pos = 10 + ((data[6] & 0x7F) << 21 | (data[7] & 0x7F) << 14 |
+                (data[8] & 0x7F) << 7  | (data[9] & 0x7F));
+    if (data[5] & 0x10) pos += 10;
+    if (!file.seek(pos)) return -1;
+    header = file.read(4);
+  }
+  if (!header.startsWith("fLaC")) return -1;
+  return pos;
+}
+
+bool FlacDecoder::open() {
+  if (!m_file.open(QIODevice::ReadOnly)) return false;
+  qint64 pos = findStreamStart(m_file);
+  if (pos < 0) return false;
+  pos += 4;
+
+  // Walk through the metadata blocks. We only need the STREAMINFO block.
+  bool has_stream_info = false;
+  bool is_last         = false;
+  while (!is_last) {
+    if (!m_file.seek(pos)) return false;
+    QByteArray header = m_file.read(4);
+    if (header.size() < 4) return false;
+    const uchar* data = (const uchar*)header.constData();
+    is_last     = data[0] & 0x80;
+    int type    = data[0] & 0x7F;
+    qint64 size = data[1] << 16 | data[2] << 8 | data[3];
+
+    if (type == 0) {
+      if (size < 34) return false;
+      QByteArray info = m_file.read(34);
+      if (info.size() < 34) return false;
+      const uchar* info_data = (const uchar*)info.constData();
+
+      // Sample rate (20 bits), channels - 1 (3), bits per sample - 1 (5) and
+      // the total number of samples (36)
+      m_min_block_size   = qFromBigEndian<quint16>(info_data);
+      m_max_block_size   = qFromBigEndian<quint16>(info_data + 2);
+      quint64 packed     = qFromBigEndian<quint64>(info_data + 10);
+      m_sample_rate      = packed >> 44;
+      m_num_channels     = ((packed >> 41) & 0x07) + 1;
+      m_bits_per_sample  = ((packed >> 36) & 0x1F) + 1;
+      m_num_frames       = packed & Q_UINT64_C(0xFFFFFFFFF);
+      has_stream_info    = true;
+    }
+    pos += 4 + size;
+  }
+
+  if (!has_stream_info || m_sample_rate <= 0 ||
+      m_bits_per_sample < 4 || m_bits_per_sample > 24) {
+    return false;
+  }
+
+  m_frame_pos = pos;
+  m_block_pos = pos;
+  m_block.clear();
+  return true;
+}
+
+int FlacDecoder::decodeFrame(std::vector<qint16>& out) {
+  // Frames are normally much smaller than a block, but we can't rule out
+  // larger ones
+  qint64 frame_size = qMax((qint64)BLOCK_SIZE,
+                           (qint64)m_max_block_size * m_num_channels *
+                           (m_bits_per_sample + 1) / 8 + 1024);
+  while (true) {
+    if (!fillBlock(frame_size)) return -1;
+    qint64 block_end = m_block_pos + (qint64)m_block.size();
+    if (m_frame_pos >= block_end) return 0;
+
+    int num_frames = tryFrame();
+    if (isOverrun()) {
+      if (block_end < m_file.size()) {
+        // The frame is larger than we thought
+        frame_size *= 2;
+        continue;
+      }
+      return 0; // The file is cut off halfway a frame
+    }
+
+    if (num_frames > 0) {
+      m_last_frame_pos    = m_frame_pos;
+      m_last_frame_sample = m_frame_sample;
+      m_frame_pos        += m_frame_size;
+
+      // Convert to interleaved 16 bit samples
+      size_t out_pos = out.size();
+      out.resize(out_pos + (size_t)num_frames * m_num_channels);
+      qint16* out_data = out.data() + out_pos;
+      int shift = m_bits_per_sample - 16;
+      for (int i = 0; i < num_frames; i++) {
+        for (int channel = 0; channel < m_num_channels; channel++) {
+          qint32 sample = m_samples[channel][i];
+          if (shift >= 0) {
+            *out_data++ = sample >> shift;
+          } else {
+            *out_data++ = sample * (1 << -shift);
+          }
+        }
+      }
+      return num_frames;
+    }
+
+    // There's no valid frame here, so look for the next frame sync code
+    qint64 pos = m_frame_pos + 1;
+    while (pos + 1 < block_end &&
+           !(m_block[pos - m_block_pos] == 0xFF &&
+             (m_block[pos + 1 - m_block_pos] & 0xFE) == 0xF8)) {
+      pos++;
+    }
+    if (pos + 1 >= block_end) {
+      if (block_end >= m_file.size()) return 0;
+      pos = block_end - 1; // Continue with the next block
+    }
+    m_frame_pos = pos;
+  }
+}
+
+bool FlacDecoder::fillBlock(qint64 num_bytes) {
+  qint64 block_end = m_block_pos + (qint64)m_block.size();
+  qint64 file_size = m_file.size();
+  if (m_frame_pos < m_block_pos ||
+      (m_frame_pos + num_bytes > block_end && block_end < file_size)) {
+    qint64 size = qMax((qint64)0, qMin(qMax((qint64)BLOCK_SIZE, num_bytes),
+                                       file_size - m_frame_pos));
+    m_block.resize(size);
+    if (!m_file.seek(m_frame_pos)) return false;
+    qint64 num_read = m_file.read((char*)m_block.data(), size);
+    if (num_read < 0) return false;
+    m_block.resize(num_read);
+    m_block_pos = m_frame_pos;
+  }
+  startBits(m_frame_pos - m_block_pos);
+  return true;
+}
+
+int FlacDecoder::tryFrame() {
+  int start = m_frame_pos - m_block_pos;
+
+  // The sync code (14 bits), a reserved bit and the blocking strategy
+  if (readBits(15) != 0x7FFC) return 0;
+  bool is_variable = readBits(1);
+  int block_size_code  = readBits(4);
+  int sample_rate_code = readBits(4);
+  int channel_code     = readBits(4);
+  int sample_size_code = readBits(3);
+  if (readBits(1) != 0) return 0;
+
+  // The frame number (for a fixed block size) or the sample number (for a
+  // variable block size), coded like UTF-8
+  quint32 first_byte = readBits(8);
+  int num_ones = 0;
+  while (num_ones < 8 && (first_byte & (0x80 >> num_ones))) num_ones++;
+  if (num_ones == 1 || num_ones > 7) return 0;
+  qint64 number = first_byte & (0x7F >> num_ones);
+  for (int i = 1; i < num_ones; i++) {
+    quint32 byte = readBits(8);
+    if ((byte & 0xC0) != 0x80) return 0;
+    number = (number << 6) | (byte & 0x3F);
+  }
+
+  int block_size;
+  switch (block_size_code) {
+    case 0: return 0;
+    case 1: block_size = 192; break;
+    case 2: case 3: case 4: case 5:
+      block_size = 576 << (block_size_code - 2);
+      break;
+    case 6: block_size = readBits(8) + 1;  break;
+    case 7: block_size = readBits(16) + 1; break;
+    default: block_size = 256 << (block_size_code - 8);
+  }
+
+  // We go by the sample rate from the STREAMINFO block, but we need to skip
+  // the one in the header
+  switch (sample_rate_code) {
+    case 12: readBits(8); break;
+    case 13: case 14: readBits(16); break;
+    case 15: return 0;
+  }
+
+  int bits_per_sample;
+  switch (sample_size_code) {
+    case 0: bits_per_sample = m_bits_per_sample; break;
+    case 1: bits_per_sample = 8;  break;
+    case 2: bits_per_sample = 12; break;
+    case 4: bits_per_sample = 16; break;
+    case 5: bits_per_sample = 20; break;
+    case 6: bits_per_sample = 24; break;
+    default: return 0;
+  }
+
+  // Changes of format halfway aren't supported
+  int num_channels = (channel_code < 8) ? channel_code + 1 : 2;
+  if (channel_code > 10 || num_channels != m_num_channels ||
+      bits_per_sample != m_bits_per_sample) {
+    return 0;
+  }
+
+  int header_size = bytePos() - start;
+  quint8 header_crc = readBits(8);
+  if (isOverrun()) return 0;
+  if (crc8(m_block.data() + start, header_size) != header_crc) return 0;
+
+  // The subframes. The side channel of a stereo pair needs an extra bit.
+  for (int channel = 0; channel < num_channels; channel++) {
+    int channel_bits = bits_per_sample;
+    if (((channel_code == 8 || channel_code == 10) && channel == 1) ||
+        (channel_code == 9 && channel == 0)) {
+      channel_bits++;
+    }
+    m_samples[channel].resize(block_size);
+    if (!decodeSubframe(m_samples[channel].data(), block_size, channel_bits)) {
+      return 0;
+    }
+    if (isOverrun()) return 0;
+  }
+
+  alignBits();
+  int size = bytePos() - start;
+  quint16 frame_crc = readBits(16);
+  if (isOverrun()) return 0;
+  if (crc16(m_block.data() + start, size) != frame_crc) return 0;
+  m_frame_size = size + 2;
+
+  // All frames but the last one have the same size if the block size is fixed
+  if (is_variable) {
+    m_frame_sample = number;
+  } else {
+    int fixed_block_size = (m_min_block_size == m_max_block_size) ?
+                           m_max_block_size : block_size;
+    m_frame_sample = number * fixed_block_size;
+  }
+
+  // Undo the stereo decorrelation
+  if (channel_code >= 8) {
+    qint32* left  = m_samples[0].data();
+    qint32* right = m_samples[1].data();
+    for (int i = 0; i < block_size; i++) {
+      if (channel_code == 8) {        // Left and side
+        right[i] = left[i] - right[i];
+      } else if (channel_code == 9) { // Side and right
+        left[i] += right[i];
+      } else {                        // Mid and side
+        qint32 side = right[i];
+        qint32 mid  = left[i] * 2 + (side & 1);
+        left[i]  = (mid + side) >> 1;
+        right[i] = (mid - side) >> 1;
+      }
+    }
+  }
+
+  return block_size;
+}
+
+bool FlacDecoder::decodeSubframe(qint32* samples, int num_samples,
+                                 int bits_per_sample) {
+  if (readBits(1) != 0) return false;
+  int type = readBits(6);
+
+  // Samples may have a number of zero bits at the least significant end
+  int wasted_bits = 0;
+  if (readBits(1)) wasted_bits = readUnary() + 1;
+  if (wasted_bits >= bits_per_sample) return false;
+  bits_per_sample -= wasted_bits;
+
+  if (type == 0) {
+    // Constant
+    qint32 value = readSigned(bits_per_sample);
+    for (int i = 0; i < num_samples; i++) samples[i] = value;
+  } else if (type == 1) {
+    // Verbatim
+    for (int i = 0; i < num_samples; i++) {
+      samples[i] = readSigned(bits_per_sample);
+    }
+  } else if (type >= 8 && type <= 12) {
+    // Fixed polynomial predictor
+    int order = type - 8;
+    if (order > num_samples) return false;
+    for (int i = 0; i < order; i++) samples[i] = readSigned(bits_per_sample);
+    if (!decodeResidual(samples, num_samples, order)) return false;
+
+    for (int i = order; i < num_samples; i++) {
+      qint64 prediction = 0;
+      switch (order) {
+        case 1: prediction = samples[i - 1]; break;
+        case 2: prediction = 2 * (qint64)samples[i - 1] - samples[i - 2]; break;
+        case 3: prediction = 3 * ((qint64)samples[i - 1] - samples[i - 2]) +
+                             samples[i - 3];
+                break;
+        case 4: prediction = 4 * ((qint64)samples[i - 1] + samples[i - 3]) -
+                             6 * (qint64)samples[i - 2] - samples[i - 4];
+                break;
+      }
+      samples[i] += (qint32)prediction;
+    }
+  } else if (type >= 32) {
+    // Linear predictor
+    int order = type - 31;
+    if (order > num_samples) return false;
+    for (int i = 0; i < order; i++) samples[i] = readSigned(bits_per_sample);
+
+    int precision = readBits(4) + 1;
+    int shift     = readSigned(5);
+    if (precision == 16 || shift < 0) return false;
+    qint32 coefs[32];
+    for (int i = 0; i < order; i++) coefs[i] = readSigned(precision);
+    if (!decodeResidual(samples, num_samples, order)) return false;
+
+    for (int i = order; i < num_samples; i++) {
+      qint64 prediction = 0;
+      for (int j = 0; j < order; j++) {
+        prediction += (qint64)coefs[j] * samples[i - 1 - j];
+      }
+      samples[i] += (qint32)(prediction >> shift);
+    }
+  } else {
+    return false; // Reserved
+  }
+
+  if (wasted_bits > 0) {
+    for (int i = 0; i < num_samples; i++) samples[i] *= (1 << wasted_bits);
+  }
+  return true;
+}
+
+bool FlacDecoder::decodeResidual(qint32* samples, int num_samples,
+                                 int order) {
+  // Rice coding with 4 or 5 bit parameters, in 2^n partitions
+  int method = readBits(2);
+  if (method > 1) return false;
+  int     param_bits = (method == 0) ? 4 : 5;
+  quint32 escape     = (1u << param_bits) - 1;
+
+  int partition_order = readBits(4);
+  int partition_size  = num_samples >> partition_order;
+  if ((partition_size << partition_order) != num_samples ||
+      partition_size < order) {
+    return false;
+  }
+
+  // The first partition is shorter, as it doesn't contain the warm-up samples
+  int pos = order;
+  for (int partition = 0; partition < (1 << partition_order); partition++) {
+    int     end   = (partition + 1) * partition_size;
+    quint32 param = readBits(param_bits);
+    if (param == escape) {
+      // Unencoded, with a fixed number of bits
+      int num_bits = readBits(5);
+      for (; pos < end; pos++) samples[pos] = readSigned(num_bits);
+    } else {
+      for (; pos < end; pos++) {
+        quint32 value = (readUnary() << param) | readBits(param);
+        samples[pos]  = (qint32)(value >> 1) ^ -(qint32)(value & 1);
+      }
+    }
+    if (isOverrun()) return false;
+  }
+  return true;
+}
+
+void FlacDecoder::startBits(int byte_offset) {
+  m_byte_pos   = byte_offset;
+  m_cache      = 0;
+  m_cache_bits = 0;
+}
+
+void FlacDecoder::refillCache() {
+  while (m_cache_bits <= 56) {
+    quint64 byte = 0;
+    if (m_byte_pos < (int)m_block.size()) byte = m_block[m_byte_pos];
+    m_byte_pos++;
+    m_cache      |= byte << (56 - m_cache_bits);
+    m_cache_bits += 8;
+  }
+}
+
+quint32 FlacDecoder::readBits(int num_bits) {
+  if (num_bits == 0) return 0;
+  if (m_cache_bits < num_bits) refillCache();
+  quint32 value = m_cache >> (64 - num_bits);
+  m_cache      <<= num_bits;
+  m_cache_bits  -= num_bits;
+  return value;
+}
+
+qint32 FlacDecoder::readSigned(int num_bits) {
+  if (num_bits == 0) return 0;
+  quint32 value = readBits(num_bits);
+  if (num_bits < 32 && (value & (1u << (num_bits - 1)))) {
+    value |= ~0u << num_bits; // Sign extension
+  }
+  return (qint32)value;
+}
+
+quint32 FlacDecoder::readUnary() {
+  quint32 count = 0;
+  while (true) {
+    if (m_cache == 0) {
+      // Only zeros in the cache
+      count       += m_cache_bits;
+      m_cache_bits = 0;
+      refillCache();
+      if (isOverrun()) return count;
+      continue;
+    }
+    int num_zeros = qCountLeadingZeroBits(m_cache);
+    m_cache      <<= num_zeros;
+    m_cache      <<= 1;
+    m_cache_bits  -= num_zeros + 1;
+    return count + num_zeros;
+  }
+}
+
+void FlacDecoder::alignBits() {
+  int num_bits = m_cache_bits % 8;
+  m_cache      <<= num_bits;
+  m_cache_bits  -= num_bits;
+}
+
+quint8 FlacDecoder::crc8(const uchar* data, int size) {
+  // Polynomial x^8 + x^2 + x^1 + x^0
+  quint8 crc = 0;
+  for (int i = 0; i < size; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+quint16 FlacDecoder::crc16(const uchar* data, int size) {
+  // Polynomial x^16 + x^15 + x^2 + x^0. This covers the complete frame, so we
+  // use a lookup table.
+  static const std::vector<quint16> table = []() {
+    std::vector<quint16> table(256);
+    for (int i = 0; i < 256; i++) {
+      quint16 crc = i << 8;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1;
+      }
+      table[i] = crc;
+    }
+    return table;
+  }();
+
+  quint16 crc = 0;
+  for (int i = 0; i < size; i++) {
+    crc = (crc << 8) ^ table[(crc >> 8) ^ data[i]];
+  }
+  return crc;
+}
@@ -0,0 +1,147 @@
+#ifndef FLACDECODER_H
+#define FLACDECODER_H
+
+#include <QFile>
+#include <QString>
+#include <QtAlgorithms>
+#include <QtEndian>
+
+#include <vector>
+
+/** A decoder for FLAC files, so that we don't depend on the platform for this
+ *  popular lossless format.
+ *  The decoder reads the file sequentially, frame by frame, and hands out the
+ *  audio as interleaved 16 bit signed samples, like PcmReader does for wav
+ *  files with larger samples. All features of the format are supported, except
+ *  for samples larger than 24 bits and files with more than 8 channels.
+ *  Corrupt frames (that fail their CRC check) are skipped.
+ *  An instance may be used from any thread, but from only one thread at a
+ *  time. */
+class FlacDecoder {
+
+public:
+  explicit FlacDecoder(const QString& path);
+
+  /** Indicate whether the file at path looks like a FLAC file. */
+  static bool isFlac(const QString& path);
+
+  /** Open the file and read the metadata.
+   *  @return false if this isn't a FLAC file we can decode. */
+  bool open();
+
+  int channelCount() const {return m_num_channels;}
+  int sampleRate() const {return m_sample_rate;}
+
+  /** The number of bits per sample in the file. The audio is always handed
+   *  out as 16 bit samples. */
+  int bitsPerSample() const {return m_bits_per_sample;}
+
+  /** The total number of audio frames (samples per channel), or 0 if it isn't
+   *  known. */
+  qint64 numFrames() const {return m_num_frames;}
+
+  /** The position in the file of the next FLAC frame to be decoded. */
+  qint64 filePos() const {return m_frame_pos;}
+
+  /** The position in the file of the last decoded FLAC frame, and the
+   *  position of its first sample in the audio, in audio frames. Together
+   *  these make an entry for a SeekIndex. */
+  qint64 framePos() const {return m_last_frame_pos;}
+  qint64 frameSample() const {return m_last_frame_sample;}
+
+  /** Continue decoding from the given position in the file, which should be
+   *  the start of a FLAC frame (from framePos()). */
+  void seek(qint64 file_pos) {m_frame_pos = file_pos;}
+
+  /** Decode the next FLAC frame and append its audio to out, as interleaved
+   *  16 bit signed samples.
+   *  @return the number of audio frames decoded, 0 at the end of the file, or
+   *          -1 if the file can't be read. */
+  int decodeFrame(std::vector<qint16>& out);
+
+private:
+  /** Return the position of the "fLaC" signature in the file, which may be
+   *  preceded by an ID3v2 tag, or -1 if it can't be found. */
+  static qint64 findStreamStart(QIODevice& file);
+
+  /** Make sure that at least num_bytes bytes from m_frame_pos onwards are in
+   *  m_block (or the rest of the file, if that's shorter), and point the bit
+   *  reader at m_frame_pos.
+   *  @return false if the file can't be read. */
+  bool fillBlock(qint64 num_bytes);
+
+  /** Try to decode a frame at m_frame_pos into m_samples, and set
+   *  m_frame_size and m_frame_sample.
+   *  @return the number of audio frames in it, or 0 if there's no valid frame
+   *          at this position. If the frame extends beyond the data in m_block,
+   *          isOverrun() is true afterwards. */
+  int tryFrame();
+
+  /** Decode a subframe of num_samples samples with the given number of bits
+   *  per sample into samples.
+   *  @return false if the subframe is invalid. */
+  bool decodeSubframe(qint32* samples, int num_samples, int bits_per_sample);
+
+  /** Decode the residual of a predicted subframe and add the prediction to
+   *  it. */
+  bool decodeResidual(qint32* samples, int num_samples, int order);
+
+  /** Reading bits from m_block, starting at byte_offset. Reading beyond the
+   *  end of the block yields zero bits; use isOverrun() to check for that. */
+  void    startBits(int byte_offset);
+  void    refillCache();
+  quint32 readBits(int num_bits);
+  qint32  readSigned(int num_bits);
+  quint32 readUnary();
+  void    alignBits();
+
+  /** The position of the bit reader in m_block, in whole bytes. */
+  int bytePos() const {return m_byte_pos - m_cache_bits / 8;}
+
+  /** Indicate whether we've read beyond the end of m_block. */
+  bool isOverrun() const {
+    return (qint64)m_byte_pos * 8 - m_cache_bits > (qint64)m_block.size() * 8;
+  }
+
+  static quint8  crc8(const uchar* data, int size);
+  static quint16 crc16(const uchar* data, int size);
+
+  QFile m_file;
+
+  int    m_num_channels    = 0;
+  int    m_sample_rate     = 0;
+  int    m_bits_per_sample = 0;
+  int    m_min_block_size  = 0;
+  int    m_max_block_size  = 0;
+  qint64 m_num_frames      = 0;
+
+  /** The position of the next frame in the file, and the part of the file
+   *  that is read into memory. */
+  qint64             m_frame_pos = 0;
+  std::vector<uchar> m_block;
+  qint64             m_block_pos = 0;
+
+  /** The size in bytes of the frame decoded by tryFrame(), and the position
+   *  of its first sample. */
+  int    m_frame_size   = 0;
+  qint64 m_frame_sample = 0;
+
+  /** The position in the file and of the first sample of the last frame that
+   *  decodeFrame() returned. */
+  qint64 m_last_frame_pos    = 0;
+  qint64 m_last_frame_sample = 0;
+
+  /** The state of the bit reader. The cache holds the next bits, aligned to
+   *  the most significant bit. */
+  int     m_byte_pos   = 0;
+  quint64 m_cache      = 0;
+  int     m_cache_bits = 0;
+
+  /** The decoded samples of the current frame, per channel. */
+  std::vector<qint32> m_samples[8];
+
+  /** The number of bytes that we read from the file at once. */
+  const int BLOCK_SIZE = 256 * 1024;
+};
+
+#endif // FLACDECODER_H
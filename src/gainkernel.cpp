@@ -0,0 +1,365 @@
+#include "gainkernel.h"
+
+#include <cstdint>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GAIN_KERNEL_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 code is compiled with a function attribute, so that the rest of the
+// program still runs on CPUs without it
+#if defined(GAIN_KERNEL_SSE2) && defined(Q_CC_GNU)
+#define GAIN_KERNEL_AVX2
+#include <immintrin.h>
+#endif
+
+// Double precision vectors are only available on 64 bit ARM, where NEON is
+// always there
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define GAIN_KERNEL_NEON
+#include <arm_neon.h>
+#endif
+
+/** The number of fractional bits of the fixed point factor. */
+static const int FIXED_POINT_BITS = 16;
+
+// Unsigned samples are offset by half their range. Flipping their sign bit
+// turns them into signed samples and back, so the kernels work on signed
+// types, and take care of unsigned data in the same pass.
+
+/** The reference implementation, which is also used for the samples at the
+ *  end that don't fill a whole vector. */
+template<typename word_type>
+static void applyScalar(const word_type* data, word_type* out,
+                        int num_samples, qreal factor, bool is_unsigned) {
+  const int   flip = is_unsigned ? 1 << (sizeof(word_type) * 8 - 1) : 0;
+  const qreal min  = std::numeric_limits<word_type>::min();
+  const qreal max  = std::numeric_limits<word_type>::max();
+  for (int i = 0; i < num_samples; i++) {
+    // Like the vector kernels, we cap the value while it's still a double, as
+    // a large factor could make it overflow an integer
+    word_type sample = static_cast<word_type>(data[i] ^ flip);
+    qreal     val    = qBound(min, sample * factor, max);
+    out[i] = static_cast<word_type>(static_cast<qint32>(val) ^ flip);
+  }
+}
+
+/** The integer only kernel. The factor is turned into a fixed point number
+ *  with 16 fractional bits (so it can be up to 32768), which every sample is
+ *  multiplied by. The product is truncated towards zero like in the other
+ *  kernels, but as the factor is rounded, the result may be one off. */
+template<typename word_type>
+static void applyFixedPoint(const word_type* data, word_type* out,
+                            int num_samples, qreal factor, bool is_unsigned) {
+  const int    flip       = is_unsigned ? 1 << (sizeof(word_type) * 8 - 1) : 0;
+  const qreal  scaled     = factor * (1 << FIXED_POINT_BITS) + 0.5;
+  const qint32 multiplier = (qint32)qBound((qreal)INT32_MIN, scaled,
+                                            (qreal)INT32_MAX);
+  const qint64 round_up   = (1 << FIXED_POINT_BITS) - 1;
+  for (int i = 0; i < num_samples; i++) {
+    word_type sample  = static_cast<word_type>(data[i] ^ flip);
+    qint64    product = (qint64)sample * multiplier;
+
+    // Shifting rounds down, so negative products are moved up first
+    qint64 val = (product + (product < 0 ? round_up : 0)) >> FIXED_POINT_BITS;
+    if (val > std::numeric_limits<word_type>::max()) {
+      val = std::numeric_limits<word_type>::max();
+    } else if (val < std::numeric_limits<word_type>::min()) {
+      val = std::numeric_limits<word_type>::min();
+    }
+    out[i] = static_cast<word_type>(val ^ flip);
+  }
+}
+
+// The vector kernels clip the samples while they're still doubles, and then
+// truncate them. This gives the same result as truncating first and clipping
+// afterwards, but there's no risk of overflowing the integers.
+
+#ifdef GAIN_KERNEL_SSE2
+/** Apply the gain to 8 samples of 16 bit, and return them as 16 bit
+ *  samples. */
+static inline __m128i gainSSE2(__m128i samples, __m128d factor, __m128d min,
+                               __m128d max) {
+  __m128i words[2];
+  words[0] = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+  words[1] = _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16);
+
+  for (int i = 0; i < 2; i++) {
+    __m128d lo = _mm_cvtepi32_pd(words[i]);
+    __m128d hi = _mm_cvtepi32_pd(_mm_srli_si128(words[i], 8));
+    lo = _mm_min_pd(_mm_max_pd(_mm_mul_pd(lo, factor), min), max);
+    hi = _mm_min_pd(_mm_max_pd(_mm_mul_pd(hi, factor), min), max);
+    words[i] = _mm_unpacklo_epi64(_mm_cvttpd_epi32(lo), _mm_cvttpd_epi32(hi));
+  }
+  return _mm_packs_epi32(words[0], words[1]);
+}
+
+static void applySSE2(const qint16* data, qint16* out, int num_samples,
+                      qreal factor, bool is_unsigned) {
+  __m128i flip = _mm_set1_epi16(is_unsigned ? (short)0x8000 : 0);
+  __m128d f    = _mm_set1_pd(factor);
+  __m128d min  = _mm_set1_pd(std::numeric_limits<qint16>::min());
+  __m128d max  = _mm_set1_pd(std::numeric_limits<qint16>::max());
+
+  int i = 0;
+  for (; i + 8 <= num_samples; i += 8) {
+    __m128i samples = _mm_xor_si128(
+                        _mm_loadu_si128((const __m128i*)(data + i)), flip);
+    _mm_storeu_si128((__m128i*)(out + i),
+                     _mm_xor_si128(gainSSE2(samples, f, min, max), flip));
+  }
+  applyScalar(data + i, out + i, num_samples - i, factor, is_unsigned);
+}
+
+static void applySSE2(const qint8* data, qint8* out, int num_samples,
+                      qreal factor, bool is_unsigned) {
+  __m128i flip = _mm_set1_epi8(is_unsigned ? (char)0x80 : 0);
+  __m128d f    = _mm_set1_pd(factor);
+  __m128d min  = _mm_set1_pd(std::numeric_limits<qint8>::min());
+  __m128d max  = _mm_set1_pd(std::numeric_limits<qint8>::max());
+
+  int i = 0;
+  for (; i + 16 <= num_samples; i += 16) {
+    __m128i samples = _mm_xor_si128(
+                        _mm_loadu_si128((const __m128i*)(data + i)), flip);
+    __m128i lo = _mm_srai_epi16(_mm_unpacklo_epi8(samples, samples), 8);
+    __m128i hi = _mm_srai_epi16(_mm_unpackhi_epi8(samples, samples), 8);
+    lo = gainSSE2(lo, f, min, max);
+    hi = gainSSE2(hi, f, min, max);
+    _mm_storeu_si128((__m128i*)(out + i),
+                     _mm_xor_si128(_mm_packs_epi16(lo, hi), flip));
+  }
+  applyScalar(data + i, out + i, num_samples - i, factor, is_unsigned);
+}
+#endif
+
+#ifdef GAIN_KERNEL_AVX2
+/** Apply the gain to 8 samples of 16 bit, and return them as 16 bit
+ *  samples. */
+__attribute__((target("avx2")))
+static inline __m128i gainAVX2(__m128i samples, __m256d factor, __m256d min,
+                               __m256d max) {
+  __m256d lo = _mm256_cvtepi32_pd(_mm_cvtepi16_epi32(samples));
+  __m256d hi = _mm256_cvtepi32_pd(
+                 _mm_cvtepi16_epi32(_mm_srli_si128(samples, 8)));
+  lo = _mm256_min_pd(_mm256_max_pd(_mm256_mul_pd(lo, factor), min), max);
+  hi = _mm256_min_pd(_mm256_max_pd(_mm256_mul_pd(hi, factor), min), max);
+  return _mm_packs_epi32(_mm256_cvttpd_epi32(lo), _mm256_cvttpd_epi32(hi));
+}
+
+__attribute__((target("avx2")))
+static void applyAVX2(const qint16* data, qint16* out, int num_samples,
+                      qreal factor, bool is_unsigned) {
+  __m128i flip = _mm_set1_epi16(is_unsigned ? (short)0x8000 : 0);
+  __m256d f    = _mm256_set1_pd(factor);
+  __m256d min  = _mm256_set1_pd(std::numeric_limits<qint16>::min());
+  __m256d max  = _mm256_set1_pd(std::numeric_limits<qint16>::max());
+
+  int i = 0;
+  for (; i + 16 <= num_samples; i += 16) {
+    __m128i lo = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data + i)),
+                               flip);
+    __m128i hi = _mm_xor_si128(
+                   _mm_loadu_si128((const __m128i*)(data + i + 8)), flip);
+    _mm_storeu_si128((__m128i*)(out + i),
+                     _mm_xor_si128(gainAVX2(lo, f, min, max), flip));
+    _mm_storeu_si128((__m128i*)(out + i + 8),
+                     _mm_xor_si128(gainAVX2(hi, f, min, max), flip));
+  }
+  applyScalar(data + i, out + i, num_samples - i, factor, is_unsigned);
+}
+
+__attribute__((target("avx2")))
+static void applyAVX2(const qint8* data, qint8* out, int num_samples,
+                      qreal factor, bool is_unsigned) {
+  __m128i flip = _mm_set1_epi8(is_unsigned ? (char)0x80 : 0);
+  __m256d f    = _mm256_set1_pd(factor);
+  __m256d min  = _mm256_set1_pd(std::numeric_limits<qint8>::min());
+  __m256d max  = _mm256_set1_pd(std::numeric_limits<qint8>::max());
+
+  int i = 0;
+  for (; i + 16 <= num_samples; i += 16) {
+    __m128i samples = _mm_xor_si128(
+                        _mm_loadu_si128((const __m128i*)(data + i)), flip);
+    __m128i lo = gainAVX2(_mm_cvtepi8_epi16(samples), f, min, max);
+    __m128i hi = gainAVX2(_mm_cvtepi8_epi16(_mm_srli_si128(samples, 8)),
+                          f, min, max);
+    _mm_storeu_si128((__m128i*)(out + i),
+                     _mm_xor_si128(_mm_packs_epi16(lo, hi), flip));
+  }
+  applyScalar(data + i, out + i, num_samples - i, factor, is_unsigned);
+}
+#endif
+
+#ifdef GAIN_KERNEL_NEON
+/** Apply the gain to 4 samples of 16 bit. */
+static inline int16x4_t gainNEON(int16x4_t samples, float64x2_t factor,
+                                 float64x2_t min, float64x2_t max) {
+  int32x4_t   words = vmovl_s16(samples);
+  float64x2_t lo    = vcvtq_f64_s64(vmovl_s32(vget_low_s32(words)));
+  float64x2_t hi    = vcvtq_f64_s64(vmovl_s32(vget_high_s32(words)));
+  lo = vminq_f64(vmaxq_f64(vmulq_f64(lo, factor), min), max);
+  hi = vminq_f64(vmaxq_f64(vmulq_f64(hi, factor), min), max);
+  return vqmovn_s32(vcombine_s32(vmovn_s64(vcvtq_s64_f64(lo)),
+                                 vmovn_s64(vcvtq_s64_f64(hi))));
+}
+
+static void applyNEON(const qint16* data, qint16* out, int num_samples,
+                      qreal factor, bool is_unsigned) {
+  int16x8_t   flip = vdupq_n_s16(is_unsigned ? (int16_t)0x8000 : 0);
+  float64x2_t f    = vdupq_n_f64(factor);
+  float64x2_t min  = vdupq_n_f64(std::numeric_limits<qint16>::min());
+  float64x2_t max  = vdupq_n_f64(std::numeric_limits<qint16>::max());
+
+  int i = 0;
+  for (; i + 8 <= num_samples; i += 8) {
+    int16x8_t samples = veorq_s16(vld1q_s16(data + i), flip);
+    int16x8_t result  = vcombine_s16(
+                          gainNEON(vget_low_s16(samples), f, min, max),
+                          gainNEON(vget_high_s16(samples), f, min, max));
+    vst1q_s16(out + i, veorq_s16(result, flip));
+  }
+  applyScalar(data + i, out + i, num_samples - i, factor, is_unsigned);
+}
+
+static void applyNEON(const qint8* data, qint8* out, int num_samples,
+                      qreal factor, bool is_unsigned) {
+  int8x8_t    flip = vdup_n_s8(is_unsigned ? (int8_t)0x80 : 0);
+  float64x2_t f    = vdupq_n_f64(factor);
+  float64x2_t min  = vdupq_n_f64(std::numeric_limits<qint8>::min());
+  float64x2_t max  = vdupq_n_f64(std::numeric_limits<qint8>::max());
+
+  int i = 0;
+  for (; i + 8 <= num_samples; i += 8) {
+    int16x8_t samples = vmovl_s8(veor_s8(vld1_s8(data + i), flip));
+    int16x8_t result  = vcombine_s16(
+                          gainNEON(vget_low_s16(samples), f, min, max),
+                          gainNEON(vget_high_s16(samples), f, min, max));
+    vst1_s8(out + i, veor_s8(vqmovn_s16(result), flip));
+  }
+  applyScalar(data + i, out + i, num_samples - i, factor, is_unsigned);
+}
+#endif
+
+bool GainKernel::isSupported(Type type) {
+  switch (type) {
+    case Scalar:
+    case FixedPoint:
+      return true;
+#ifdef GAIN_KERNEL_SSE2
+    case SSE2:
+      return true;
+#endif
+#ifdef GAIN_KERNEL_AVX2
+    case AVX2:
+      return __builtin_cpu_supports("avx2");
+#endif
+#ifdef GAIN_KERNEL_NEON
+    case NEON:
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+GainKernel::Type GainKernel::best() {
+  // Checking the CPU takes a little time, so we only do it once
+  static const Type type = isSupported(AVX2) ? AVX2 :
+                           isSupported(SSE2) ? SSE2 :
+                           isSupported(NEON) ? NEON :
+#if defined(Q_PROCESSOR_ARM)
+                           FixedPoint;
+#else
+                           Scalar;
+#endif
+  return type;
+}
+
+const char* GainKernel::name(Type type) {
+  switch (type) {
+    case SSE2:       return "SSE2";
+    case AVX2:       return "AVX2";
+    case NEON:       return "NEON";
+    case FixedPoint: return "fixed point";
+    default:         return "scalar";
+  }
+}
+
+/** The signed type of the same width as an unsigned type. */
+template<typename word_type> struct SignedType {typedef word_type type;};
+template<> struct SignedType<quint8>  {typedef qint8  type;};
+template<> struct SignedType<quint16> {typedef qint16 type;};
+
+// The kernels as GainKernel::Functions for each sample type. Unsigned data is
+// passed to the signed kernels, which know what to do with it.
+#define GAIN_KERNEL_FUNCTION(name, kernel)                                     \
+template<typename word_type>                                                  \
+static void name(const word_type* data, word_type* out, int num_samples,      \
+                 qreal factor) {                                              \
+  typedef typename SignedType<word_type>::type signed_type;                   \
+  kernel((const signed_type*)data, (signed_type*)out, num_samples, factor,    \
+         !std::numeric_limits<word_type>::is_signed);                         \
+}
+
+GAIN_KERNEL_FUNCTION(scalarFunction, applyScalar)
+GAIN_KERNEL_FUNCTION(fixedPointFunction, applyFixedPoint)
+#ifdef GAIN_KERNEL_SSE2
+GAIN_KERNEL_FUNCTION(sse2Function, applySSE2)
+#endif
+#ifdef GAIN_KERNEL_AVX2
+GAIN_KERNEL_FUNCTION(avx2Function, applyAVX2)
+#endif
+#ifdef GAIN_KERNEL_NEON
+GAIN_KERNEL_FUNCTION(neonFunction, applyNEON)
+#endif
+
+template<typename word_type>
+GainKernel::Function<word_type> GainKernel::select(Type type) {
+  switch (type) {
+#ifdef GAIN_KERNEL_SSE2
+    case SSE2:
+      return sse2Function<word_type>;
+#endif
+#ifdef GAIN_KERNEL_AVX2
+    case AVX2:
+      return avx2Function<word_type>;
+#endif
+#ifdef GAIN_KERNEL_NEON
+    case NEON:
+      return neonFunction<word_type>;
+#endif
+    case FixedPoint:
+      return fixedPointFunction<word_type>;
+    default:
+      return scalarFunction<word_type>;
+  }
+}
+
+template GainKernel::Function<qint8>   GainKernel::select<qint8>(Type);
+template GainKernel::Function<quint8>  GainKernel::select<quint8>(Type);
+template GainKernel::Function<qint16>  GainKernel::select<qint16>(Type);
+template GainKernel::Function<quint16> GainKernel::select<quint16>(Type);
+
+void GainKernel::apply(Type type, const qint8* data, qint8* out,
+                       int num_samples, qreal factor) {
+  select<qint8>(type)(data, out, num_samples, factor);
+}
+
+void GainKernel::apply(Type type, const quint8* data, quint8* out,
+                       int num_samples, qreal factor) {
+  select<quint8>(type)(data, out, num_samples, factor);
+}
+
+void GainKernel::apply(Type type, const qint16* data, qint16* out,
+                       int num_samples, qreal factor) {
+  select<qint16>(type)(data, out, num_samples, factor);
+}
+
+void GainKernel::apply(Type type, const quint16* data, quint16* out,
+                       int num_samples, qreal factor) {
+  select<quint16>(type)(data, out, num_samples, factor);
+}
@@ -0,0 +1,56 @@
+#ifndef GAINKERNEL_H
+#define GAINKERNEL_H
+
+#include <QtGlobal>
+
+/** The loops that multiply audio samples by a gain factor and clip them to
+ *  the range of the sample type, which is where SonicBooster spends most of
+ *  its time. Besides the plain C++ loop, there are versions that use the
+ *  vector instructions of the CPU: SSE2 and AVX2 on x86, and NEON on 64 bit
+ *  ARM. The best one that the CPU supports is picked at runtime.
+ *  Unsigned samples are converted to signed and back in the same loop, so
+ *  every sample is read and written only once.
+ *  All these versions compute in double precision and truncate towards zero,
+ *  just like the plain loop, so they give exactly the same results.
+ *  The FixedPoint kernel only uses integers, for CPUs that are slow at
+ *  floating point math, like the 32 bit ARM CPUs of low-end Android devices.
+ *  Its results may be one off. */
+class GainKernel {
+
+public:
+  enum Type {Scalar, SSE2, AVX2, NEON, FixedPoint};
+
+  /** A kernel for samples of type word_type: multiply num_samples samples in
+   *  data by factor, clip them and store them in out, which may be the same
+   *  as data. */
+  template<typename word_type>
+  using Function = void (*)(const word_type* data, word_type* out,
+                            int num_samples, qreal factor);
+
+  /** Indicate whether the kernel of the given type is compiled in and can
+   *  run on this CPU. The Scalar kernel is always supported. */
+  static bool isSupported(Type type);
+
+  /** The fastest kernel that is supported. On 32 bit ARM, this is the
+   *  FixedPoint kernel. */
+  static Type best();
+
+  /** A readable name of the type, for benchmarks and debugging. */
+  static const char* name(Type type);
+
+  /** Return the kernel of the given type for qint8, quint8, qint16 or
+   *  quint16 samples, so that it can be called without picking it again. */
+  template<typename word_type> static Function<word_type> select(Type type);
+
+  /** Run the kernel of the given type on data, like the one from select(). */
+  static void apply(Type type, const qint8* data, qint8* out, int num_samples,
+                    qreal factor);
+  static void apply(Type type, const quint8* data, quint8* out,
+                    int num_samples, qreal factor);
+  static void apply(Type type, const qint16* data, qint16* out,
+                    int num_samples, qreal factor);
+  static void apply(Type type, const quint16* data, quint16* out,
+                    int num_samples, qreal factor);
+};
+
+#endif // GAINKERNEL_H
@@ -111,6 +111,11 @@ void HistoryModel::del(HistoryRoles by, const QFile* file) {
     }
   }
 
+  // The seek index of a forgotten audio file is of no use anymore
+  if (by == HistoryRoles::AudioFileRole) {
+    SeekIndex::remove(file_path);
+  }
+
   // Save the changes
   saveHistory();
 }
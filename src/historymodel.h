@@ -11,6 +11,8 @@
 
 #include <vector>
 
+#include "seekindex.h"
+
 struct HistoryEntry {
   QString text_file;
   QString audio_file;
@@ -52,7 +54,8 @@ public:
   bool textFileForAudio(const QString& audio_path, QString& text_path);
 
   /** Delete all entries that contain the give file path, which may be an
-   *  audio or text file based on the 'by' parameter. */
+   *  audio or text file based on the 'by' parameter. For an audio file, its
+   *  SeekIndex is deleted as well. */
   void del(HistoryRoles by, const QFile* file);
 
 private:
@@ -55,6 +55,12 @@ bool KeyCatcher::eventFilter(QObject* object, QEvent* event) {
         case Qt::Key_Down:
           emit boost(false);
           break;
+        case Qt::Key_PageUp:
+          emit skipToMarker(false);
+          break;
+        case Qt::Key_PageDown:
+          emit skipToMarker(true);
+          break;
         default:
           is_consumed = false;
       }
@@ -32,6 +32,10 @@ signals:
    *  the boost factor. */
   void boost(bool is_up);
 
+  /** Emitted when a key combination is typed that should seek to the next or
+   *  previous marker in the audio. */
+  void skipToMarker(bool is_forward);
+
 protected:
   /** The raison d'etre of this class: catching keys. */
   bool eventFilter(QObject* object, QEvent* event);
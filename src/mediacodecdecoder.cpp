@@ -0,0 +1,180 @@
+#include "mediacodecdecoder.h"
+
+MediaCodecDecoder::MediaCodecDecoder(const QString& path) : m_file(path) {}
+
+MediaCodecDecoder::~MediaCodecDecoder() {
+  if (m_codec) {
+    AMediaCodec_stop(m_codec);
+    AMediaCodec_delete(m_codec);
+  }
+  if (m_extractor) AMediaExtractor_delete(m_extractor);
+}
+
+bool MediaCodecDecoder::open() {
+  if (!m_file.open(QIODevice::ReadOnly)) return false;
+  m_extractor = AMediaExtractor_new();
+  if (!m_extractor ||
+      AMediaExtractor_setDataSourceFd(m_extractor, m_file.handle(), 0,
+                                      m_file.size()) != AMEDIA_OK) {
+    return false;
+  }
+
+  // Set up a codec for the first audio track that Android can decode
+  int64_t duration = 0;
+  size_t num_tracks = AMediaExtractor_getTrackCount(m_extractor);
+  for (size_t i = 0; i < num_tracks && !m_codec; i++) {
+    AMediaFormat* format = AMediaExtractor_getTrackFormat(m_extractor, i);
+    const char*   mime   = NULL;
+    if (AMediaFormat_getString(format, AMEDIAFORMAT_KEY_MIME, &mime) &&
+        qstrncmp(mime, "audio/", 6) == 0) {
+      m_codec = AMediaCodec_createDecoderByType(mime);
+      if (m_codec &&
+          (AMediaCodec_configure(m_codec, format, NULL, NULL, 0) !=
+             AMEDIA_OK ||
+           AMediaCodec_start(m_codec) != AMEDIA_OK)) {
+        AMediaCodec_delete(m_codec);
+        m_codec = NULL;
+      }
+      if (m_codec) {
+        AMediaExtractor_selectTrack(m_extractor, i);
+        int32_t num_channels = 0;
+        int32_t sample_rate  = 0;
+        AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_CHANNEL_COUNT,
+                              &num_channels);
+        AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_SAMPLE_RATE,
+                              &sample_rate);
+        AMediaFormat_getInt64(format, AMEDIAFORMAT_KEY_DURATION, &duration);
+        m_num_channels = num_channels;
+        m_sample_rate  = sample_rate;
+      }
+    }
+    AMediaFormat_delete(format);
+  }
+  if (!m_codec) return false;
+
+  // The codec may decide on another format than the container says (like
+  // for HE-AAC), so we only know for sure after the first buffer
+  if (!fillPending()) return false;
+  if (duration > 0) m_num_frames = duration * m_sample_rate / 1000000;
+  return true;
+}
+
+void MediaCodecDecoder::seek(qint64 frame) {
+  if (!m_codec || m_sample_rate <= 0) return;
+
+  AMediaExtractor_seekTo(m_extractor, frame * 1000000 / m_sample_rate,
+                         AMEDIAEXTRACTOR_SEEK_PREVIOUS_SYNC);
+  AMediaCodec_flush(m_codec);
+  m_pending.clear();
+  m_next_sample    = frame == 0 ? 0 : -1;
+  m_is_input_done  = false;
+  m_is_output_done = false;
+}
+
+int MediaCodecDecoder::decode(std::vector<qint16>& out) {
+  if (m_pending.empty() && !fillPending()) return m_has_error ? -1 : 0;
+
+  out.insert(out.end(), m_pending.begin(), m_pending.end());
+  m_last_frame_sample = m_pending_sample;
+  int num_frames = m_pending.size() / m_num_channels;
+  m_pending.clear();
+  return num_frames;
+}
+
+bool MediaCodecDecoder::fillPending() {
+  m_pending.clear();
+  while (!m_is_output_done && !m_has_error) {
+    // Hand the codec the next packet from the file, if it has room for it
+    if (!m_is_input_done) {
+      ssize_t index = AMediaCodec_dequeueInputBuffer(m_codec, 0);
+      if (index >= 0) {
+        size_t   size;
+        uint8_t* buffer = AMediaCodec_getInputBuffer(m_codec, index, &size);
+        ssize_t  num_bytes = AMediaExtractor_readSampleData(m_extractor,
+                                                            buffer, size);
+        if (num_bytes < 0) {
+          AMediaCodec_queueInputBuffer(m_codec, index, 0, 0, 0,
+                                       AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM);
+          m_is_input_done = true;
+        } else {
+          AMediaCodec_queueInputBuffer(m_codec, index, 0, num_bytes,
+                                       AMediaExtractor_getSampleTime(
+                                         m_extractor),
+                                       0);
+          AMediaExtractor_advance(m_extractor);
+        }
+      }
+    }
+
+    AMediaCodecBufferInfo info;
+    ssize_t index = AMediaCodec_dequeueOutputBuffer(m_codec, &info,
+                                                    CODEC_TIMEOUT);
+    if (index == AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED) {
+      readOutputFormat();
+      continue;
+    } else if (index == AMEDIACODEC_INFO_TRY_AGAIN_LATER ||
+               index == AMEDIACODEC_INFO_OUTPUT_BUFFERS_CHANGED) {
+      continue;
+    } else if (index < 0) {
+      m_has_error = true;
+      break;
+    }
+
+    if (info.flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM) {
+      m_is_output_done = true;
+    }
+    size_t   size;
+    uint8_t* data = AMediaCodec_getOutputBuffer(m_codec, index, &size);
+    if (data && info.size > 0 && m_num_channels > 0) {
+      data += info.offset;
+      if (m_is_float) {
+        qint64 num_samples = info.size / sizeof(float);
+        m_pending.resize(num_samples);
+        PcmReader::convert(PcmReader::Float32, data, m_pending.data(),
+                           num_samples);
+      } else {
+        const qint16* samples = (const qint16*)data;
+        m_pending.assign(samples, samples + info.size / sizeof(qint16));
+      }
+      m_pending.resize(m_pending.size() -
+                       m_pending.size() % m_num_channels);
+    }
+    AMediaCodec_releaseOutputBuffer(m_codec, index, false);
+
+    if (!m_pending.empty()) {
+      // After a seek, we learn from the codec where we are
+      if (m_next_sample < 0) {
+        m_next_sample = qMax((int64_t)0, info.presentationTimeUs) *
+                        m_sample_rate / 1000000;
+      }
+      m_pending_sample = m_next_sample;
+      m_next_sample   += m_pending.size() / m_num_channels;
+      return true;
+    }
+  }
+  return false;
+}
+
+void MediaCodecDecoder::readOutputFormat() {
+  AMediaFormat* format = AMediaCodec_getOutputFormat(m_codec);
+  if (!format) return;
+
+  int32_t num_channels = m_num_channels;
+  int32_t sample_rate  = m_sample_rate;
+  int32_t encoding     = 0;
+  AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_CHANNEL_COUNT, &num_channels);
+  AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_SAMPLE_RATE, &sample_rate);
+  AMediaFormat_getInt32(format, "pcm-encoding", &encoding);
+  AMediaFormat_delete(format);
+
+  // We can't handle format changes halfway
+  if (m_has_output_format && (num_channels != m_num_channels ||
+                              sample_rate  != m_sample_rate)) {
+    m_has_error = true;
+    return;
+  }
+  m_num_channels      = num_channels;
+  m_sample_rate       = sample_rate;
+  m_is_float          = (encoding == ENCODING_PCM_FLOAT);
+  m_has_output_format = true;
+}
@@ -0,0 +1,103 @@
+#ifndef MEDIACODECDECODER_H
+#define MEDIACODECDECODER_H
+
+#include <QFile>
+#include <QString>
+
+#include <media/NdkMediaCodec.h>
+#include <media/NdkMediaExtractor.h>
+#include <media/NdkMediaFormat.h>
+
+#include <vector>
+
+#include "pcmreader.h"
+
+/** A decoder that uses the media codecs of Android itself, so that MP3, AAC,
+ *  Ogg/Vorbis and Opus files can be decoded in our own process on Android,
+ *  where QAudioDecoder isn't available.
+ *  The interface follows FlacDecoder: the audio is handed out as interleaved
+ *  16 bit signed samples, one codec buffer at a time. Unlike QAudioDecoder,
+ *  it can continue from any position in the file (see seek()), so there's no
+ *  need to decode everything up to there first.
+ *  An instance may be used from any thread, but from only one thread at a
+ *  time. */
+class MediaCodecDecoder {
+
+public:
+  explicit MediaCodecDecoder(const QString& path);
+  ~MediaCodecDecoder();
+
+  /** Open the file, set up the codec for its first audio track and decode
+   *  the first buffer, so that the format of the decoded audio is known.
+   *  @return false if Android can't decode the file. */
+  bool open();
+
+  int channelCount() const {return m_num_channels;}
+  int sampleRate() const {return m_sample_rate;}
+
+  /** The total number of audio frames (samples per channel) according to the
+   *  container, or 0 if it isn't known. This may be off by a bit. */
+  qint64 numFrames() const {return m_num_frames;}
+
+  /** The position in the audio of the first sample of the last buffer that
+   *  decode() returned, in audio frames. */
+  qint64 frameSample() const {return m_last_frame_sample;}
+
+  /** Continue decoding from the last sync point at or before the given audio
+   *  frame. The next buffer that decode() returns tells where that is. */
+  void seek(qint64 frame);
+
+  /** Decode the next buffer and append its audio to out, as interleaved 16
+   *  bit signed samples.
+   *  @return the number of audio frames decoded, 0 at the end of the file, or
+   *          -1 if the codec fails. */
+  int decode(std::vector<qint16>& out);
+
+private:
+  /** Feed the codec and wait for the next buffer of audio, which is put in
+   *  m_pending.
+   *  @return false at the end of the file or if the codec fails; m_has_error
+   *          tells which. */
+  bool fillPending();
+
+  /** Take the sample rate, channel count and sample encoding from the output
+   *  format of the codec. */
+  void readOutputFormat();
+
+  QFile m_file;
+
+  AMediaExtractor* m_extractor = NULL;
+  AMediaCodec*     m_codec     = NULL;
+
+  int    m_num_channels = 0;
+  int    m_sample_rate  = 0;
+  qint64 m_num_frames   = 0;
+
+  /** Indicate whether the codec hands out floating point samples instead of
+   *  16 bit ones, and whether it told us the format of its output. */
+  bool m_is_float          = false;
+  bool m_has_output_format = false;
+
+  /** The next buffer of decoded audio, and the position of its first sample.
+   *  Buffers are numbered from the start of the file, or from the
+   *  presentation time after a seek, and follow each other seamlessly from
+   *  there. */
+  std::vector<qint16> m_pending;
+  qint64              m_pending_sample    = -1;
+  qint64              m_next_sample       = 0;
+  qint64              m_last_frame_sample = 0;
+
+  bool m_is_input_done  = false;
+  bool m_is_output_done = false;
+  bool m_has_error      = false;
+
+  /** How long to wait for the codec each time we ask for a buffer, in
+   *  microseconds. */
+  const int64_t CODEC_TIMEOUT = 10000;
+
+  /** The value of "pcm-encoding" in a media format for float samples (see
+   *  android.media.AudioFormat.ENCODING_PCM_FLOAT). */
+  const int32_t ENCODING_PCM_FLOAT = 4;
+};
+
+#endif // MEDIACODECDECODER_H
@@ -0,0 +1,158 @@
+#include "pcmreader.h"
+
+PcmReader::PcmReader(const QString& path, qint64 data_offset,
+                     qint64 data_size, Encoding encoding, bool use_mmap) :
+  m_file(path),
+  m_data_offset(data_offset),
+  m_data_size(data_size),
+  m_encoding(encoding) {
+  m_in_sample_size  = bytesPerSample(m_encoding);
+  m_out_sample_size = (m_encoding == UnsignedInt8) ? 1 : 2;
+  m_size = (m_data_size / m_in_sample_size) * m_out_sample_size;
+
+  if (m_file.open(QIODevice::ReadOnly)) {
+    if (use_mmap && m_data_size > 0) {
+      m_mapped_data = m_file.map(m_data_offset, m_data_size);
+    }
+  }
+}
+
+PcmReader::~PcmReader() {
+  if (m_mapped_data) {
+    m_file.unmap(m_mapped_data);
+  }
+}
+
+int PcmReader::bytesPerSample(Encoding encoding) {
+  switch (encoding) {
+    case UnsignedInt8: return 1;
+    case SignedInt16:  return 2;
+    case SignedInt24:  return 3;
+    case SignedInt32:
+    case Float32:      return 4;
+  }
+  return 1;
+}
+
+qint64 PcmReader::size() const {
+  if (m_source) {
+    return (m_source->size() / m_in_sample_size) * m_out_sample_size;
+  }
+  return m_size;
+}
+
+qint64 PcmReader::available(qint64 pos) const {
+  if (pos < 0) return 0;
+  if (m_source) {
+    qint64 in_pos = (pos / m_out_sample_size) * m_in_sample_size;
+    return (m_source->available(in_pos) / m_in_sample_size) * m_out_sample_size;
+  }
+  return qMax((qint64)0, m_size - pos);
+}
+
+bool PcmReader::encodingForFormat(const QAudioFormat& format,
+                                  Encoding& encoding) {
+  if (format.codec() != "audio/pcm" ||
+      format.byteOrder() != QAudioFormat::LittleEndian) {
+    return false;
+  }
+
+  switch (format.sampleType()) {
+    case QAudioFormat::UnSignedInt:
+      if (format.sampleSize() != 8) return false;
+      encoding = UnsignedInt8;
+      return true;
+    case QAudioFormat::SignedInt:
+      switch (format.sampleSize()) {
+        case 16: encoding = SignedInt16; return true;
+        case 24: encoding = SignedInt24; return true;
+        case 32: encoding = SignedInt32; return true;
+        default: return false;
+      }
+    case QAudioFormat::Float:
+      if (format.sampleSize() != 32) return false;
+      encoding = Float32;
+      return true;
+    default:
+      return false;
+  }
+}
+
+qint64 PcmReader::read(qint64 pos, char* data, qint64 max_bytes) {
+  if (pos < 0 || pos > size()) return -1;
+  qint64 num_bytes = qMin(max_bytes, available(pos));
+
+  // Without conversion, positions in the file and the output are the same
+  if (m_in_sample_size == m_out_sample_size) {
+    if (m_mapped_data) {
+      // When memory mapped, reading is just a memory copy; the OS takes care
+      // of getting the data from disk if needed.
+      memcpy(data, m_mapped_data + pos, num_bytes);
+      return num_bytes;
+    }
+
+    if (!m_file.seek(m_data_offset + pos)) return -1;
+    return m_file.read(data, num_bytes);
+  }
+
+  // With conversion, we work with whole samples
+  qint64 first_sample = pos / m_out_sample_size;
+  qint64 num_samples  = num_bytes / m_out_sample_size;
+  qint64 in_pos       = first_sample * m_in_sample_size;
+
+  if (m_mapped_data) {
+    convert(m_encoding, m_mapped_data + in_pos, (qint16*)data, num_samples);
+    return num_samples * m_out_sample_size;
+  }
+
+  if ((qint64)m_scratch.size() < num_samples * m_in_sample_size) {
+    m_scratch.resize(num_samples * m_in_sample_size);
+  }
+  if (!m_file.seek(m_data_offset + in_pos)) return -1;
+  qint64 num_read = m_file.read(m_scratch.data(),
+                                num_samples * m_in_sample_size);
+  if (num_read < 0) return -1;
+  num_samples = num_read / m_in_sample_size;
+  convert(m_encoding, (const uchar*)m_scratch.data(), (qint16*)data,
+          num_samples);
+  return num_samples * m_out_sample_size;
+}
+
+void PcmReader::convert(Encoding encoding, const uchar* in_data,
+                        qint16* out_data, qint64 num_samples) {
+  switch (encoding) {
+    case SignedInt24:
+      // Keep the two most significant bytes
+      for (qint64 i = 0; i < num_samples; i++) {
+        out_data[i] = qFromLittleEndian<qint16>(in_data + 3 * i + 1);
+      }
+      break;
+    case SignedInt32:
+      for (qint64 i = 0; i < num_samples; i++) {
+        out_data[i] = qFromLittleEndian<qint32>(in_data + 4 * i) >> 16;
+      }
+      break;
+    case Float32:
+      for (qint64 i = 0; i < num_samples; i++) {
+        quint32 bits = qFromLittleEndian<quint32>(in_data + 4 * i);
+        float   value;
+        memcpy(&value, &bits, sizeof(value));
+
+        // Scale and clip. NaN fails both comparisons, so we make it silent.
+        value *= 32768.0f;
+        if (value >= 32767.0f) {
+          out_data[i] = 32767;
+        } else if (value >= -32768.0f) {
+          out_data[i] = (qint16)qRound(value);
+        } else if (value < -32768.0f) {
+          out_data[i] = -32768;
+        } else {
+          out_data[i] = 0;
+        }
+      }
+      break;
+    default:
+      // No conversion needed
+      break;
+  }
+}
@@ -0,0 +1,120 @@
+#ifndef PCMREADER_H
+#define PCMREADER_H
+
+#include <QAudioFormat>
+#include <QFile>
+#include <QString>
+#include <QtEndian>
+
+#include <cstring>
+#include <vector>
+
+/** Random access to the raw audio data in a file, like the data chunk of a
+ *  wav file. The data is memory mapped if possible (and requested), or read
+ *  with regular file I/O otherwise.
+ *  Audio output devices (and SonicBooster) are only guaranteed to handle 8 bit
+ *  unsigned and 16 bit signed samples, so other sample formats are converted
+ *  to 16 bit signed samples while reading. All positions and sizes are in
+ *  bytes of the converted data.
+ *  The reader can also follow a file that is still being written, possibly
+ *  out of order, like the cache of a DecodeThread; see setSource().
+ *  An instance may be used from any thread, but from only one thread at a
+ *  time. */
+class PcmReader {
+
+public:
+  /** The sample formats in the file that we can read. All are little endian.
+   */
+  enum Encoding {
+    UnsignedInt8, // Handed out as is
+    SignedInt16,  // Handed out as is
+    SignedInt24,  // Packed in three bytes
+    SignedInt32,
+    Float32       // Nominally between -1.0 and 1.0
+  };
+
+  /** Open the file at path for reading raw audio data.
+   *  @param path the path to the file
+   *  @param data_offset the start of the audio data in the file, in bytes
+   *  @param data_size the size of the audio data in the file, in bytes
+   *  @param encoding the sample format of the audio data in the file
+   *  @param use_mmap if true, try to memory map the audio data. */
+  PcmReader(const QString& path, qint64 data_offset, qint64 data_size,
+            Encoding encoding, bool use_mmap);
+  ~PcmReader();
+
+  bool isOpen() const {return m_file.isOpen();}
+  bool isMemoryMapped() const {return m_mapped_data != NULL;}
+
+  /** Tells which parts of a file that is still being written can be read. */
+  class Source {
+  public:
+    virtual ~Source() {}
+
+    /** The size of the audio data in bytes (before conversion), as far as it
+     *  is known. */
+    virtual qint64 size() const = 0;
+
+    /** The number of bytes of audio data (before conversion) from pos onwards
+     *  that can be read right now. */
+    virtual qint64 available(qint64 pos) const = 0;
+  };
+
+  /** Only read the parts of the audio data that the source says can be read,
+   *  for files that are still being written to by another thread. The source
+   *  should outlive this object. Files that grow can't be memory mapped, so
+   *  the reader should have been created without memory mapping and with a
+   *  data_size of 0. */
+  void setSource(const Source* source) {m_source = source;}
+
+  /** The size of the audio data in bytes, after conversion. */
+  qint64 size() const;
+
+  /** The number of bytes (after conversion) from pos onwards that can be read
+   *  right now. This is less than size() - pos if we're following a source
+   *  that hasn't written that part yet. */
+  qint64 available(qint64 pos) const;
+
+  /** Copy at most max_bytes of audio data, starting at pos (relative to the
+   *  start of the audio data), into data, converting it if needed.
+   *  @return the number of bytes read, or -1 on error. */
+  qint64 read(qint64 pos, char* data, qint64 max_bytes);
+
+  /** Return the number of bytes a single sample takes in the given encoding. */
+  static int bytesPerSample(Encoding encoding);
+
+  /** Find the Encoding that matches the given QAudioFormat.
+   *  @return false if the format isn't one that we can read. */
+  static bool encodingForFormat(const QAudioFormat& format, Encoding& encoding);
+
+  /** Convert num_samples samples in the given encoding from in_data to 16 bit
+   *  signed samples in out_data. Nothing is done for 8 and 16 bit
+   *  encodings, which are handed out as is. */
+  static void convert(Encoding encoding, const uchar* in_data,
+                      qint16* out_data, qint64 num_samples);
+
+private:
+
+  QFile  m_file;
+  uchar* m_mapped_data = NULL;
+  qint64 m_data_offset;
+  qint64 m_data_size;
+
+  Encoding m_encoding;
+
+  /** The number of bytes per sample in the file and after conversion. */
+  int m_in_sample_size;
+  int m_out_sample_size;
+
+  /** The size of the data after conversion. */
+  qint64 m_size;
+
+  /** The source that's writing the file, or NULL if the file is complete. */
+  const Source* m_source = NULL;
+
+  /** Scratch space for converting data that isn't memory mapped. It is kept
+   *  around because we're typically reading chunks of the same size. */
+  std::vector<char> m_scratch;
+};
+
+#endif // PCMREADER_H
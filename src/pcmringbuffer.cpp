@@ -0,0 +1,54 @@
+#include "pcmringbuffer.h"
+
+PcmRingBuffer::PcmRingBuffer(int capacity) :
+  m_data(capacity), m_capacity(capacity), m_num_written(0), m_num_read(0) {}
+
+int PcmRingBuffer::bytesAvailable() const {
+  return m_num_written.load(std::memory_order_acquire) -
+         m_num_read.load(std::memory_order_acquire);
+}
+
+int PcmRingBuffer::bytesFree() const {
+  return m_capacity - bytesAvailable();
+}
+
+int PcmRingBuffer::write(const char* data, int max_bytes) {
+  quint64 num_written = m_num_written.load(std::memory_order_relaxed);
+  quint64 num_read    = m_num_read.load(std::memory_order_acquire);
+
+  int num_bytes = qMin(max_bytes, m_capacity - (int)(num_written - num_read));
+  if (num_bytes <= 0) return 0;
+
+  // Copy the data in at most two parts; until the end of the buffer, and then
+  // from the start of the buffer.
+  int index = num_written % m_capacity;
+  int first = qMin(num_bytes, m_capacity - index);
+  memcpy(m_data.data() + index, data, first);
+  memcpy(m_data.data(), data + first, num_bytes - first);
+
+  // Only publish the data after it is actually copied.
+  m_num_written.store(num_written + num_bytes, std::memory_order_release);
+  return num_bytes;
+}
+
+int PcmRingBuffer::read(char* data, int max_bytes) {
+  quint64 num_read    = m_num_read.load(std::memory_order_relaxed);
+  quint64 num_written = m_num_written.load(std::memory_order_acquire);
+
+  int num_bytes = qMin(max_bytes, (int)(num_written - num_read));
+  if (num_bytes <= 0) return 0;
+
+  int index = num_read % m_capacity;
+  int first = qMin(num_bytes, m_capacity - index);
+  memcpy(data, m_data.data() + index, first);
+  memcpy(data + first, m_data.data(), num_bytes - first);
+
+  // Only release the space after we're done copying from it.
+  m_num_read.store(num_read + num_bytes, std::memory_order_release);
+  return num_bytes;
+}
+
+void PcmRingBuffer::clear() {
+  m_num_written.store(0);
+  m_num_read.store(0);
+}
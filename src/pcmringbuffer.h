@@ -0,0 +1,53 @@
+#ifndef PCMRINGBUFFER_H
+#define PCMRINGBUFFER_H
+
+#include <QtGlobal>
+
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+/** A lock-free ring buffer for raw audio data, meant for exactly one producer
+ *  thread and exactly one consumer thread. The producer only calls write() and
+ *  bytesFree(), the consumer only calls read() and bytesAvailable().
+ *
+ *  Internally, the number of bytes ever written and read are kept as two
+ *  64 bit counters, so there is no ambiguity between a full and an empty
+ *  buffer, and each side only ever modifies its own counter. */
+class PcmRingBuffer {
+
+public:
+  /** Create a ring buffer that can hold capacity bytes. */
+  explicit PcmRingBuffer(int capacity);
+
+  int capacity() const {return m_capacity;}
+
+  /** The number of bytes that can be read. */
+  int bytesAvailable() const;
+
+  /** The number of bytes that can be written. */
+  int bytesFree() const;
+
+  /** Copy at most max_bytes from data into the buffer.
+   *  @return the number of bytes actually written. */
+  int write(const char* data, int max_bytes);
+
+  /** Copy at most max_bytes from the buffer into data.
+   *  @return the number of bytes actually read. */
+  int read(char* data, int max_bytes);
+
+  /** Discard all data in the buffer. This is NOT thread safe; the caller must
+   *  make sure that neither the producer nor the consumer is accessing the
+   *  buffer. */
+  void clear();
+
+private:
+  std::vector<char> m_data;
+  int               m_capacity;
+
+  /** The total number of bytes written and read. */
+  std::atomic<quint64> m_num_written;
+  std::atomic<quint64> m_num_read;
+};
+
+#endif // PCMRINGBUFFER_H
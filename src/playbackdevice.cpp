@@ -0,0 +1,58 @@
+#include "playbackdevice.h"
+
+PlaybackDevice::PlaybackDevice(QObject* parent) : QIODevice(parent) {
+  // Without our own buffering, QIODevice would read ahead more than the audio
+  // output asks for
+  open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+}
+
+void PlaybackDevice::reserve(qint64 capacity) {
+  qint64 old_capacity = (qint64)m_data.size();
+  if (capacity <= old_capacity) return;
+
+  // Move the data to the start of the new buffer
+  std::vector<char> data((size_t)capacity);
+  qint64 first = qMin(m_size, old_capacity - m_start);
+  if (first > 0) memcpy(data.data(), m_data.data() + m_start, first);
+  if (m_size > first) memcpy(data.data() + first, m_data.data(), m_size - first);
+  m_data.swap(data);
+  m_start = 0;
+}
+
+qint64 PlaybackDevice::bytesAvailable() const {
+  return m_size + QIODevice::bytesAvailable();
+}
+
+qint64 PlaybackDevice::readData(char* data, qint64 max_size) {
+  if (m_size < max_size) {
+    emit dataNeeded(max_size - m_size);
+  }
+
+  // Copy the data in at most two parts, like in PcmRingBuffer
+  qint64 num_bytes = qMin(max_size, m_size);
+  if (num_bytes > 0) {
+    qint64 capacity = (qint64)m_data.size();
+    qint64 first    = qMin(num_bytes, capacity - m_start);
+    memcpy(data, m_data.data() + m_start, first);
+    memcpy(data + first, m_data.data(), num_bytes - first);
+    m_start     = (m_start + num_bytes) % capacity;
+    m_size     -= num_bytes;
+    m_num_read += num_bytes;
+  }
+  return num_bytes;
+}
+
+qint64 PlaybackDevice::writeData(const char* data, qint64 size) {
+  if (size <= 0) return 0;
+  if (m_size + size > (qint64)m_data.size()) {
+    reserve(qMax(m_size + size, (qint64)m_data.size() * 2));
+  }
+
+  qint64 capacity = (qint64)m_data.size();
+  qint64 index    = (m_start + m_size) % capacity;
+  qint64 first    = qMin(size, capacity - index);
+  memcpy(m_data.data() + index, data, first);
+  memcpy(m_data.data(), data + first, size - first);
+  m_size += size;
+  return size;
+}
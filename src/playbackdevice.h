@@ -0,0 +1,62 @@
+#ifndef PLAYBACKDEVICE_H
+#define PLAYBACKDEVICE_H
+
+#include <QIODevice>
+
+#include <cstring>
+#include <vector>
+
+/** A QIODevice that QAudioOutput pulls audio data from, so that we only have
+ *  to do something when the audio output actually needs data, instead of
+ *  polling it on a timer.
+ *  When the audio output reads from it and it doesn't hold enough data, the
+ *  device asks for more with the dataNeeded() signal. Whoever produces the
+ *  audio should respond to that signal directly, by writing the data into the
+ *  device with write().
+ *  The data is kept in a ring buffer, which only grows if more data is
+ *  written than it can hold, so that steady playback doesn't allocate any
+ *  memory. */
+class PlaybackDevice : public QIODevice {
+  Q_OBJECT
+
+public:
+  /** Create the device, opened for reading and writing. */
+  explicit PlaybackDevice(QObject* parent = 0);
+
+  bool   isSequential() const override {return true;}
+  qint64 bytesAvailable() const override;
+
+  /** Make room for capacity bytes of data that hasn't been read yet. The
+   *  capacity is never reduced. */
+  void reserve(qint64 capacity);
+
+  /** Discard the data that hasn't been read yet, for instance after
+   *  seeking. */
+  void clear() {m_size = 0;}
+
+  /** The number of bytes that were read from the device since it was
+   *  created, and the number of bytes that will have been read once the data
+   *  that's written to it now is read. Discarded data isn't counted. */
+  qint64 readPosition() const {return m_num_read;}
+  qint64 writePosition() const {return m_num_read + m_size;}
+
+signals:
+  /** Sent when the audio output wants num_bytes more data than we have. This
+   *  must be handled with a direct connection. */
+  void dataNeeded(qint64 num_bytes);
+
+protected:
+  qint64 readData(char* data, qint64 max_size) override;
+  qint64 writeData(const char* data, qint64 size) override;
+
+private:
+  /** The data that is written but not read yet: m_size bytes from m_start
+   *  onwards, wrapping around at the end of m_data. */
+  std::vector<char> m_data;
+  qint64            m_start = 0;
+  qint64            m_size  = 0;
+
+  qint64 m_num_read = 0;
+};
+
+#endif // PLAYBACKDEVICE_H
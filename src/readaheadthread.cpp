@@ -0,0 +1,90 @@
+#include "readaheadthread.h"
+
+ReadAheadThread::ReadAheadThread(PcmReader* reader, int buffer_size,
+                                 int chunk_size, QObject* parent) :
+  QThread(parent),
+  m_reader(reader),
+  m_buffer(buffer_size),
+  m_chunk(qMax(1, chunk_size)),
+  m_error_pos(std::numeric_limits<qint64>::max()),
+  m_num_stalls(0),
+  m_should_stop(false) {}
+
+ReadAheadThread::~ReadAheadThread() {
+  stop();
+}
+
+void ReadAheadThread::seek(qint64 pos) {
+  QMutexLocker locker(&m_mutex);
+
+  // The thread isn't writing to the buffer while we hold the lock, and we're
+  // the consumer ourselves, so it is safe to clear it.
+  m_buffer.clear();
+  m_pos = pos;
+  m_generation++;
+  m_error_pos = std::numeric_limits<qint64>::max();
+
+  m_wake.wakeOne();
+}
+
+int ReadAheadThread::read(char* data, int max_bytes) {
+  int num_read = m_buffer.read(data, max_bytes);
+  if (num_read > 0) {
+    // There's room in the buffer again. This is lock-free; if the thread
+    // isn't waiting right now, it will find out soon enough.
+    m_wake.wakeOne();
+  }
+  return num_read;
+}
+
+qint64 ReadAheadThread::endPosition() const {
+  return qMin(m_error_pos.load(), m_reader->size());
+}
+
+qreal ReadAheadThread::fillLevel() const {
+  if (m_buffer.capacity() == 0) return 0.0;
+  return (qreal)m_buffer.bytesAvailable() / m_buffer.capacity();
+}
+
+void ReadAheadThread::stop() {
+  m_should_stop = true;
+  m_wake.wakeOne();
+  wait();
+}
+
+void ReadAheadThread::run() {
+  m_mutex.lock();
+  while (!m_should_stop) {
+    qint64 pos       = m_pos;
+    qint64 num_bytes = qMin((qint64)m_buffer.bytesFree(),
+                            qMin((qint64)m_chunk.size(),
+                                 endPosition() - pos));
+    num_bytes = qMin(num_bytes, m_reader->available(pos));
+    if (num_bytes <= 0) {
+      // The buffer is full, we're at the end or the data at this position
+      // isn't there yet; wait for the consumer or the writer of the file.
+      m_wake.wait(&m_mutex, MAX_SLEEP);
+      continue;
+    }
+
+    // Read from file without holding the lock, so that seeking doesn't have
+    // to wait for slow storage.
+    quint64 generation = m_generation;
+    m_mutex.unlock();
+    qint64 num_read = m_reader->read(pos, m_chunk.data(), num_bytes);
+    m_mutex.lock();
+
+    // If the consumer seeked in the meantime, the data is useless.
+    if (generation != m_generation) continue;
+
+    if (num_read <= 0) {
+      // We can't read any further, so this is where the audio ends.
+      m_error_pos = pos;
+      continue;
+    }
+
+    m_buffer.write(m_chunk.data(), num_read);
+    m_pos = pos + num_read;
+  }
+  m_mutex.unlock();
+}
@@ -0,0 +1,111 @@
+#ifndef READAHEADTHREAD_H
+#define READAHEADTHREAD_H
+
+#include <QThread>
+
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <atomic>
+#include <limits>
+#include <vector>
+
+#include "pcmreader.h"
+#include "pcmringbuffer.h"
+
+/** A thread that reads raw audio data ahead of playback, so that slow storage
+ *  can't starve the audio output.
+ *  The thread keeps a PcmRingBuffer filled with audio data from a PcmReader,
+ *  starting at a given position. The consumer (the thread that created this
+ *  object, normally the GUI thread) drains the buffer with read(), which
+ *  never blocks and never touches the file.
+ *
+ *  Seeking is done with seek(), which should be called from the consumer
+ *  thread as well. It discards everything in the buffer and lets the thread
+ *  start reading from the new position. This is the only operation that takes
+ *  a lock, and the thread never holds that lock while doing file I/O. */
+class ReadAheadThread : public QThread {
+  Q_OBJECT
+
+public:
+  /** @param reader the PcmReader to read from. It should stay alive for the
+   *                lifetime of this object, and should not be used by anyone
+   *                else while the thread is running.
+   *  @param buffer_size the number of bytes to keep prefetched
+   *  @param chunk_size the maximum number of bytes to read from file in one
+   *                    go. */
+  ReadAheadThread(PcmReader* reader, int buffer_size, int chunk_size,
+                  QObject* parent = 0);
+
+  /** Stop the thread and wait for it to finish. */
+  ~ReadAheadThread();
+
+  /** Discard the prefetched data and continue reading from pos, relative to
+   *  the start of the audio data. */
+  void seek(qint64 pos);
+
+  /** Copy at most max_bytes of prefetched data into data.
+   *  @return the number of bytes actually read. */
+  int read(char* data, int max_bytes);
+
+  /** The number of bytes that can be read right now. */
+  int bytesAvailable() const {return m_buffer.bytesAvailable();}
+
+  /** The size of the read-ahead buffer in bytes. */
+  int bufferSize() const {return m_buffer.capacity();}
+
+  /** The fill level of the read-ahead buffer, between 0.0 and 1.0. */
+  qreal fillLevel() const;
+
+  /** The position up to which data can be read. This is normally the size of
+   *  the audio data (which may still change if the reader follows a file that
+   *  is being written), but it is less if the file couldn't be read beyond
+   *  that point. */
+  qint64 endPosition() const;
+
+  /** The consumer should call this when it needs data but there isn't any
+   *  available yet, so we can keep count of how often this happens. */
+  void registerStall() {m_num_stalls++;}
+
+  /** The number of times the consumer ran out of data. */
+  int numStalls() const {return m_num_stalls.load();}
+
+  /** Ask the thread to finish and wait until it does. */
+  void stop();
+
+protected:
+  void run() override;
+
+private:
+  PcmReader*    m_reader;
+  PcmRingBuffer m_buffer;
+
+  /** Scratch buffer for reading from file, outside of the lock. */
+  std::vector<char> m_chunk;
+
+  /** Protects m_pos and m_generation. */
+  QMutex m_mutex;
+
+  /** Used to wake up the thread when there's room in the buffer or when we
+   *  seek. */
+  QWaitCondition m_wake;
+
+  /** The position in the audio data that should be read next. */
+  qint64 m_pos = 0;
+
+  /** Increased on every seek, so that the thread can discard data that it read
+   *  from the old position. */
+  quint64 m_generation = 0;
+
+  /** The position where reading failed, or the maximum qint64 if it didn't.
+   */
+  std::atomic<qint64> m_error_pos;
+  std::atomic<int>    m_num_stalls;
+  std::atomic<bool>   m_should_stop;
+
+  /** The maximum time to sleep when there's nothing to do, in ms. This is a
+   *  safeguard against missed wake-ups. */
+  const unsigned long MAX_SLEEP = 20;
+};
+
+#endif // READAHEADTHREAD_H
@@ -0,0 +1,48 @@
+#include "rewindcache.h"
+
+RewindCache::RewindCache(int capacity) : m_data(qMax(0, capacity)) {}
+
+void RewindCache::setCapacity(int capacity) {
+  m_data.assign(qMax(0, capacity), 0);
+  reset(m_end);
+}
+
+void RewindCache::reset(qint64 pos) {
+  m_start = pos;
+  m_end   = pos;
+}
+
+void RewindCache::append(qint64 pos, const char* data, int num_bytes) {
+  int capacity = this->capacity();
+  if (capacity == 0 || num_bytes <= 0) return;
+  if (pos != m_end) reset(pos);
+
+  // Only the last part fits if there's more than we can hold
+  if (num_bytes > capacity) {
+    data      += num_bytes - capacity;
+    pos       += num_bytes - capacity;
+    num_bytes  = capacity;
+  }
+
+  // Copy the data in at most two parts, like in PcmRingBuffer
+  int index = pos % capacity;
+  int first = qMin(num_bytes, capacity - index);
+  memcpy(m_data.data() + index, data, first);
+  memcpy(m_data.data(), data + first, num_bytes - first);
+
+  m_end   = pos + num_bytes;
+  m_start = qMax(m_start, m_end - capacity);
+}
+
+int RewindCache::read(qint64 pos, char* data, int max_bytes) const {
+  if (!contains(pos)) return 0;
+  int capacity  = this->capacity();
+  int num_bytes = (int)qMin((qint64)max_bytes, m_end - pos);
+  if (num_bytes <= 0) return 0;
+
+  int index = pos % capacity;
+  int first = qMin(num_bytes, capacity - index);
+  memcpy(data, m_data.data() + index, first);
+  memcpy(data + first, m_data.data(), num_bytes - first);
+  return num_bytes;
+}
@@ -0,0 +1,54 @@
+#ifndef REWINDCACHE_H
+#define REWINDCACHE_H
+
+#include <QtGlobal>
+
+#include <cstring>
+#include <vector>
+
+/** A cache of the audio data that was played most recently, so that skipping
+ *  back a few seconds (which is what a transcriber does all the time) doesn't
+ *  need to go back to the file or the decoder.
+ *  The cache holds one contiguous stretch of audio data, up to its capacity,
+ *  that ends at the last position that was appended. Appending data that
+ *  doesn't follow on the previous data starts a new stretch.
+ *  The cache is not thread safe; it is meant to be used by the consumer of the
+ *  audio data only. */
+class RewindCache {
+
+public:
+  explicit RewindCache(int capacity = 0);
+
+  /** Set the maximum number of bytes to keep. This discards the contents. */
+  void setCapacity(int capacity);
+  int  capacity() const {return (int)m_data.size();}
+
+  /** Discard the contents and continue with pos as the start of the next
+   *  stretch. */
+  void reset(qint64 pos);
+
+  /** Add num_bytes of audio data from position pos onwards. If the cache is
+   *  full, the oldest data is dropped. */
+  void append(qint64 pos, const char* data, int num_bytes);
+
+  /** The range of positions that the cache holds, from startPosition() up to
+   *  (but not including) endPosition(). */
+  qint64 startPosition() const {return m_start;}
+  qint64 endPosition() const {return m_end;}
+
+  /** Indicate whether the data at pos is in the cache. */
+  bool contains(qint64 pos) const {return pos >= m_start && pos < m_end;}
+
+  /** Copy at most max_bytes from position pos onwards into data.
+   *  @return the number of bytes actually copied. */
+  int read(qint64 pos, char* data, int max_bytes) const;
+
+private:
+  /** The data, stored at its position modulo the capacity. */
+  std::vector<char> m_data;
+
+  qint64 m_start = 0;
+  qint64 m_end   = 0;
+};
+
+#endif // REWINDCACHE_H
@@ -0,0 +1,85 @@
+#include "seekindex.h"
+
+void SeekIndex::add(qint64 frame, qint64 offset) {
+  if (!m_entries.isEmpty() && frame <= m_entries.last().frame) return;
+
+  Entry entry;
+  entry.frame  = frame;
+  entry.offset = offset;
+  m_entries.append(entry);
+}
+
+bool SeekIndex::find(qint64 frame, Entry& entry) const {
+  // The first entry beyond frame; we need the one before that
+  auto it = std::upper_bound(m_entries.begin(), m_entries.end(), frame,
+                             [](qint64 frame, const Entry& entry) {
+                               return frame < entry.frame;
+                             });
+  if (it == m_entries.begin()) return false;
+  entry = *(it - 1);
+  return true;
+}
+
+bool SeekIndex::load(const QString& audio_path) {
+  m_entries.clear();
+
+  QFile file(indexPath(audio_path));
+  if (!file.open(QIODevice::ReadOnly)) return false;
+  QDataStream stream(&file);
+
+  // Check that the index was made for this file as it is now
+  QFileInfo info(audio_path);
+  quint32 magic, version;
+  qint64  file_size, modified;
+  qint32  num_entries;
+  stream >> magic >> version >> file_size >> modified >> num_entries;
+  if (stream.status() != QDataStream::Ok || magic != MAGIC ||
+      version != VERSION || file_size != info.size() ||
+      modified != info.lastModified().toMSecsSinceEpoch() ||
+      num_entries < 0) {
+    return false;
+  }
+
+  m_entries.reserve(num_entries);
+  for (qint32 i = 0; i < num_entries; i++) {
+    Entry entry;
+    stream >> entry.frame >> entry.offset;
+    m_entries.append(entry);
+  }
+  if (stream.status() != QDataStream::Ok) {
+    m_entries.clear();
+    return false;
+  }
+  return true;
+}
+
+bool SeekIndex::save(const QString& audio_path) const {
+  QString path = indexPath(audio_path);
+  if (!QDir().mkpath(QFileInfo(path).absolutePath())) return false;
+
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly)) return false;
+  QDataStream stream(&file);
+
+  QFileInfo info(audio_path);
+  stream << MAGIC << VERSION << (qint64)info.size()
+         << (qint64)info.lastModified().toMSecsSinceEpoch()
+         << (qint32)m_entries.size();
+  for (const Entry& entry : m_entries) {
+    stream << entry.frame << entry.offset;
+  }
+  return stream.status() == QDataStream::Ok;
+}
+
+void SeekIndex::remove(const QString& audio_path) {
+  QFile::remove(indexPath(audio_path));
+}
+
+QString SeekIndex::indexPath(const QString& audio_path) {
+  // Name the index after a hash of the absolute path of the audio file
+  QByteArray hash = QCryptographicHash::hash(
+        QFileInfo(audio_path).absoluteFilePath().toUtf8(),
+        QCryptographicHash::Sha1).toHex();
+  return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) +
+         "/seekindex/" + QString::fromLatin1(hash) + ".idx";
+}
@@ -0,0 +1,72 @@
+#ifndef SEEKINDEX_H
+#define SEEKINDEX_H
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QString>
+#include <QVector>
+
+#include <algorithm>
+
+/** An index of a compressed audio file that maps positions in the audio (in
+ *  audio frames, or samples per channel) to the positions in the file where
+ *  decoding can start, like the start of a FLAC frame.
+ *  Only FLAC files are indexed, as FlacDecoder is the only decoder that we
+ *  can start anywhere in a file. QAudioDecoder can only decode from start to
+ *  end, so an index wouldn't help for the files it decodes, like MP3 and Ogg
+ *  files; AudioDecoder leaves seeking far into those to QMediaPlayer. On
+ *  Android, MediaCodecDecoder seeks in those files by itself.
+ *  The index is built while the file is decoded for the first time, and is
+ *  stored in the cache directory so that later on we can jump straight to any
+ *  position in the file. Lookups are a binary search, and they are sample
+ *  accurate: the entries point to exact frame boundaries, so the decoder only
+ *  needs to know where to start and how many samples to skip. */
+class SeekIndex {
+
+public:
+  struct Entry {
+    qint64 frame;  // The first audio frame that is decoded from this position
+    qint64 offset; // The position in the file
+  };
+
+  void clear() {m_entries.clear();}
+  bool isEmpty() const {return m_entries.isEmpty();}
+  int  size() const {return m_entries.size();}
+
+  /** Add an entry. Entries should be added in order; an entry that doesn't
+   *  come after the last one is ignored. */
+  void add(qint64 frame, qint64 offset);
+
+  /** Find the last entry at or before the given audio frame.
+   *  @return false if there is no such entry. */
+  bool find(qint64 frame, Entry& entry) const;
+
+  /** Load the index of the audio file at audio_path from the cache directory.
+   *  @return false if there is no index, or if it was made for a different
+   *          version of the file. */
+  bool load(const QString& audio_path);
+
+  /** Save the index of the audio file at audio_path to the cache directory. */
+  bool save(const QString& audio_path) const;
+
+  /** Delete the stored index for the audio file at audio_path, if any. */
+  static void remove(const QString& audio_path);
+
+  /** The path of the stored index for the audio file at audio_path. */
+  static QString indexPath(const QString& audio_path);
+
+private:
+  /** The entries, sorted by frame. */
+  QVector<Entry> m_entries;
+
+  /** The signature and format version of index files. */
+  static const quint32 MAGIC   = 0x54534958; // "TSIX"
+  static const quint32 VERSION = 1;
+};
+
+#endif // SEEKINDEX_H
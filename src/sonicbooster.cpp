@@ -1,10 +1,7 @@
 #include "sonicbooster.h"
 
-SonicBooster::SonicBooster(QObject* parent) : QObject(parent) {}
-
-SonicBooster::~SonicBooster() {
-  delete m_data;
-  delete m_spectrogram;
+SonicBooster::SonicBooster(QObject* parent) : QObject(parent) {
+  setGainKernel(GainKernel::best());
 }
 
 bool SonicBooster::canBoost(const QAudioFormat& format) {
@@ -27,148 +24,143 @@ bool SonicBooster::canBoost(const QAudioFormat& format) {
   return true;
 }
 
+bool SonicBooster::setFormat(const QAudioFormat& format) {
+  m_format    = format;
+  m_processor = &SonicBooster::skip;
+  if (!canBoost(format)) return false;
+
+  bool is_unsigned = format.sampleType() == QAudioFormat::UnSignedInt;
+  if (format.sampleSize() == 8) {
+    m_processor = is_unsigned ? &SonicBooster::process<quint8> :
+                                &SonicBooster::process<qint8>;
+  } else {
+    m_processor = is_unsigned ? &SonicBooster::process<quint16> :
+                                &SonicBooster::process<qint16>;
+  }
+  return true;
+}
+
 int SonicBooster::level() {
-  return round(m_level);
+  return m_level;
+}
+
+void SonicBooster::setGainKernel(GainKernel::Type type) {
+  if (!GainKernel::isSupported(type)) type = GainKernel::Scalar;
+  m_gain_kernel = type;
+  m_kernel_s8   = GainKernel::select<qint8>(type);
+  m_kernel_u8   = GainKernel::select<quint8>(type);
+  m_kernel_s16  = GainKernel::select<qint16>(type);
+  m_kernel_u16  = GainKernel::select<quint16>(type);
 }
 
 bool SonicBooster::boost(const QAudioBuffer& buffer) {
-  if (!(canBoost(buffer.format()) && buffer.isValid())) {
+  if (!buffer.isValid()) return false;
+  return boost((const char*)buffer.constData(), buffer.byteCount(),
+               buffer.format());
+}
+
+bool SonicBooster::boost(const char* data, int num_bytes,
+                         const QAudioFormat& format) {
+  m_boosted_data_bytes = 0;
+  if (!canBoost(format) || num_bytes <= 0) {
     return false;
   }
 
-  adjustDataBufferSize(buffer);
+  adjustDataBufferSize(num_bytes);
+  if (!boost(data, m_data.data(), num_bytes, format)) {
+    return false;
+  }
+  m_boosted_data_bytes = num_bytes;
+  return true;
+}
 
-  char* data = (char*)buffer.constData();
-  int   size = buffer.sampleCount();
+bool SonicBooster::boost(const char* data, char* out, int num_bytes,
+                         const QAudioFormat& format) {
+  if (format != m_format) setFormat(format);
+  return boost(data, out, num_bytes);
+}
 
-  // If format is unsigned, make a signed copy of the data and use that for the
-  // actual amplification.
-  if (buffer.format().sampleType() == QAudioFormat::UnSignedInt) {
-    if (buffer.format().sampleSize() == 8) {
-      switchSignedness((uint8_t*)data, (int8_t*)m_data, size);
-    } else if (buffer.format().sampleSize() == 16) {
-      switchSignedness((uint16_t*)data, (int16_t*)m_data, size);
-    }
-    data = m_data;
+template<typename word_type>
+bool SonicBooster::process(const char* data, char* out, int num_bytes) {
+  qreal factor = this->factor();
+  if (factor == 1.0 || num_bytes <= 0) {
+    return false;
   }
 
-  // Boost the signal
-  bool is_modified = false;
-  if (buffer.format().sampleSize() == 8) {
-    is_modified = boostAudioBuffer((int8_t*)data, size);
-  } else if (buffer.format().sampleSize() == 16) {
-    is_modified = boostAudioBuffer((int16_t*)data, size);
-  }
+  // Unsigned data is converted to signed and back on the fly, so that we
+  // only go over the data once.
+  boostAudioBuffer(factor, (const word_type*)data, (word_type*)out,
+                   num_bytes / (int)sizeof(word_type));
+  return true;
+}
 
-  // If needed, convert the modified buffer back to unsigned
-  if (buffer.format().sampleType() == QAudioFormat::UnSignedInt) {
-    if (buffer.format().sampleSize() == 8) {
-      switchSignedness((int8_t*)m_data, (uint8_t*)m_data, size);
-    } else if (buffer.format().sampleSize() == 16) {
-      switchSignedness((int16_t*)m_data, (uint16_t*)m_data, size);
-    }
+qreal SonicBooster::factor() {
+  int level = m_level;
+  if (level != m_factor_level) {
+    m_factor_level = level;
+    m_factor       = qPow(10, level / 20.0);
   }
-
-  return is_modified;
+  return m_factor;
 }
 
 const char* SonicBooster::getBoostedBuffer(int& size) {
   size = m_boosted_data_bytes;
-  return m_data;
+  return m_data.data();
 }
 
 template<typename word_type>
-bool SonicBooster::boostAudioBuffer(const word_type* data, int num_samples) {
-
-  m_boosted_data_bytes = 0;
-
-  // Calculate the amplification factor for the samples
-  qreal factor = qPow(10, m_level / 20);
-
-  if (factor != 1.0) {
-    // If we amplify the audio signal, we need to check if the amount of clipped
-    // samples is acceptible (smaller than five percent).
-    if (factor > 1.0) {
-      factor = getMaxFactor<word_type>(factor, data, num_samples);
-    }
-
-    word_type* new_buffer = (word_type*)m_data;
-    for (int i = 0; i < num_samples; i++) {
-      // qint32 should be sufficient as we only handle 8 and 16 bit data.
-      qint32 val = static_cast<qint32>(data[i]) * factor;
-
-      // Cap the value if needed
-      if (val > std::numeric_limits<word_type>::max()) {
-        val = std::numeric_limits<word_type>::max();
-      } else if (val < std::numeric_limits<word_type>::min()) {
-        val = std::numeric_limits<word_type>::min();
-      }
-      new_buffer[i] = static_cast<word_type>(val);
-    }
-    m_boosted_data_bytes = num_samples * sizeof(word_type);
-    return true;
+void SonicBooster::boostAudioBuffer(qreal factor, const word_type* data,
+                                    word_type* out, int num_samples) {
+  // If we amplify the audio signal, we need to check if the amount of clipped
+  // samples is acceptible (smaller than five percent).
+  if (factor > 1.0) {
+    factor = getMaxFactor<word_type>(factor, data, num_samples);
   }
 
-  return false;
+  kernel(data)(data, out, num_samples, factor);
 }
 
 template<typename word_type>
 qreal SonicBooster::getMaxFactor(qreal factor,
                                  const word_type* data, int num_samples) {
-  // Resize the spectrogram size if needed.
-  if (abs(std::numeric_limits<word_type>::min()) > m_spectrogram->size()) {
-    m_spectrogram->resize(abs(std::numeric_limits<word_type>::min()));
+  if ((int)m_magnitudes.size() < num_samples) {
+    m_magnitudes.resize(num_samples);
   }
-  if (std::numeric_limits<word_type>::max() > m_spectrogram->size()) {
-    m_spectrogram->resize(std::numeric_limits<word_type>::max());
-  }
-
-  // Calculate the value at which samples will be clipped
-  word_type cutoff = std::numeric_limits<word_type>::max() / factor;
 
-  // Create a reverse cumulative count of the number of samples for the
-  // relevant part of the spectrum (everything between the cutoff and the
-  // max allowable value).
-  for (int i = cutoff; i < std::numeric_limits<word_type>::max(); i++) {
-    m_spectrogram->data()[i] = 0;
-  }
+  // Calculate the value at which samples will be clipped, and collect the
+  // samples that would be. Usually there are only a few. Unsigned samples
+  // are offset by half their range.
+  const int offset   = std::numeric_limits<word_type>::is_signed ?
+                       0 : 1 << (sizeof(word_type) * 8 - 1);
+  const int max      = (1 << (sizeof(word_type) * 8 - 1)) - 1;
+  int       cutoff   = max / factor;
+  int*      loud     = m_magnitudes.data();
+  int       num_loud = 0;
   for (int i = 0; i < num_samples; i++) {
-    m_spectrogram->data()[(word_type)abs(data[i])]++;
-  }
-  for (int i = std::numeric_limits<word_type>::max() - 1; i > cutoff - 1; i--) {
-    m_spectrogram->data()[i] += m_spectrogram->data()[i + 1];
+    int magnitude = abs((int)data[i] - offset);
+    if (magnitude >= cutoff) loud[num_loud++] = magnitude;
   }
 
-  // Now we can stepwise scale down the boost factor until the number of
-  // clipped samples falls below five percent.
+  // No more than five percent of the samples may be clipped, so the one
+  // after the loudest five percent sets the limit.
   int fraction = num_samples / 20;
-  while (m_spectrogram->data()[cutoff] > fraction) {
+  if (num_loud <= fraction) return factor;
+  std::nth_element(loud, loud + fraction, loud + num_loud,
+                   std::greater<int>());
+  int threshold = loud[fraction];
+
+  // Now we can stepwise scale down the boost factor until it doesn't clip
+  // that sample anymore.
+  while (cutoff <= threshold && factor > 1.0) {
     factor -= 0.1;
-    cutoff = std::numeric_limits<word_type>::max() / factor;
+    cutoff = max / factor;
   }
 
-  return factor;
-}
-
-template<typename from_type, typename to_type>
-void SonicBooster::switchSignedness(const from_type* in_buffer,
-                                    to_type* out_buffer,
-                                    int num_samples) {
-  qint32 sign_offset = (1 << (sizeof(to_type) * 8 - 1));
-  bool to_signed = std::numeric_limits<to_type>::is_signed;
-  for (int i = 0; i < num_samples; i++) {
-    if (to_signed) {
-      out_buffer[i] = in_buffer[i] - sign_offset;
-    } else {
-      out_buffer[i] = in_buffer[i] + sign_offset;
-    }
-  }
+  return qMax((qreal)1.0, factor);
 }
 
-void SonicBooster::adjustDataBufferSize(const QAudioBuffer& buffer) {
-  if (buffer.byteCount() > m_data_max_bytes) {
-    m_data_max_bytes = buffer.byteCount();
-    m_data           = (char*)realloc(m_data,
-                                      m_data_max_bytes);
+void SonicBooster::adjustDataBufferSize(int num_bytes) {
+  if (num_bytes > (int)m_data.size()) {
+    m_data.resize(num_bytes);
   }
 }
@@ -8,14 +8,22 @@
 #include <QtGlobal>
 #include <QtMath>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <functional>
 #include <limits>
 #include <math.h>
+#include <vector>
+
+#include "gainkernel.h"
 
 /** Boost an audio buffer, so that it plays more loudly. This class is a 'slave'
  *  class to an audio player; it should constantly be fed short QAudioBuffers as
  *  input. The boosted audio is stored in an internal raw buffer, which can be
- *  requested with getBoostedBuffer() and getBoostedBufferSize().
+ *  requested with getBoostedBuffer() and getBoostedBufferSize(). Or, to save
+ *  a copy, it can be written to a buffer of the caller, or back into the
+ *  audio data itself.
  *  The boost amount can be set adjusted by the user. This number is not always
  *  used however; if the amount of clipping would become to large for a given
  *  audio buffer, it is scaled down. Thus loud parts of the audio stream will
@@ -28,14 +36,25 @@ class SonicBooster : public QObject {
 
 public:
   SonicBooster(QObject* parent = 0);
-  ~SonicBooster();
 
   /** Indicate if the signal with the given audio format can be amplified. */
   bool canBoost(const QAudioFormat& format);
 
+  /** Prepare for boosting audio in the given format, by picking the code for
+   *  its sample type and size. This only needs to be done when the format
+   *  changes.
+   *  @return false if the format can't be boosted. */
+  bool setFormat(const QAudioFormat& format);
+
   /** Return the currently set boost factor, in dB. */
   int level();
 
+  /** Select the GainKernel that does the actual boosting. By default, this is
+   *  GainKernel::best(), which on 32 bit ARM is the FixedPoint kernel. This
+   *  should be called from the thread that boosts the audio. */
+  void setGainKernel(GainKernel::Type type);
+  GainKernel::Type gainKernel() const {return m_gain_kernel;}
+
   /** Boost the given audio buffer. If succesful, the boosted audio data is
    *  available through the getBoostedBuffer() method. The return value should
    *  always be used to check if this buffer is available!
@@ -44,6 +63,26 @@ public:
    *               is false, getBoostedBuffer() doesn't contain valid data! */
   bool boost(const QAudioBuffer& buffer);
 
+  /** Boost num_bytes of raw audio data in the given format, like the other
+   *  boost() method. */
+  bool boost(const char* data, int num_bytes, const QAudioFormat& format);
+
+  /** Boost num_bytes of raw audio data in the given format into out, which
+   *  should have room for num_bytes bytes. out may be the same as data, to
+   *  boost the audio in place. This is a single pass over the data, without
+   *  the copy to the internal buffer.
+   *  @return true if the audio is boosted into out, false if it is left
+   *          alone because it can't be or doesn't need to be boosted. */
+  bool boost(const char* data, char* out, int num_bytes,
+             const QAudioFormat& format);
+
+  /** Like the other boost() method, for audio in the format that was given
+   *  to setFormat(). This is the cheapest way to boost a stream of audio, as
+   *  it goes straight to the code for the format. */
+  bool boost(const char* data, char* out, int num_bytes) {
+    return (this->*m_processor)(data, out, num_bytes);
+  }
+
   /** Return the raw boosted audio data. This can be used to write to a
    *  QIODevice opened by QAudioOutput.
    *  @param size will hold the number of bytes in the buffer. This will be 0
@@ -53,27 +92,66 @@ public:
 
 public slots:
   /** Increase of decrease the boost factor by 1 dB */
-  void increaseLevel() {m_level += 1.0;}
-  void decreaseLevel() {m_level -= 1.0;}
+  void increaseLevel() {m_level++;}
+  void decreaseLevel() {m_level--;}
 
   /** Reset the amplification level to 0 dB. */
-  void resetLevel() {m_level = 0.0;}
+  void resetLevel() {m_level = 0;}
 
 private:
-  /** Amplify the audio by the m_boost factor and store the result in the
-   *  supplied data buffer. Check the return value to make sure the data in
-   *  buffer is valid before using!
+  /** The code for boosting audio in one format, with the arguments of
+   *  boost(). */
+  typedef bool (SonicBooster::*Processor)(const char* data, char* out,
+                                          int num_bytes);
+
+  /** Boost audio with samples of type word_type, which may be signed or
+   *  unsigned. */
+  template<typename word_type> bool process(const char* data, char* out,
+                                            int num_bytes);
+
+  /** Leave audio that can't be boosted alone. */
+  bool skip(const char*, char*, int) {return false;}
+
+  /** The boost factor for the current level, which is only recalculated when
+   *  the level changes. */
+  qreal factor();
+
+  /** Amplify the audio by the given factor and store the result in out.
    *  If the signal is boosted outside its bounds, it will be clipped.
-   *  @tparam word_type the type of the audio data.
+   *  @tparam word_type the type of the audio data, which may be signed or
+   *                    unsigned.
+   *  @param factor the boost factor, which is scaled down if the audio is
+   *                loud
    *  @param data the raw data
-   *  @param num_samples the number of samples in data (not the number of bytes)
-   *  @return true if the signal was modified, false otherwise. */
-  template<typename word_type> bool boostAudioBuffer(const word_type* data,
+   *  @param out the buffer for the result, which may be the same as data
+   *  @param num_samples the number of samples in data (not the number of
+   *                     bytes) */
+  template<typename word_type> void boostAudioBuffer(qreal factor,
+                                                     const word_type* data,
+                                                     word_type* out,
                                                      int num_samples);
 
+  /** The selected gain kernel, for each sample type. */
+  GainKernel::Type              m_gain_kernel;
+  GainKernel::Function<qint8>   m_kernel_s8;
+  GainKernel::Function<quint8>  m_kernel_u8;
+  GainKernel::Function<qint16>  m_kernel_s16;
+  GainKernel::Function<quint16> m_kernel_u16;
+
+  /** Return the selected gain kernel for the type of data. */
+  GainKernel::Function<qint8>   kernel(const qint8*)   {return m_kernel_s8;}
+  GainKernel::Function<quint8>  kernel(const quint8*)  {return m_kernel_u8;}
+  GainKernel::Function<qint16>  kernel(const qint16*)  {return m_kernel_s16;}
+  GainKernel::Function<quint16> kernel(const quint16*) {return m_kernel_u16;}
+
+  /** The format from setFormat(), and the code for boosting it. */
+  QAudioFormat m_format;
+  Processor    m_processor = &SonicBooster::skip;
+
   /** Calculate the max boost factor that can be applied to the buffer without
-   *  too much clipping (where 'too much' is defined at ten per cent of the
-   *  samples.
+   *  too much clipping (where 'too much' is defined at five per cent of the
+   *  samples). The factor is lowered in steps of 0.1 until the loudest
+   *  sample that may not be clipped fits, but never below 1.0.
    *  @param factor the target boost factor
    *  @param data the actual data
    *  @param num_samples the number of samples in data
@@ -82,41 +160,31 @@ private:
                                                   const word_type* data,
                                                   int num_samples);
 
-  /** Rewrite unsigned data in in_buffer to signed data in out_buffer, or vice
-   *  versa.
-   *  @tparam from_type the type to convert from
-   *  @tparam to_type the type to convert to. It should have a different
-   *                  signedness than from_type, and the same bit width.
-   *  @param in_buffer the buffer with the input data
-   *  @param out_buffer the buffer for the modified data. It should be large
-   *                    enough to accomodate all the data
-   *  @param num_samples the number of elements in both buffers.
-   */
-  template<typename from_type, typename to_type>
-  void switchSignedness(const from_type* in_buffer,
-                        to_type* out_buffer,
-                        int num_samples);
-
-  /** Enlarge the size of m_data if the supplied buffer wouldn't fit. We never
-   *  decrease it. */
-  void adjustDataBufferSize(const QAudioBuffer& buffer);
-
-  /** The targeted audio level in dB, where 0.0 is the nominal, unboosted
-   *  audio. */
-  qreal m_level = 0.0;
-
-  /** Due to restrictions with the QMediaPlayer/QAudioProbe setup we can only
-   *  get const audio data. The result of all operations is thus copied to
-   *  another buffer. We declared it once to reduce the overhead of repeated
-   *  memory operations. This buffer will also hold the final and is returned
-   *  by getBoostedBuffer(). */
-  char* m_data = NULL;
+  /** Enlarge the size of m_data if num_bytes wouldn't fit. We never decrease
+   *  it, so that steady playback doesn't allocate memory. */
+  void adjustDataBufferSize(int num_bytes);
+
+  /** The targeted audio level in dB, where 0 is the nominal, unboosted
+   *  audio. The level is set from the GUI thread while boost() runs in the
+   *  audio thread, which only needs the latest value. */
+  std::atomic<int> m_level{0};
 
-  /** Remember the size of the audio data buffer, so that we can enlarge it if a
-   *  new buffer arrives which requires more space. We never reduce the size
-   *  though, as audio buffers are fairly constant in size and it wouldn't make
-   *  much sense to reclaim the small amount of memory. */
-  int m_data_max_bytes = 0;
+  /** The level that m_factor was calculated for. Only for the thread that
+   *  calls boost(). */
+  int   m_factor_level = 0;
+  qreal m_factor       = 1.0;
+
+  /** The buffers from the AudioDecoder are shared with other receivers of its
+   *  signal, so we can only get const audio data. Unless the caller supplies
+   *  a buffer, the result of all operations is thus copied to another
+   *  buffer. We declared it once to reduce the overhead of repeated
+   *  memory operations. This buffer will also hold the final and is returned
+   *  by getBoostedBuffer().
+   *  We enlarge it if a new buffer arrives which requires more space. We
+   *  never reduce the size though, as audio buffers are fairly constant in
+   *  size and it wouldn't make much sense to reclaim the small amount of
+   *  memory. */
+  std::vector<char> m_data;
 
   /** Keep track of the number of bytes in m_data after the last boost()
    *  operation. If the boost() operation didn't succeed, this number will be
@@ -124,11 +192,10 @@ private:
   int m_boosted_data_bytes = 0;
 
   /** To figure out by how much we can boost an audio sample without clipping it
-   *  too much, we have to count how many of each sample point there are.
-   *  We use int for this as the QAudioFormat::sampleCount() method uses this as
-   *  the return type, thus the actual count fits into an int.
-   *  Declared on the heap because of the potentially large size. */
-  QVector<int>* m_spectrogram = new QVector<int>;
+   *  too much, we collect the magnitudes of the samples that would be clipped
+   *  at the target factor here, and select the loudest one that may not be.
+   *  Like m_data, it is enlarged for larger buffers, but never reduced. */
+  std::vector<int> m_magnitudes;
 };
 
 #endif // SONICBOOSTER_H
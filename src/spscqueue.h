@@ -0,0 +1,60 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <QtGlobal>
+
+#include <atomic>
+#include <vector>
+
+/** A lock-free queue of small items, for exactly one producer thread and
+ *  exactly one consumer thread. It works like PcmRingBuffer, but with whole
+ *  items instead of bytes: the numbers of items ever pushed and popped are
+ *  kept as two 64 bit counters, and each side only modifies its own counter.
+ *  Pushing and popping never allocate memory, so the queue can be used on a
+ *  real-time thread. */
+template<typename T>
+class SpscQueue {
+
+public:
+  /** Create a queue that can hold capacity items. */
+  explicit SpscQueue(int capacity) :
+    m_items(capacity), m_capacity(capacity), m_num_pushed(0), m_num_popped(0) {}
+
+  /** Add an item to the queue. Only for the producer.
+   *  @return false if the queue is full. */
+  bool push(const T& item) {
+    quint64 num_pushed = m_num_pushed.load(std::memory_order_relaxed);
+    quint64 num_popped = m_num_popped.load(std::memory_order_acquire);
+    if (num_pushed - num_popped >= (quint64)m_capacity) return false;
+
+    m_items[num_pushed % m_capacity] = item;
+    m_num_pushed.store(num_pushed + 1, std::memory_order_release);
+    return true;
+  }
+
+  /** Take the oldest item from the queue. Only for the consumer.
+   *  @return false if the queue is empty. */
+  bool pop(T& item) {
+    quint64 num_popped = m_num_popped.load(std::memory_order_relaxed);
+    quint64 num_pushed = m_num_pushed.load(std::memory_order_acquire);
+    if (num_popped == num_pushed) return false;
+
+    item = m_items[num_popped % m_capacity];
+    m_num_popped.store(num_popped + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool isEmpty() const {
+    return m_num_pushed.load(std::memory_order_acquire) ==
+           m_num_popped.load(std::memory_order_acquire);
+  }
+
+private:
+  std::vector<T> m_items;
+  int            m_capacity;
+
+  std::atomic<quint64> m_num_pushed;
+  std::atomic<quint64> m_num_popped;
+};
+
+#endif // SPSCQUEUE_H
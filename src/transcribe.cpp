@@ -230,6 +230,8 @@ void Transcribe::guiReady(QObject* root) {
           m_player.get(), SLOT(togglePlayPause(bool)));
   connect(catcher,        SIGNAL(boost(bool)),
           m_player.get(), SLOT(boost(bool)));
+  connect(catcher,        SIGNAL(skipToMarker(bool)),
+          m_player.get(), SLOT(skipToMarker(bool)));
   root->installEventFilter(catcher);
 #ifdef Q_OS_ANDROID
   // On Android, we might connect the signals when using the virtual keyboard
@@ -0,0 +1,258 @@
+#include "wavheader.h"
+
+bool WavHeader::parse(QIODevice* file) {
+  m_file = file;
+  m_block.clear();
+  m_block_pos = 0;
+  m_chunks.clear();
+  m_data_offset    = -1;
+  m_data_size      = 0;
+  m_rf64_riff_size = -1;
+  m_rf64_data_size = -1;
+  m_rf64_table.clear();
+  m_cue_points.clear();
+  m_cue_labels.clear();
+  m_origination_time = QDateTime();
+  m_description.clear();
+
+  // The signature
+  if (!ensureBlock(0, 12)) return false;
+  QByteArray signature((const char*)at(0), 4);
+  bool is_rf64 = false;
+  if (signature == "RF64" || signature == "BW64") {
+    is_rf64 = true;
+  } else if (signature != "RIFF") {
+    // Not an actual wave file
+    return false;
+  }
+  // The length of the file, for a sanity check. For RF64 files, this is
+  // 0xFFFFFFFF and the actual size is stored in the ds64 chunk.
+  qint64 riff_size = readNumber<quint32>(at(4));
+  if (QByteArray((const char*)at(8), 4) != "WAVE") return false;
+
+  // Walk through all chunks
+  bool   has_fmt   = false;
+  qint64 file_size = m_file->size();
+  qint64 pos       = 12;
+  while (pos + 8 <= file_size) {
+    if (!ensureBlock(pos, 8)) break;
+
+    Chunk chunk;
+    chunk.id     = QByteArray((const char*)at(pos), 4);
+    chunk.offset = pos + 8;
+    chunk.size   = readNumber<quint32>(at(pos + 4));
+
+    // In RF64 files, the actual size of large chunks is in the ds64 chunk
+    if (is_rf64 && chunk.size == 0xFFFFFFFF) {
+      if (chunk.id == "data") {
+        chunk.size = m_rf64_data_size;
+      } else {
+        for (const Chunk& entry : m_rf64_table) {
+          if (entry.id == chunk.id) chunk.size = entry.size;
+        }
+      }
+      if (chunk.size < 0) return false;
+    }
+    m_chunks.append(chunk);
+
+    if (chunk.id == "data") {
+      // We only play the first data chunk
+      if (m_data_offset < 0) {
+        m_data_offset = chunk.offset;
+        m_data_size   = chunk.size;
+      }
+    } else if (chunk.id == "ds64" || chunk.id == "fmt ") {
+      // Chunks that we can't do without
+      if (chunk.size > MAX_METADATA_SIZE) return false;
+      if (!ensureBlock(chunk.offset, chunk.size)) return false;
+      if (chunk.id == "ds64") {
+        if (!is_rf64 || m_chunks.size() != 1) return false;
+        if (!parseDs64(chunk)) return false;
+      } else {
+        if (!parseFmt(chunk)) return false;
+        has_fmt = true;
+      }
+    } else if (chunk.id == "cue " || chunk.id == "LIST" || chunk.id == "bext") {
+      // Metadata, which we can do without if needed
+      if (chunk.size <= MAX_METADATA_SIZE &&
+          ensureBlock(chunk.offset, chunk.size)) {
+        if (chunk.id == "cue ") {
+          parseCue(chunk);
+        } else if (chunk.id == "LIST") {
+          parseList(chunk);
+        } else {
+          parseBext(chunk);
+        }
+      }
+    }
+
+    // Chunks are padded to an even size
+    pos = chunk.offset + chunk.size + (chunk.size % 2);
+  }
+
+  // Sanity checks
+  if (is_rf64) {
+    if (m_rf64_riff_size < 0) return false;
+    riff_size = m_rf64_riff_size;
+  }
+  if (file_size != riff_size + 8) return false;
+  if (!has_fmt || m_data_offset < 0) return false;
+
+  // Don't trust the header blindly; recordings that were cut off report
+  // more data than there actually is.
+  m_data_size = qMin(m_data_size, file_size - m_data_offset);
+  m_data_size -= m_data_size % bytesPerFrame();
+
+  // Attach the labels to the cue points and sort them
+  for (CuePoint& cue_point : m_cue_points) {
+    cue_point.label = m_cue_labels.value(cue_point.id);
+  }
+  std::sort(m_cue_points.begin(), m_cue_points.end(),
+            [](const CuePoint& a, const CuePoint& b) {return a.frame < b.frame;});
+
+  return true;
+}
+
+int WavHeader::bytesPerFrame() const {
+  return m_num_channels * PcmReader::bytesPerSample(m_encoding);
+}
+
+bool WavHeader::ensureBlock(qint64 pos, qint64 num_bytes) {
+  if (pos >= m_block_pos &&
+      pos + num_bytes <= m_block_pos + m_block.size()) {
+    return true;
+  }
+
+  if (!m_file->seek(pos)) return false;
+  m_block     = m_file->read(qMax(BLOCK_SIZE, num_bytes));
+  m_block_pos = pos;
+  return m_block.size() >= num_bytes;
+}
+
+const uchar* WavHeader::at(qint64 pos) const {
+  return (const uchar*)m_block.constData() + (pos - m_block_pos);
+}
+
+bool WavHeader::parseDs64(const Chunk& chunk) {
+  if (chunk.size < 28) return false;
+  const uchar* data = at(chunk.offset);
+
+  m_rf64_riff_size = readNumber<qint64>(data);
+  m_rf64_data_size = readNumber<qint64>(data + 8);
+  if (m_rf64_riff_size < 0 || m_rf64_data_size < 0) return false;
+
+  // The sizes of other large chunks
+  quint32 table_size = readNumber<quint32>(data + 24);
+  for (quint32 i = 0; i < table_size && 28 + (i + 1) * 12 <= chunk.size; i++) {
+    const uchar* entry = data + 28 + i * 12;
+    Chunk table_chunk;
+    table_chunk.id     = QByteArray((const char*)entry, 4);
+    table_chunk.offset = -1;
+    table_chunk.size   = readNumber<qint64>(entry + 4);
+    m_rf64_table.append(table_chunk);
+  }
+
+  return true;
+}
+
+bool WavHeader::parseFmt(const Chunk& chunk) {
+  if (chunk.size < 16) return false;
+  const uchar* data = at(chunk.offset);
+
+  quint16 format_tag      = readNumber<quint16>(data);
+  m_num_channels          = readNumber<quint16>(data + 2);
+  m_sample_rate           = readNumber<quint32>(data + 4);
+  quint16 bits_per_sample = readNumber<quint16>(data + 14);
+  if (m_num_channels <= 0 || m_sample_rate <= 0) return false;
+
+  // For WAVE_FORMAT_EXTENSIBLE, the actual format tag is in the first two
+  // bytes of the SubFormat GUID. The other extra fields (the number of valid
+  // bits and the speaker positions) don't matter to us; samples are always
+  // aligned to the most significant bits of the container.
+  if (format_tag == WAVE_FORMAT_EXTENSIBLE) {
+    if (chunk.size < 40) return false;
+    format_tag = readNumber<quint16>(data + 24);
+  }
+
+  if (format_tag == WAVE_FORMAT_PCM) {
+    switch (bits_per_sample) {
+      case 8:  m_encoding = PcmReader::UnsignedInt8; break;
+      case 16: m_encoding = PcmReader::SignedInt16;  break;
+      case 24: m_encoding = PcmReader::SignedInt24;  break;
+      case 32: m_encoding = PcmReader::SignedInt32;  break;
+      default: return false;
+    }
+  } else if (format_tag == WAVE_FORMAT_IEEE_FLOAT && bits_per_sample == 32) {
+    m_encoding = PcmReader::Float32;
+  } else {
+    return false; // Compressed or otherwise unsupported
+  }
+
+  return true;
+}
+
+void WavHeader::parseCue(const Chunk& chunk) {
+  if (chunk.size < 4) return;
+  const uchar* data = at(chunk.offset);
+
+  quint32 num_cue_points = readNumber<quint32>(data);
+  for (quint32 i = 0; i < num_cue_points && 4 + (i + 1) * 24 <= chunk.size; i++) {
+    const uchar* cue_data = data + 4 + i * 24;
+    CuePoint cue_point;
+    cue_point.id    = readNumber<quint32>(cue_data);
+    cue_point.frame = readNumber<quint32>(cue_data + 20); // The sample offset
+    m_cue_points.append(cue_point);
+  }
+}
+
+void WavHeader::parseList(const Chunk& chunk) {
+  if (chunk.size < 4) return;
+  const uchar* data = at(chunk.offset);
+
+  // We're only interested in associated data lists
+  if (QByteArray((const char*)data, 4) != "adtl") return;
+
+  // Walk through the subchunks, looking for labels
+  qint64 pos = 4;
+  while (pos + 8 <= chunk.size) {
+    QByteArray id((const char*)data + pos, 4);
+    qint64     size = readNumber<quint32>(data + pos + 4);
+    if (pos + 8 + size > chunk.size) break;
+
+    if (id == "labl" && size >= 4) {
+      quint32 cue_id = readNumber<quint32>(data + pos + 8);
+      m_cue_labels[cue_id] = readString(data + pos + 12, size - 4);
+    }
+
+    pos += 8 + size + (size % 2);
+  }
+}
+
+void WavHeader::parseBext(const Chunk& chunk) {
+  // Description (256), originator (32), originator reference (32),
+  // origination date (10) and origination time (8)
+  if (chunk.size < 338) return;
+  const uchar* data = at(chunk.offset);
+
+  m_description = readString(data, 256);
+
+  // The date is formatted as yyyy-mm-dd and the time as hh-mm-ss, but the
+  // separators may be any character, so we just pick out the digits.
+  QString date = readString(data + 320, 10);
+  QString time = readString(data + 330, 8);
+  if (date.length() == 10 && time.length() == 8) {
+    QDate origination_date(date.mid(0, 4).toInt(), date.mid(5, 2).toInt(),
+                           date.mid(8, 2).toInt());
+    QTime origination_time(time.mid(0, 2).toInt(), time.mid(3, 2).toInt(),
+                           time.mid(6, 2).toInt());
+    if (origination_date.isValid() && origination_time.isValid()) {
+      m_origination_time = QDateTime(origination_date, origination_time);
+    }
+  }
+}
+
+QString WavHeader::readString(const uchar* data, int max_size) {
+  int length = 0;
+  while (length < max_size && data[length] != '\0') length++;
+  return QString::fromLatin1((const char*)data, length).trimmed();
+}
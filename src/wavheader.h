@@ -0,0 +1,150 @@
+#ifndef WAVHEADER_H
+#define WAVHEADER_H
+
+#include <QByteArray>
+#include <QDate>
+#include <QDateTime>
+#include <QHash>
+#include <QIODevice>
+#include <QString>
+#include <QTime>
+#include <QVector>
+#include <QtEndian>
+
+#include <algorithm>
+
+#include "pcmreader.h"
+
+/** Parser for the header of WAV files (RIFF, RF64 and BW64).
+ *  Rather than reading the header field by field, the parser reads a large
+ *  block from the start of the file in one go and walks through all chunks in
+ *  memory, building a table of every chunk in the file. A new block is only
+ *  read when a chunk header lies beyond the current block, which normally only
+ *  happens once; for chunks that trail the (large) data chunk.
+ *
+ *  Besides the format and the location of the audio data, the parser picks up
+ *  the metadata that's relevant for transcriptions:
+ *  - cue points from the 'cue ' chunk, with their labels from the 'labl'
+ *    subchunks of a 'LIST' chunk of type 'adtl'
+ *  - the origination date and time and the description from the Broadcast
+ *    Wave 'bext' chunk. */
+class WavHeader {
+
+public:
+  /** A chunk in the file. */
+  struct Chunk {
+    QByteArray id;
+    qint64     offset; // The position of the chunk data (after the header)
+    qint64     size;   // The size of the chunk data
+  };
+
+  /** A cue point, as a position in frames relative to the start of the audio
+   *  data. */
+  struct CuePoint {
+    quint32 id;
+    qint64  frame;
+    QString label;
+  };
+
+  /** Parse the header of the given file, which should be opened for reading.
+   *  This changes the position in the file.
+   *  @return true if this is a WAV file with audio data that we can read. */
+  bool parse(QIODevice* file);
+
+  /** All chunks in the file, in order. */
+  const QVector<Chunk>& chunks() const {return m_chunks;}
+
+  PcmReader::Encoding encoding() const {return m_encoding;}
+  int channelCount() const {return m_num_channels;}
+  int sampleRate() const {return m_sample_rate;}
+
+  /** The number of bytes per frame in the file. */
+  int bytesPerFrame() const;
+
+  /** The position and size of the audio data in the file. The size is
+   *  rounded down to whole frames, and doesn't extend beyond the end of the
+   *  file. */
+  qint64 dataOffset() const {return m_data_offset;}
+  qint64 dataSize() const {return m_data_size;}
+
+  /** The cue points, sorted by position. */
+  const QVector<CuePoint>& cuePoints() const {return m_cue_points;}
+
+  /** The time the recording was started, from the bext chunk. This is an
+   *  invalid QDateTime if it isn't known. */
+  QDateTime originationTime() const {return m_origination_time;}
+
+  /** The description from the bext chunk, if any. */
+  QString description() const {return m_description;}
+
+private:
+  /** Make sure that the m_block contains the num_bytes bytes at pos in the
+   *  file, reading a new block if needed.
+   *  @return false if these bytes can't be read. */
+  bool ensureBlock(qint64 pos, qint64 num_bytes);
+
+  /** Return a pointer to the data at pos in the file. ensureBlock() should
+   *  have been called for this position first. */
+  const uchar* at(qint64 pos) const;
+
+  /** Parse the contents of the specific chunks. ensureBlock() should have been
+   *  called for the complete chunk.
+   *  @return false if the chunk is invalid and the file can't be used. */
+  bool parseDs64(const Chunk& chunk);
+  bool parseFmt(const Chunk& chunk);
+  void parseCue(const Chunk& chunk);
+  void parseList(const Chunk& chunk);
+  void parseBext(const Chunk& chunk);
+
+  /** Return a string from a fixed size, possibly zero terminated, field. */
+  static QString readString(const uchar* data, int max_size);
+
+  template <typename word>
+  static word readNumber(const uchar* data) {
+    return qFromLittleEndian<word>(data);
+  }
+
+  QIODevice* m_file = NULL;
+
+  /** The block of the file we've read, and its position in the file. */
+  QByteArray m_block;
+  qint64     m_block_pos = 0;
+
+  QVector<Chunk> m_chunks;
+
+  PcmReader::Encoding m_encoding = PcmReader::SignedInt16;
+  int m_num_channels = 0;
+  int m_sample_rate  = 0;
+
+  qint64 m_data_offset = -1;
+  qint64 m_data_size   = 0;
+
+  /** The 64 bit sizes from the ds64 chunk of an RF64 file. Sizes of chunks
+   *  other than the data chunk are stored in a table, indexed by chunk id. */
+  qint64 m_rf64_riff_size = -1;
+  qint64 m_rf64_data_size = -1;
+  QVector<Chunk> m_rf64_table;
+
+  QVector<CuePoint> m_cue_points;
+
+  /** The labels of the cue points, by cue point id. */
+  QHash<quint32, QString> m_cue_labels;
+
+  QDateTime m_origination_time;
+  QString   m_description;
+
+  /** The number of bytes we read at once. Headers are usually much smaller
+   *  than this, but some recorders reserve space with a 'JUNK' chunk or store
+   *  lots of metadata. */
+  const qint64 BLOCK_SIZE = 64 * 1024;
+
+  /** Chunks with metadata larger than this are ignored. */
+  const qint64 MAX_METADATA_SIZE = 16 * 1024 * 1024;
+
+  /** The format tags in the fmt chunk of WAV files that we support. */
+  const quint16 WAVE_FORMAT_PCM        = 0x0001;
+  const quint16 WAVE_FORMAT_IEEE_FLOAT = 0x0003;
+  const quint16 WAVE_FORMAT_EXTENSIBLE = 0xFFFE;
+};
+
+#endif // WAVHEADER_H
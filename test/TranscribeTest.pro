@@ -11,39 +11,69 @@ TARGET = TranscribeTest
 CONFIG += console
 CONFIG -= app_bundle
 CONFIG += c++11
+android: LIBS += -lmediandk
 
 INCLUDEPATH += ../src
 
 SOURCES += main.cpp \
+           allocationcounter.cpp \
            audioplayertest.cpp \
            typingtimelordtest.cpp \
            keycatchertest.cpp \
            transcribetest.cpp \
            sonicboostertest.cpp \
            historymodeltest.cpp \
+           audiodecodertest.cpp \
            ../src/audioplayer.cpp \
            ../src/typingtimelord.cpp \
            ../src/keycatcher.cpp \
            ../src/transcribe.cpp \
            ../src/sonicbooster.cpp \
+           ../src/audiobufferpool.cpp \
            ../src/audiodecoder.cpp \
+           ../src/decodethread.cpp \
+           ../src/flacdecoder.cpp \
+           ../src/gainkernel.cpp \
+           ../src/pcmreader.cpp \
+           ../src/pcmringbuffer.cpp \
+           ../src/playbackdevice.cpp \
+           ../src/readaheadthread.cpp \
+           ../src/rewindcache.cpp \
+           ../src/seekindex.cpp \
+           ../src/wavheader.cpp \
            ../src/historymodel.cpp \
            ../src/icontranslationmatrix.cpp
+android: SOURCES += ../src/mediacodecdecoder.cpp
 
-HEADERS += audioplayertest.h \
+HEADERS += allocationcounter.h \
+           audioplayertest.h \
            typingtimelordtest.h \
            keycatchertest.h \
            transcribetest.h \
            sonicboostertest.h \
            historymodeltest.h \
+           audiodecodertest.h \
            ../src/audioplayer.h \
            ../src/typingtimelord.h \
            ../src/keycatcher.h \
            ../src/transcribe.h \
            ../src/sonicbooster.h \
+           ../src/audiobufferpool.h \
            ../src/audiodecoder.h \
+           ../src/decodethread.h \
+           ../src/flacdecoder.h \
+           ../src/gainkernel.h \
+           ../src/pcmreader.h \
+           ../src/pcmringbuffer.h \
+           ../src/playbackdevice.h \
+           ../src/readaheadthread.h \
+           ../src/rewindcache.h \
+           ../src/seekindex.h \
+           ../src/spscqueue.h \
+           ../src/wavheader.h \
            ../src/historymodel.h \
            ../src/icontranslationmatrix.h
+android: HEADERS += ../src/mediacodecdecoder.h
 
 RESOURCES += ../src/qml.qrc
 
@@ -0,0 +1,89 @@
+#include "allocationcounter.h"
+
+#include <QObject>
+#include <QSemaphore>
+#include <QThread>
+#include <QTimer>
+
+#include <cstdlib>
+#include <new>
+
+/** The number of allocations made by each thread. It's atomic so that the
+ *  count of one thread can be read from another. */
+static thread_local std::atomic<int> num_allocations(0);
+
+static inline void countAllocation() {
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+#ifdef __GLIBC__
+// glibc lets us take over the allocation functions, while still using its
+// own implementation underneath
+extern "C" {
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t num, std::size_t size);
+void* __libc_realloc(void* memory, std::size_t size);
+
+void* malloc(std::size_t size) noexcept {
+  countAllocation();
+  return __libc_malloc(size);
+}
+
+void* calloc(std::size_t num, std::size_t size) noexcept {
+  countAllocation();
+  return __libc_calloc(num, size);
+}
+
+void* realloc(void* memory, std::size_t size) noexcept {
+  countAllocation();
+  return __libc_realloc(memory, size);
+}
+}
+#endif
+
+void* operator new(std::size_t size) {
+#ifndef __GLIBC__
+  // Otherwise, malloc() counts it already
+  countAllocation();
+#endif
+  void* memory = std::malloc(size == 0 ? 1 : size);
+  if (memory == NULL) throw std::bad_alloc();
+  return memory;
+}
+
+void* operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* memory) noexcept {
+  std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+  std::free(memory);
+}
+
+AllocationCounter::AllocationCounter() :
+  m_count(&num_allocations),
+  m_start(num_allocations.load()) {}
+
+AllocationCounter::AllocationCounter(QObject* object) {
+  if (object->thread() == QThread::currentThread()) {
+    m_count = &num_allocations;
+    m_start = num_allocations.load();
+    return;
+  }
+
+  // We can only get at the count of the other thread from that thread
+  QSemaphore done;
+  QTimer::singleShot(0, object, [this, &done]() {
+    m_count = &num_allocations;
+    m_start = num_allocations.load();
+    done.release();
+  });
+  done.acquire();
+}
+
+int AllocationCounter::numAllocations() const {
+  return m_count->load() - m_start;
+}
@@ -0,0 +1,31 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <atomic>
+
+class QObject;
+
+/** Counts the heap allocations that a thread makes from the moment the
+ *  counter is created, for tests that check that code doesn't allocate
+ *  memory. The test program replaces the global operator new for this, and
+ *  with glibc also malloc(), calloc() and realloc(), so that allocations by
+ *  Qt containers and the C library count as well. */
+class AllocationCounter {
+
+public:
+  /** Count the allocations of the current thread. */
+  AllocationCounter();
+
+  /** Count the allocations of the thread that object lives in, like the
+   *  audio thread of a player. That thread needs to run an event loop. */
+  explicit AllocationCounter(QObject* object);
+
+  /** The number of allocations since the counter was created. */
+  int numAllocations() const;
+
+private:
+  const std::atomic<int>* m_count;
+  int m_start;
+};
+
+#endif // ALLOCATIONCOUNTER_H
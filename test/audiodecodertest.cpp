@@ -0,0 +1,896 @@
+#include "audiodecodertest.h"
+
+AudioDecoderTest::AudioDecoderTest(QObject* parent) : QObject(parent) {
+  m_noise_file =  QString(SRCDIR);
+  m_noise_file += "files/noise.wav";
+
+  // Keep the seek indexes of the test files out of the real cache directory
+  QStandardPaths::setTestModeEnabled(true);
+}
+
+void AudioDecoderTest::openNoiseFile(AudioDecoder& decoder, bool use_mmap,
+                                     int read_ahead_time) {
+  decoder.setMemoryMapping(use_mmap);
+  decoder.setReadAheadTime(read_ahead_time);
+  decoder.setMedia(QUrl::fromLocalFile(m_noise_file));
+}
+
+QByteArray AudioDecoderTest::createLargeFile(const QString& path,
+                                             qint64 data_size, bool is_rf64,
+                                             qint64 marker_time) {
+  const int    num_channels    = 2;
+  const int    sample_rate     = 44100;
+  const int    bytes_per_frame = num_channels * 2;
+
+  // Build the header
+  QByteArray header;
+  auto append32 = [&header](quint32 value) {
+    uchar bytes[4];
+    qToLittleEndian(value, bytes);
+    header.append((const char*)bytes, 4);
+  };
+  auto append64 = [&header](quint64 value) {
+    uchar bytes[8];
+    qToLittleEndian(value, bytes);
+    header.append((const char*)bytes, 8);
+  };
+
+  qint64 header_size = is_rf64 ? 80 : 44;
+  qint64 riff_size   = header_size + data_size - 8;
+  if (is_rf64) {
+    header.append("RF64");
+    append32(0xFFFFFFFF);
+    header.append("WAVE");
+    header.append("ds64");
+    append32(28);
+    append64(riff_size);
+    append64(data_size);
+    append64(data_size / bytes_per_frame);
+    append32(0); // No table entries
+  } else {
+    header.append("RIFF");
+    append32(riff_size);
+    header.append("WAVE");
+  }
+  header.append("fmt ");
+  append32(16);
+  header.append("\x01\x00", 2); // PCM
+  header.append((char)num_channels); header.append('\0');
+  append32(sample_rate);
+  append32(sample_rate * bytes_per_frame);
+  header.append((char)bytes_per_frame); header.append('\0');
+  header.append((char)16); header.append('\0');
+  header.append("data");
+  append32(is_rf64 ? 0xFFFFFFFF : data_size);
+  if (header.size() != header_size) return QByteArray();
+
+  // Write the header and extend the file without actually writing the data
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly)) return QByteArray();
+  if (file.write(header) != header_size) return QByteArray();
+  if (!file.resize(header_size + data_size)) return QByteArray();
+
+  // Write the pattern at the marker position
+  QByteArray pattern;
+  for (int i = 0; i < PERIOD_SIZE; i++) {
+    pattern.append((char)(i * 7 + 3));
+  }
+  qint64 marker_pos = (marker_time * sample_rate / 1000) * bytes_per_frame;
+  if (!file.seek(header_size + marker_pos)) return QByteArray();
+  if (file.write(pattern) != pattern.size()) return QByteArray();
+
+  return pattern;
+}
+
+bool AudioDecoderTest::hasAudioOutput() {
+  return !QAudioDeviceInfo::defaultOutputDevice().isNull();
+}
+
+QByteArray AudioDecoderTest::readAll(AudioDecoder& decoder) {
+  QByteArray data;
+  QElapsedTimer timer;
+  timer.start();
+  while (decoder.mediaStatus() != QMediaPlayer::EndOfMedia &&
+         timer.elapsed() < 5000) {
+    QAudioBuffer buffer = decoder.readBuffer(PERIOD_SIZE);
+    if (buffer.isValid()) {
+      data.append((const char*)buffer.constData(), buffer.byteCount());
+    } else {
+      QTest::qWait(1);
+    }
+  }
+  return data;
+}
+
+void AudioDecoderTest::memoryMapping() {
+  AudioDecoder mapped;
+  openNoiseFile(mapped, true);
+  QVERIFY(mapped.isMemoryMapped());
+
+  AudioDecoder unmapped;
+  openNoiseFile(unmapped, false);
+  QVERIFY(!unmapped.isMemoryMapped());
+
+  QCOMPARE(mapped.duration(), unmapped.duration());
+
+  QByteArray mapped_data   = readAll(mapped);
+  QByteArray unmapped_data = readAll(unmapped);
+  QVERIFY(mapped_data.size() > 0);
+  QCOMPARE(mapped_data.size(), unmapped_data.size());
+  QVERIFY(mapped_data == unmapped_data);
+
+  QCOMPARE(mapped.position(), unmapped.position());
+  QCOMPARE(mapped.mediaStatus(),   QMediaPlayer::EndOfMedia);
+  QCOMPARE(unmapped.mediaStatus(), QMediaPlayer::EndOfMedia);
+}
+
+void AudioDecoderTest::seekMemoryMapped() {
+  AudioDecoder mapped;
+  openNoiseFile(mapped, true);
+  AudioDecoder unmapped;
+  openNoiseFile(unmapped, false);
+
+  mapped.setPosition(3000);
+  unmapped.setPosition(3000);
+  QCOMPARE(mapped.position(), (qint64)3000);
+  QCOMPARE(unmapped.position(), (qint64)3000);
+
+  QAudioBuffer mapped_buffer   = mapped.readBuffer(PERIOD_SIZE);
+  QAudioBuffer unmapped_buffer = unmapped.readBuffer(PERIOD_SIZE);
+  QVERIFY(mapped_buffer.isValid());
+  QCOMPARE(mapped_buffer.byteCount(), unmapped_buffer.byteCount());
+  QVERIFY(memcmp(mapped_buffer.constData(), unmapped_buffer.constData(),
+                 mapped_buffer.byteCount()) == 0);
+
+  // Seeking past the end should cap at the end of the data
+  mapped.setPosition(100000);
+  QCOMPARE(mapped.position(), mapped.duration());
+  QVERIFY(!mapped.readBuffer(PERIOD_SIZE).isValid());
+}
+
+void AudioDecoderTest::readAhead() {
+  AudioDecoder direct;
+  openNoiseFile(direct, true);
+  AudioDecoder ahead;
+  openNoiseFile(ahead, true, 500);
+
+  QByteArray direct_data = readAll(direct);
+  QByteArray ahead_data  = readAll(ahead);
+  QVERIFY(direct_data.size() > 0);
+  QVERIFY(direct_data == ahead_data);
+  QCOMPARE(ahead.position(), direct.position());
+
+  // After seeking, the thread should continue from the new position
+  direct.setPosition(3000);
+  ahead.setPosition(3000);
+  QCOMPARE(ahead.position(), (qint64)3000);
+  direct_data = readAll(direct);
+  ahead_data  = readAll(ahead);
+  QVERIFY(direct_data.size() > 0);
+  QVERIFY(direct_data == ahead_data);
+}
+
+void AudioDecoderTest::readAheadFillLevel() {
+  AudioDecoder decoder;
+  openNoiseFile(decoder, false, 500);
+  QTRY_COMPARE(decoder.readAheadFillLevel(), 1.0);
+
+  QVERIFY(decoder.readBuffer(PERIOD_SIZE).isValid());
+  QCOMPARE(decoder.readAheadStalls(), 0);
+
+  // Without reading ahead, there's nothing to report
+  AudioDecoder direct;
+  openNoiseFile(direct, false);
+  QCOMPARE(direct.readAheadFillLevel(), 0.0);
+  QCOMPARE(direct.readAheadStalls(), 0);
+}
+
+void AudioDecoderTest::rewindCache_data() {
+  QTest::addColumn<int>("read_ahead_time");
+
+  QTest::newRow("read ahead") << 500;
+  QTest::newRow("direct")     << 0;
+}
+
+void AudioDecoderTest::rewindCache() {
+  QFETCH(int, read_ahead_time);
+
+  AudioDecoder reference;
+  reference.setRewindTime(0);
+  openNoiseFile(reference, false);
+  AudioDecoder decoder;
+  decoder.setRewindTime(2000);
+  openNoiseFile(decoder, false, read_ahead_time);
+  QCOMPARE(decoder.rewindTime(), 2000);
+
+  // Play three seconds
+  QElapsedTimer timer;
+  timer.start();
+  while (decoder.position() < 3000 && timer.elapsed() < 5000) {
+    if (!decoder.readBuffer(PERIOD_SIZE).isValid()) QTest::qWait(1);
+  }
+  QVERIFY(decoder.position() >= 3000);
+
+  // Skipping back within the last two seconds doesn't need the file
+  decoder.setPosition(decoder.position() - 1500);
+  QCOMPARE(decoder.rewindHits(), 1);
+  QCOMPARE(decoder.rewindMisses(), 0);
+  reference.setPosition(decoder.position());
+  QAudioBuffer buffer = decoder.readBuffer(PERIOD_SIZE);
+  QVERIFY(buffer.isValid());
+  QByteArray data((const char*)buffer.constData(), buffer.byteCount());
+
+  // Beyond the replayed audio, we should continue seamlessly
+  data.append(readAll(decoder));
+  QVERIFY(data == readAll(reference));
+
+  // Skipping back beyond the cache is a miss
+  decoder.setPosition(1000);
+  QCOMPARE(decoder.rewindHits(), 1);
+  QCOMPARE(decoder.rewindMisses(), 1);
+  reference.setPosition(1000);
+  QVERIFY(readAll(decoder) == readAll(reference));
+
+  // Without a cache, nothing is counted
+  reference.setPosition(0);
+  QCOMPARE(reference.rewindHits(), 0);
+  QCOMPARE(reference.rewindMisses(), 0);
+}
+
+void AudioDecoderTest::formats_data() {
+  QTest::addColumn<QString>("file_name");
+  QTest::addColumn<bool>("use_mmap");
+
+  QStringList file_names = {"sine24.wav", "sine24ext.wav", "sine32.wav",
+                            "sinefloat.wav", "sinefloatext.wav"};
+  for (QString file_name : file_names) {
+    QTest::newRow(QString(file_name + " read").toLatin1().constData())
+        << file_name << false;
+    QTest::newRow(QString(file_name + " mmap").toLatin1().constData())
+        << file_name << true;
+  }
+}
+
+void AudioDecoderTest::formats() {
+  QFETCH(QString, file_name);
+  QFETCH(bool, use_mmap);
+
+  AudioDecoder reference;
+  reference.setReadAheadTime(0);
+  reference.setMedia(QUrl::fromLocalFile(QString(SRCDIR) + "files/sine16.wav"));
+
+  AudioDecoder decoder;
+  decoder.setMemoryMapping(use_mmap);
+  decoder.setReadAheadTime(0);
+  decoder.setMedia(QUrl::fromLocalFile(QString(SRCDIR) + "files/" + file_name));
+  QVERIFY(decoder.isIntercepting());
+  QCOMPARE(decoder.duration(), (qint64)2000);
+  QCOMPARE(decoder.isMemoryMapped(), use_mmap);
+
+  QAudioBuffer first = decoder.readBuffer(PERIOD_SIZE);
+  QVERIFY(first.isValid());
+  QCOMPARE(first.format().sampleSize(), 16);
+  QCOMPARE(first.format().sampleType(), QAudioFormat::SignedInt);
+
+  decoder.setPosition(0);
+  QByteArray reference_data = readAll(reference);
+  QByteArray data           = readAll(decoder);
+  QCOMPARE(data.size(), reference_data.size());
+  QVERIFY(data == reference_data);
+}
+
+void AudioDecoderTest::largeFiles_data() {
+  QTest::addColumn<bool>("is_rf64");
+  QTest::addColumn<qint64>("data_size");
+  QTest::addColumn<bool>("use_mmap");
+
+  // About 3.4 hours and 8.1 hours
+  qint64 riff_size = Q_INT64_C(3) * 1024 * 1024 * 1024;
+  qint64 rf64_size = Q_INT64_C(8) * 3600 * 44100 * 4 + 4 * 44100 * 4;
+
+  QTest::newRow("RIFF > 2 GB, read") << false << riff_size << false;
+  QTest::newRow("RIFF > 2 GB, mmap") << false << riff_size << true;
+  QTest::newRow("RF64, read")        << true  << rf64_size << false;
+  QTest::newRow("RF64, mmap")        << true  << rf64_size << true;
+}
+
+void AudioDecoderTest::largeFiles() {
+  QFETCH(bool,   is_rf64);
+  QFETCH(qint64, data_size);
+  QFETCH(bool,   use_mmap);
+
+  QTemporaryDir dir;
+  QVERIFY(dir.isValid());
+  QString path = dir.path() + "/large.wav";
+
+  qint64 duration    = (data_size / 4) * 1000 / 44100;
+  qint64 marker_time = duration - 2000;
+  QByteArray pattern = createLargeFile(path, data_size, is_rf64, marker_time);
+  if (pattern.isEmpty()) {
+    QSKIP("Can't create a sparse file in the temporary directory");
+  }
+
+  AudioDecoder decoder;
+  decoder.setMemoryMapping(use_mmap);
+  decoder.setReadAheadTime(0);
+  decoder.setMedia(QUrl::fromLocalFile(path));
+  QVERIFY(decoder.isIntercepting());
+  QCOMPARE(decoder.duration(), duration);
+
+  // Data at the start of the file is silence
+  QAudioBuffer buffer = decoder.readBuffer(PERIOD_SIZE);
+  QVERIFY(buffer.isValid());
+  QCOMPARE(buffer.byteCount(), PERIOD_SIZE);
+  QVERIFY(QByteArray((const char*)buffer.constData(), PERIOD_SIZE) ==
+          QByteArray(PERIOD_SIZE, '\0'));
+
+  // Seek to the marker, beyond 2 GB
+  decoder.setPosition(marker_time);
+  QCOMPARE(decoder.position(), marker_time);
+  buffer = decoder.readBuffer(PERIOD_SIZE);
+  QVERIFY(buffer.isValid());
+  QCOMPARE(buffer.byteCount(), PERIOD_SIZE);
+  QVERIFY(QByteArray((const char*)buffer.constData(), PERIOD_SIZE) == pattern);
+
+  // The position should have advanced by exactly one period
+  QCOMPARE(decoder.position(), marker_time + (PERIOD_SIZE / 4) * 1000 / 44100);
+
+  // Seeking to the end should put us at the end of the media
+  decoder.setPosition(duration);
+  QVERIFY(!decoder.readBuffer(PERIOD_SIZE).isValid());
+  QCOMPARE(decoder.mediaStatus(), QMediaPlayer::EndOfMedia);
+}
+
+void AudioDecoderTest::metaData() {
+  AudioDecoder decoder;
+  decoder.setReadAheadTime(0);
+  decoder.setMedia(QUrl::fromLocalFile(QString(SRCDIR) + "files/markers.wav"));
+  QVERIFY(decoder.isIntercepting());
+  QCOMPARE(decoder.duration(), (qint64)2000);
+
+  QVector<AudioDecoder::Marker> markers = decoder.markers();
+  QCOMPARE(markers.size(), 2);
+  QCOMPARE(markers[0].position, (qint64)500);
+  QCOMPARE(markers[0].label, QString("First question"));
+  QCOMPARE(markers[1].position, (qint64)1500);
+  QCOMPARE(markers[1].label, QString("Answer"));
+
+  QCOMPARE(decoder.recordingTime(),
+           QDateTime(QDate(2020, 4, 11), QTime(13, 45, 30)));
+
+  // The audio should be the same as without all this metadata
+  AudioDecoder reference;
+  reference.setReadAheadTime(0);
+  reference.setMedia(QUrl::fromLocalFile(QString(SRCDIR) + "files/sine16.wav"));
+  QVERIFY(readAll(decoder) == readAll(reference));
+
+  // Files without metadata should report nothing
+  QCOMPARE(reference.markers().size(), 0);
+  QVERIFY(!reference.recordingTime().isValid());
+}
+
+void AudioDecoderTest::decode_data() {
+  QTest::addColumn<QString>("file_name");
+  QTest::addColumn<QString>("reference_name");
+
+  // FLAC files with all kinds of subframes, block sizes and stereo modes
+  QTest::newRow("16 bit mono FLAC")   << "sine.flac"   << "sine16.wav";
+  QTest::newRow("24 bit mono FLAC")   << "sine24.flac" << "sine24.wav";
+  QTest::newRow("16 bit stereo FLAC") << "stereo.flac" << "stereo.wav";
+}
+
+void AudioDecoderTest::decode() {
+  QFETCH(QString, file_name);
+  QFETCH(QString, reference_name);
+
+  AudioDecoder reference;
+  reference.setReadAheadTime(0);
+  reference.setMedia(QUrl::fromLocalFile(QString(SRCDIR) + "files/" +
+                                         reference_name));
+
+  // FLAC files are decoded by ourselves, so this should work everywhere
+  AudioDecoder decoder;
+  decoder.setReadAheadTime(500);
+  decoder.setMedia(QUrl::fromLocalFile(QString(SRCDIR) + "files/" + file_name));
+  QVERIFY(decoder.isIntercepting());
+  QTRY_COMPARE(decoder.mediaStatus(), QMediaPlayer::LoadedMedia);
+  QVERIFY(decoder.markers().isEmpty());
+
+  QByteArray reference_data = readAll(reference);
+  QByteArray data           = readAll(decoder);
+  QVERIFY(!decoder.isDecoding());
+  QCOMPARE(decoder.duration(), reference.duration());
+  QCOMPARE(data.size(), reference_data.size());
+  QVERIFY(data == reference_data);
+
+  // Seeking works on the decoded data, so there's no need to decode again
+  decoder.setPosition(1000);
+  reference.setPosition(1000);
+  QCOMPARE(decoder.position(), (qint64)1000);
+  QVERIFY(readAll(decoder) == readAll(reference));
+}
+
+void AudioDecoderTest::seekIndex() {
+  SeekIndex index;
+  QVERIFY(index.isEmpty());
+  index.add(0,    100);
+  index.add(4096, 5000);
+  index.add(4096, 6000); // Out of order, so ignored
+  index.add(8192, 9000);
+  QCOMPARE(index.size(), 3);
+
+  SeekIndex::Entry entry;
+  QVERIFY(index.find(0, entry));
+  QCOMPARE(entry.offset, (qint64)100);
+  QVERIFY(index.find(4095, entry));
+  QCOMPARE(entry.offset, (qint64)100);
+  QVERIFY(index.find(4096, entry));
+  QCOMPARE(entry.frame,  (qint64)4096);
+  QCOMPARE(entry.offset, (qint64)5000);
+  QVERIFY(index.find(100000, entry));
+  QCOMPARE(entry.offset, (qint64)9000);
+  QVERIFY(!SeekIndex().find(0, entry));
+
+  // Store it for a file, and load it back
+  QTemporaryDir dir;
+  QString path = dir.path() + "/audio.flac";
+  QFile file(path);
+  QVERIFY(file.open(QIODevice::WriteOnly));
+  file.write(QByteArray(10000, 0));
+  file.close();
+  QVERIFY(index.save(path));
+
+  SeekIndex loaded;
+  QVERIFY(loaded.load(path));
+  QCOMPARE(loaded.size(), 3);
+  QVERIFY(loaded.find(5000, entry));
+  QCOMPARE(entry.offset, (qint64)5000);
+
+  // Another file doesn't have an index
+  QVERIFY(!loaded.load(dir.path() + "/other.flac"));
+  QVERIFY(loaded.isEmpty());
+
+  // Once the file changes, the index is worthless
+  QVERIFY(file.open(QIODevice::Append));
+  file.write(QByteArray(100, 0));
+  file.close();
+  QVERIFY(!loaded.load(path));
+
+  SeekIndex::remove(path);
+  QVERIFY(!QFile::exists(SeekIndex::indexPath(path)));
+}
+
+void AudioDecoderTest::decodeWithIndex_data() {
+  decode_data();
+}
+
+void AudioDecoderTest::decodeWithIndex() {
+  QFETCH(QString, file_name);
+  QFETCH(QString, reference_name);
+  QString path = QString(SRCDIR) + "files/" + file_name;
+
+  AudioDecoder reference;
+  reference.setReadAheadTime(0);
+  reference.setMedia(QUrl::fromLocalFile(QString(SRCDIR) + "files/" +
+                                         reference_name));
+
+  // Decode the file once to build the index
+  SeekIndex::remove(path);
+  {
+    AudioDecoder decoder;
+    decoder.setMedia(QUrl::fromLocalFile(path));
+    QTRY_VERIFY(decoder.mediaStatus() == QMediaPlayer::LoadedMedia &&
+                !decoder.isDecoding());
+  }
+  SeekIndex index;
+  QVERIFY(index.load(path));
+  QVERIFY(index.size() > 1);
+
+  // Now we can start anywhere, with and without reading ahead
+  for (int read_ahead_time : {0, 500}) {
+    AudioDecoder decoder;
+    decoder.setReadAheadTime(read_ahead_time);
+    decoder.setMedia(QUrl::fromLocalFile(path));
+    QTRY_COMPARE(decoder.mediaStatus(), QMediaPlayer::LoadedMedia);
+    decoder.setPosition(1000);
+    reference.setPosition(1000);
+    QVERIFY(readAll(decoder) == readAll(reference));
+
+    // The part before it should be filled in as well
+    decoder.setPosition(0);
+    reference.setPosition(0);
+    QVERIFY(readAll(decoder) == readAll(reference));
+    QVERIFY(!decoder.isDecoding());
+  }
+}
+
+void AudioDecoderTest::wakeupRate() {
+  if (!hasAudioOutput()) QSKIP("There is no audio output device");
+
+  qreal rates[2];
+  for (bool use_pull : {false, true}) {
+    AudioDecoder decoder;
+    decoder.setPullMode(use_pull);
+    openNoiseFile(decoder, true);
+    QCOMPARE(decoder.isPullMode(), use_pull);
+
+    // Play the audio as it is, like AudioPlayer does
+    connect(&decoder, &AudioDecoder::bufferReady,
+            [&decoder](const QAudioBuffer& buffer) {
+      decoder.playbackDevice()->write((const char*)buffer.constData(),
+                                      buffer.byteCount());
+    });
+    decoder.play();
+    QTest::qWait(1000);
+    decoder.pause();
+    QVERIFY(decoder.position() > 500);
+
+    rates[use_pull] = decoder.wakeupRate();
+    QVERIFY(rates[use_pull] > 0);
+  }
+  QVERIFY(rates[true] < rates[false]);
+  QTest::setBenchmarkResult(rates[true], QTest::Events);
+}
+
+void AudioDecoderTest::latencyProfiles() {
+  if (!hasAudioOutput()) QSKIP("There is no audio output device");
+
+  qint64 latencies[3];
+  qreal  rates[3];
+  for (int profile = AudioDecoder::LowLatency;
+       profile <= AudioDecoder::PowerSaver; profile++) {
+    AudioDecoder decoder;
+    decoder.setLatencyProfile((AudioDecoder::LatencyProfile)profile);
+    openNoiseFile(decoder, true);
+    QCOMPARE(decoder.outputLatency(), (qint64)0);
+
+    connect(&decoder, &AudioDecoder::bufferReady,
+            [&decoder](const QAudioBuffer& buffer) {
+      decoder.playbackDevice()->write((const char*)buffer.constData(),
+                                      buffer.byteCount());
+    });
+    decoder.play();
+    QTest::qWait(1000);
+    decoder.pause();
+
+    latencies[profile] = decoder.outputLatency();
+    rates[profile]     = decoder.wakeupRate();
+    QVERIFY(latencies[profile] > 0);
+  }
+  QVERIFY(latencies[AudioDecoder::LowLatency] <
+          latencies[AudioDecoder::PowerSaver]);
+  QVERIFY(rates[AudioDecoder::PowerSaver] < rates[AudioDecoder::LowLatency]);
+  QTest::setBenchmarkResult(latencies[AudioDecoder::LowLatency],
+                            QTest::WalltimeMilliseconds);
+}
+
+void AudioDecoderTest::clock() {
+  if (!hasAudioOutput()) QSKIP("There is no audio output device");
+
+  AudioDecoder decoder;
+  openNoiseFile(decoder, true);
+  connect(&decoder, &AudioDecoder::bufferReady,
+          [&decoder](const QAudioBuffer& buffer) {
+    decoder.playbackDevice()->write((const char*)buffer.constData(),
+                                    buffer.byteCount());
+  });
+
+  // Wait until the audio is really audible
+  decoder.play();
+  QTRY_VERIFY(decoder.position() > 100);
+
+  // The clock should move in small steps, and at the speed of time
+  QElapsedTimer timer;
+  timer.start();
+  qint64 start_pos = decoder.position();
+  qint64 last_pos  = start_pos;
+  qint64 max_step  = 0;
+  while (timer.elapsed() < 1000) {
+    QTest::qWait(1);
+    qint64 pos = decoder.position();
+    QVERIFY(pos >= last_pos);
+    max_step = qMax(max_step, pos - last_pos);
+    last_pos = pos;
+  }
+  qint64 drift = (last_pos - start_pos) - timer.elapsed();
+  QVERIFY(qAbs(drift) < 50);
+  QVERIFY(max_step < 50);
+  QTest::setBenchmarkResult(max_step, QTest::WalltimeMilliseconds);
+
+  // While paused, it stands still
+  decoder.pause();
+  QTest::qWait(100);
+  qint64 paused_pos = decoder.position();
+  QTest::qWait(100);
+  QCOMPARE(decoder.position(), paused_pos);
+
+  // A seek shows right away, and the clock moves on from there
+  decoder.play();
+  decoder.setPosition(500);
+  QCOMPARE(decoder.position(), (qint64)500);
+  QTest::qWait(300);
+  QVERIFY(decoder.position() >= 500);
+  QVERIFY(decoder.position() < 1000);
+  decoder.pause();
+}
+
+void AudioDecoderTest::positionNotifications() {
+  if (!hasAudioOutput()) QSKIP("There is no audio output device");
+
+  AudioDecoder decoder;
+  decoder.setNotifyInterval(100);
+  openNoiseFile(decoder, true);
+  std::atomic<int> num_buffers(0);
+  connect(&decoder, &AudioDecoder::bufferReady,
+          [&decoder, &num_buffers](const QAudioBuffer& buffer) {
+    decoder.playbackDevice()->write((const char*)buffer.constData(),
+                                    buffer.byteCount());
+    num_buffers++;
+  });
+  QSignalSpy spy(&decoder, SIGNAL(positionChanged(qint64)));
+
+  decoder.play();
+  QTest::qWait(2000);
+  decoder.pause();
+
+  // We used to report the position for every buffer
+  QVERIFY(spy.count() > 0);
+  QVERIFY(spy.count() <= 2000 / 100 + 2);
+  QVERIFY(spy.count() < num_buffers);
+  QTest::setBenchmarkResult((qreal)spy.count() / num_buffers, QTest::Events);
+}
+
+void AudioDecoderTest::pauseLatency() {
+  if (!hasAudioOutput()) QSKIP("There is no audio output device");
+
+  AudioDecoder decoder;
+  decoder.setLatencyProfile(AudioDecoder::PowerSaver); // A large buffer
+  openNoiseFile(decoder, true);
+  connect(&decoder, &AudioDecoder::bufferReady,
+          [&decoder](const QAudioBuffer& buffer) {
+    decoder.playbackDevice()->write((const char*)buffer.constData(),
+                                    buffer.byteCount());
+  });
+  QCOMPARE(decoder.pauseLatency(), (qint64)-1);
+
+  decoder.play();
+  QTest::qWait(1000);
+  qint64 pos        = decoder.position();
+  qint64 buffer_len = decoder.outputLatency();
+  decoder.pause();
+  QTRY_VERIFY(decoder.pauseLatency() >= 0);
+  QVERIFY(decoder.pauseLatency() < 5000);
+  QTest::setBenchmarkResult(decoder.pauseLatency() / 1000.0,
+                            QTest::WalltimeMilliseconds);
+
+  // We should be back at what was audible, not a buffer ahead of it. Real
+  // devices report what they've played with some delay, so we allow for a
+  // part of the buffer.
+  QTest::qWait(100);
+  QVERIFY(qAbs(decoder.position() - pos) < qMax((qint64)100, buffer_len / 4));
+
+  // Going back to what was audible isn't a seek
+  QCOMPARE(decoder.rewindHits(), 0);
+  QCOMPARE(decoder.rewindMisses(), 0);
+  qint64 paused_pos = decoder.position();
+
+  // And we should continue from there
+  decoder.play();
+  QTest::qWait(50);
+  QVERIFY(decoder.position() >= paused_pos);
+  QVERIFY(decoder.position() < paused_pos + 100);
+  decoder.pause();
+}
+
+void AudioDecoderTest::reuseOutput() {
+  if (!hasAudioOutput()) QSKIP("There is no audio output device");
+
+  AudioDecoder decoder;
+  connect(&decoder, &AudioDecoder::bufferReady,
+          [&decoder](const QAudioBuffer& buffer) {
+    decoder.playbackDevice()->write((const char*)buffer.constData(),
+                                    buffer.byteCount());
+  });
+  QString sine_file = QString(SRCDIR) + "files/sine16.wav";
+
+  // The same format, then another format, and back again
+  QString paths[]       = {m_noise_file, m_noise_file, sine_file,
+                           m_noise_file};
+  int     num_created[] = {1, 1, 2, 3};
+  qint64  reused_latency = 0;
+  for (int i = 0; i < 4; i++) {
+    decoder.setMedia(QUrl::fromLocalFile(paths[i]));
+    decoder.play();
+    QTRY_VERIFY(decoder.openLatency() > 0);
+    QTest::qWait(100);
+    decoder.pause();
+    QCOMPARE(decoder.outputsCreated(), num_created[i]);
+    if (i == 1) reused_latency = decoder.openLatency();
+  }
+  QTest::setBenchmarkResult(reused_latency / 1000.0,
+                            QTest::WalltimeMilliseconds);
+}
+
+void AudioDecoderTest::busyGuiThread() {
+  if (!hasAudioOutput()) QSKIP("There is no audio output device");
+
+  AudioDecoder decoder;
+  openNoiseFile(decoder, true);
+  connect(&decoder, &AudioDecoder::bufferReady,
+          [&decoder](const QAudioBuffer& buffer) {
+    decoder.playbackDevice()->write((const char*)buffer.constData(),
+                                    buffer.byteCount());
+  });
+  QSignalSpy spy(&decoder, SIGNAL(positionChanged(qint64)));
+
+  decoder.play();
+  QTest::qWait(100);
+
+  // Keep the event loop of this thread from running for a while
+  qint64 start_pos = decoder.position();
+  QElapsedTimer timer;
+  timer.start();
+  while (timer.elapsed() < 1000);
+  QVERIFY(decoder.position() - start_pos > 500);
+
+  spy.clear();
+  QTest::qWait(100);
+  decoder.pause();
+  QVERIFY(spy.count() > 0);
+  QVERIFY(spy.last().at(0).toLongLong() - start_pos > 500);
+}
+
+void AudioDecoderTest::endWhileGuiThreadBusy() {
+  if (!hasAudioOutput()) QSKIP("There is no audio output device");
+
+  AudioDecoder decoder;
+  decoder.setMedia(QUrl::fromLocalFile(QString(SRCDIR) + "files/sine16.wav"));
+  connect(&decoder, &AudioDecoder::bufferReady,
+          [&decoder](const QAudioBuffer& buffer) {
+    decoder.playbackDevice()->write((const char*)buffer.constData(),
+                                    buffer.byteCount());
+  });
+  QSignalSpy spy(&decoder,
+                 SIGNAL(mediaStatusChanged(QMediaPlayer::MediaStatus)));
+
+  // The file is two seconds long, so it ends while we're busy
+  decoder.play();
+  QElapsedTimer timer;
+  timer.start();
+  while (timer.elapsed() < 3000);
+
+  QTRY_COMPARE(decoder.state(), QMediaPlayer::StoppedState);
+  QVERIFY(spy.count() > 0);
+  QCOMPARE(spy.last().at(0).value<QMediaPlayer::MediaStatus>(),
+           QMediaPlayer::EndOfMedia);
+}
+
+void AudioDecoderTest::readBenchmark_data() {
+  QTest::addColumn<bool>("use_mmap");
+
+  QTest::newRow("read") << false;
+  QTest::newRow("mmap") << true;
+}
+
+void AudioDecoderTest::readBenchmark() {
+  QFETCH(bool, use_mmap);
+
+  AudioDecoder decoder;
+  openNoiseFile(decoder, use_mmap);
+  QCOMPARE(decoder.isMemoryMapped(), use_mmap);
+
+  QBENCHMARK {
+    decoder.setPosition(0);
+    while (decoder.readBuffer(PERIOD_SIZE).isValid());
+  }
+}
+
+void AudioDecoderTest::dispatchBenchmark_data() {
+  QTest::addColumn<bool>("use_sink");
+
+  QTest::newRow("signal") << false;
+  QTest::newRow("sink")   << true;
+}
+
+void AudioDecoderTest::dispatchBenchmark() {
+  QFETCH(bool, use_sink);
+
+  QAudioFormat format;
+  format.setChannelCount(2);
+  format.setCodec("audio/pcm");
+  format.setSampleRate(44100);
+  format.setSampleSize(16);
+  format.setSampleType(QAudioFormat::SignedInt);
+
+  // This is how AudioPlayer used to receive the audio
+  AudioDecoder   decoder;
+  BufferReceiver receiver;
+  connect(&decoder,  SIGNAL(bufferReady(QAudioBuffer)),
+          &receiver, SLOT(handleBuffer(QAudioBuffer)), Qt::DirectConnection);
+  AudioDecoder::Sink* sink = &receiver;
+
+  char data[PERIOD_SIZE];
+  memset(data, 0, PERIOD_SIZE);
+  QBENCHMARK {
+    for (int i = 0; i < 1000; i++) {
+      if (use_sink) {
+        sink->processAudio(data, PERIOD_SIZE, format);
+      } else {
+        emit decoder.bufferReady(
+          QAudioBuffer(QByteArray::fromRawData(data, PERIOD_SIZE), format));
+      }
+    }
+  }
+  QVERIFY(receiver.numBytes() > 0);
+}
+
+void AudioDecoderTest::playbackCpuBenchmark_data() {
+  QTest::addColumn<bool>("use_probe");
+
+  QTest::newRow("probe")   << true;
+  QTest::newRow("decoder") << false;
+}
+
+void AudioDecoderTest::playbackCpuBenchmark() {
+  QFETCH(bool, use_probe);
+  if (!hasAudioOutput()) QSKIP("There is no audio output device");
+
+  QString path = QString::fromLocal8Bit(qgetenv("TRANSCRIBE_BENCHMARK_FILE"));
+  if (path.isEmpty()) path = QString(SRCDIR) + "files/stereo.flac";
+  const int MAX_PLAY_TIME = 10000;
+
+  // The old way: the probed audio is played by an output of our own
+  QMediaPlayer  player;
+  QAudioProbe   probe;
+  QAudioOutput* output        = NULL;
+  QIODevice*    output_device = NULL;
+  connect(&probe, &QAudioProbe::audioBufferProbed,
+          [&player, &output, &output_device](const QAudioBuffer& buffer) {
+    if (!output) {
+      output        = new QAudioOutput(buffer.format(), &player);
+      output_device = output->start();
+    }
+    output_device->write((const char*)buffer.constData(), buffer.byteCount());
+  });
+
+  // The new way, playing the audio like AudioPlayer does
+  AudioDecoder decoder;
+  connect(&decoder, &AudioDecoder::bufferReady,
+          [&decoder](const QAudioBuffer& buffer) {
+    decoder.playbackDevice()->write((const char*)buffer.constData(),
+                                    buffer.byteCount());
+  });
+
+  std::clock_t start_clock = std::clock();
+  QElapsedTimer timer;
+  timer.start();
+  qint64 played = 0;
+  if (use_probe) {
+    if (!probe.setSource(&player)) {
+      QSKIP("Audio probes aren't supported on this platform");
+    }
+    player.setVolume(0);
+    player.setMedia(QUrl::fromLocalFile(path));
+    player.play();
+    while (player.mediaStatus() != QMediaPlayer::EndOfMedia &&
+           timer.elapsed() < MAX_PLAY_TIME) {
+      QTest::qWait(10);
+      played = qMax(played, player.position());
+    }
+  } else {
+    decoder.setMedia(QUrl::fromLocalFile(path));
+    QTRY_VERIFY(decoder.mediaStatus() == QMediaPlayer::LoadedMedia);
+    QVERIFY(decoder.isIntercepting());
+    decoder.play();
+    while (decoder.mediaStatus() != QMediaPlayer::EndOfMedia &&
+           timer.elapsed() < MAX_PLAY_TIME) {
+      QTest::qWait(10);
+      played = qMax(played, decoder.position());
+    }
+  }
+  qreal cpu_time = (std::clock() - start_clock) * 1000.0 / CLOCKS_PER_SEC;
+  QVERIFY(played > 0);
+
+  QTest::setBenchmarkResult(cpu_time * 3600000.0 / played,
+                            QTest::WalltimeMilliseconds);
+}
@@ -0,0 +1,196 @@
+#ifndef AUDIODECODERTEST_H
+#define AUDIODECODERTEST_H
+
+#include <QObject>
+
+#include <QAudioDeviceInfo>
+#include <QAudioOutput>
+#include <QAudioProbe>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QStandardPaths>
+#include <QString>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QtEndian>
+#include <QtTest>
+
+#include <ctime>
+
+#include "audiodecoder.h"
+#include "seekindex.h"
+
+/** Counts the audio data it gets through the bufferReady() signal or as an
+ *  AudioDecoder::Sink, for comparing the two. */
+class BufferReceiver : public QObject, public AudioDecoder::Sink {
+  Q_OBJECT
+
+public:
+  void prepare(const QAudioFormat&) override {}
+
+  void processAudio(char*, int num_bytes, const QAudioFormat&) override {
+    m_num_bytes += num_bytes;
+  }
+
+  qint64 numBytes() const {return m_num_bytes;}
+
+public slots:
+  void handleBuffer(const QAudioBuffer& buffer) {
+    m_num_bytes += buffer.byteCount();
+  }
+
+private:
+  qint64 m_num_bytes = 0;
+};
+
+class AudioDecoderTest : public QObject {
+  Q_OBJECT
+
+public:
+  AudioDecoderTest(QObject* parent = 0);
+
+private:
+  // The path to a wav file containing 5+ seconds of pink noise
+  QString m_noise_file;
+
+  // The number of bytes we read at once, roughly the period size of a typical
+  // audio device.
+  const int PERIOD_SIZE = 4096;
+
+  /** Open the noise file natively, with or without memory mapping, and with
+   *  the given read-ahead time. */
+  void openNoiseFile(AudioDecoder& decoder, bool use_mmap,
+                     int read_ahead_time = 0);
+
+  /** Create a sparse wav file of the given size at path, with a recognizable
+   *  pattern at the position of marker_time (in ms). The file is 16 bit stereo
+   *  at 44.1 kHz, and uses the RF64 format if requested.
+   *  @return the pattern, or an empty array if the file couldn't be created. */
+  QByteArray createLargeFile(const QString& path, qint64 data_size,
+                             bool is_rf64, qint64 marker_time);
+
+  /** Read all audio data from the current position onwards and return it. If
+   *  the decoder is reading ahead, wait for the data to become available. */
+  QByteArray readAll(AudioDecoder& decoder);
+
+  /** Indicate whether there is an audio output device. The tests that play
+   *  audio are skipped if there isn't, like on a headless build server. */
+  static bool hasAudioOutput();
+
+private Q_SLOTS:
+  /** Memory mapped and regular reading of a wav file should yield the same
+   *  data and timing. */
+  void memoryMapping();
+
+  /** Seeking should work the same with and without memory mapping. */
+  void seekMemoryMapped();
+
+  /** When reading ahead, we should get the same data as without, both from the
+   *  start and after seeking. */
+  void readAhead();
+
+  /** The read-ahead buffer should fill up by itself, and reading what's in it
+   *  shouldn't be counted as a stall. */
+  void readAheadFillLevel();
+
+  /** Skipping back within the recently played audio should be served from
+   *  memory right away, with the same data, and should be counted as a hit.
+   *  Skipping beyond it should be counted as a miss. */
+  void rewindCache_data();
+  void rewindCache();
+
+  /** 24 bit, 32 bit and floating point wav files, with or without extensible
+   *  format chunk, should be parsed natively and be handed out as 16 bit data.
+   *  All test files contain the same sine wave. */
+  void formats_data();
+  void formats();
+
+  /** Files larger than 2 GB, both regular RIFF files (up to 4 GB) and RF64
+   *  files, should have the right duration, and seeking to a position near the
+   *  end should yield the data at that position. */
+  void largeFiles_data();
+  void largeFiles();
+
+  /** Cue points with their labels and the recording time from the bext chunk
+   *  should be available, also when these chunks are spread out over the
+   *  file. */
+  void metaData();
+
+  /** Compressed files should be decoded only once in the background, and
+   *  should yield the same data as the wav file they were made from, both from
+   *  the start and after seeking. */
+  void decode_data();
+  void decode();
+
+  /** A seek index should find the last entry at or before a position, and it
+   *  should only be loaded for the file it was made for, as long as that file
+   *  doesn't change. */
+  void seekIndex();
+
+  /** The first time a FLAC file is decoded, a seek index should be stored.
+   *  The next time, seeking right after opening should yield the same data
+   *  as the wav file it was made from. */
+  void decodeWithIndex_data();
+  void decodeWithIndex();
+
+  /** Both in pull and in push mode, playback should advance, and the audio
+   *  output should wake us up less often in pull mode. The number of wakeups
+   *  per second in pull mode is reported. */
+  void wakeupRate();
+
+  /** A profile with a larger buffer should have a higher latency and fewer
+   *  wakeups. The latency that the low latency profile achieves is reported,
+   *  in ms. */
+  void latencyProfiles();
+
+  /** While playing, the clock should keep up with the wall clock, and it
+   *  should stand still while paused. After a seek, it should start from the
+   *  new position right away. Its largest step is reported, in ms. */
+  void clock();
+
+  /** While playing, the position should be reported at the notify interval,
+   *  rather than for every period of audio. The number of notifications per
+   *  period is reported. */
+  void positionNotifications();
+
+  /** A pause should silence the audio output within a few ms, and the
+   *  position should go back to what was audible, rather than what was
+   *  read, without counting as a seek for the rewind cache. The latency is
+   *  reported, in ms. */
+  void pauseLatency();
+
+  /** The audio output should be reused for a file with the same format, but
+   *  not for a file with another format. The open latency of a reused output
+   *  is reported, in ms. */
+  void reuseOutput();
+
+  /** Playback should carry on while the GUI thread is busy, and the position
+   *  should be reported once it isn't anymore. */
+  void busyGuiThread();
+
+  /** The end of the audio should be reported, also when the GUI thread was
+   *  too busy to notice it when it happened. */
+  void endWhileGuiThreadBusy();
+
+  /** Compare the time it takes to read a complete file with and without memory
+   *  mapping. */
+  void readBenchmark_data();
+  void readBenchmark();
+
+  /** Compare the cost of handing a period of audio to the player with the
+   *  bufferReady() signal and with the AudioDecoder::Sink interface. */
+  void dispatchBenchmark_data();
+  void dispatchBenchmark();
+
+  /** Measure the CPU time that an hour of playback of a compressed file
+   *  takes, the way it used to be played (a muted QMediaPlayer with a
+   *  QAudioProbe that feeds another audio output) and with AudioDecoder. The
+   *  result is in ms per hour of audio. The file is taken from the
+   *  TRANSCRIBE_BENCHMARK_FILE environment variable, so that it can be a long
+   *  MP3 file; otherwise a FLAC test file is used, which we decode ourselves.
+   */
+  void playbackCpuBenchmark_data();
+  void playbackCpuBenchmark();
+};
+
+#endif // AUDIODECODERTEST_H
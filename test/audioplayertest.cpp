@@ -132,22 +132,32 @@ void AudioPlayerTest::toggleWaiting() {
 }
 
 /** Test if the positionChangedSignal is emitted during playback and if the
- *  position is reported correctly. */
+ *  position is reported correctly. The signal should only be emitted when the
+ *  position in whole seconds changes, while the position in ms is updated at
+ *  the refresh rate. */
 void AudioPlayerTest::positionChangedSignal() {
   QSignalSpy spy(m_player, SIGNAL(positionChanged()));
+  QSignalSpy ms_spy(m_player, SIGNAL(positionMsChanged()));
   m_player->togglePlayPause(true);
   QTest::qWait(100);
   int num_signals = spy.count();
-  QVERIFY(num_signals > 1); // At least one signal because of play start
+  QCOMPARE(num_signals, 0); // We're still at 0 seconds
 
-  // Play for 1100 ms. This should emit exactly one signal since the 'starting
-  // signals'
+  // Play for 1100 ms. This should emit exactly one signal, when the position
+  // goes to 1 second
   QTest::qWait(1100);
   QCOMPARE(spy.count(), num_signals + 1); // Position changed signal
 
   m_player->togglePlayPause(false);
-  QCOMPARE(spy.count(), num_signals + 2); // Signal because of play stop
+  QCOMPARE(spy.count(), num_signals + 1); // Still at 1 second
   QCOMPARE((int)m_player->getPosition(), 1); // Position should be at 1 second
+
+  // About 12 updates at the default of 10 per second, where there used to be
+  // one for every period of audio. The whole seconds change far less often.
+  QVERIFY(ms_spy.count() >= 6);
+  QVERIFY(ms_spy.count() <= 16);
+  QVERIFY(spy.count() < ms_spy.count());
+  QTest::setBenchmarkResult(ms_spy.count(), QTest::Events);
 }
 
 /** Test for seeking and position changed signal changed signal. */
@@ -237,6 +247,38 @@ void AudioPlayerTest::setPosition() {
   QCOMPARE(m_player->getState(), AudioPlayer::PAUSED);
 }
 
+/** A burst of seeks, like from dragging the position slider, should only lead
+ *  to a few actual seeks, while the position is updated right away. */
+void AudioPlayerTest::seekCoalescing() {
+  AudioPlayer player;
+  player.openFile(m_noise_file);
+  QTest::qWait(200);
+  QCOMPARE(player.seekCount(), 0);
+
+  QSignalSpy spy(&player, SIGNAL(positionChanged()));
+  for (int i = 0; i < 100; i++) {
+    player.setPosition(i % 6);
+    QCOMPARE((int)player.getPosition(), i % 6);
+  }
+  QVERIFY(spy.count() >= 99); // The first one doesn't change the position
+
+  // Only the first and the last one should be carried out
+  QTest::qWait(200);
+  QVERIFY(player.seekCount() <= 2);
+  QCOMPARE((int)player.getPosition(), 3);
+
+  // Skips should add up, even if they're held back
+  int num_seeks = player.seekCount();
+  player.setPosition(0);
+  for (int i = 0; i < 5; i++) {
+    player.skipSeconds(1);
+  }
+  QCOMPARE((int)player.getPosition(), 5);
+  QTest::qWait(200);
+  QVERIFY(player.seekCount() <= num_seeks + 2);
+  QCOMPARE((int)player.getPosition(), 5);
+}
+
 /** Test if durations and positions are properly rounded to whole seconds. */
 void AudioPlayerTest::timeRounding() {
   // Our test file takes 5.8 seconds, which should round the result to 6
@@ -326,3 +368,135 @@ void AudioPlayerTest::stateTransitions() {
   QCOMPARE(player.getState(), AudioPlayer::PAUSED);
   QCOMPARE(spy.count(), 7);
 }
+
+/** Once playing, the audio thread should read, boost and play back the audio
+ *  without allocating any memory, also after skipping back within the rewind
+ *  cache. */
+void AudioPlayerTest::steadyStateAllocations() {
+  if (QAudioDeviceInfo::defaultOutputDevice().isNull()) {
+    QSKIP("There is no audio output device");
+  }
+
+  AudioPlayer player;
+  player.openFile(m_noise_file);
+  QTest::qWait(200);
+  player.boost(true);
+  player.togglePlayPause(true);
+
+  // The first periods may set things up
+  QTest::qWait(500);
+  QIODevice* device = player.m_decoder.playbackDevice();
+  QVERIFY(device != NULL);
+
+  AllocationCounter counter(device);
+  QTest::qWait(2000);
+  QCOMPARE(counter.numAllocations(), 0);
+
+  AllocationCounter rewind_counter(device);
+  player.skipSeconds(-2);
+  QTest::qWait(1000);
+  QCOMPARE(rewind_counter.numAllocations(), 0);
+  QVERIFY(player.m_decoder.rewindHits() > 0);
+
+  player.togglePlayPause(false);
+}
+
+/** A seek far beyond what QAudioDecoder has decoded leaves the file to the
+ *  QMediaPlayer. If its audio can be probed, it should still be boosted, and
+ *  otherwise the player should say that it can't boost anymore. Whether the
+ *  decoder has gotten that far depends on the machine, so we leave the file
+ *  to the QMediaPlayer directly. */
+void AudioPlayerTest::boostAfterFarSeek() {
+  if (QAudioDeviceInfo::defaultOutputDevice().isNull()) {
+    QSKIP("There is no audio output device");
+  }
+
+  QString flac_file = QString(SRCDIR);
+  flac_file += "files/stereo.flac";
+
+  AudioPlayer player;
+  QSignalSpy error_spy(&player, SIGNAL(error(const QString&)));
+  player.openFile(flac_file);
+  QTRY_VERIFY(player.isAvailable());
+  QVERIFY(player.m_decoder.isIntercepting());
+  player.boost(true);
+
+  // The buffers are sent from the audio thread
+  std::atomic<int> num_buffers(0);
+  connect(&player.m_decoder, &AudioDecoder::bufferReady,
+          [&num_buffers](const QAudioBuffer&) {num_buffers++;});
+  player.m_decoder.leaveToMediaPlayer(1000);
+  if (!player.m_decoder.isIntercepting()) {
+    QCOMPARE(player.canBoost(), false);
+    QCOMPARE(error_spy.count(), 1);
+    QSKIP("The QMediaPlayer can't be probed on this platform");
+  }
+
+  QTRY_VERIFY(player.m_decoder.mediaStatus() == QMediaPlayer::LoadedMedia ||
+              player.m_decoder.mediaStatus() == QMediaPlayer::BufferedMedia);
+  player.togglePlayPause(true);
+  QTRY_VERIFY(num_buffers > 0);
+  QTRY_VERIFY(player.getPositionMs() > 1000);
+  player.togglePlayPause(false);
+
+  // The audio still goes through the booster
+  QVERIFY(player.canBoost());
+  QCOMPARE(player.m_sonic_booster.level(), 1);
+  QCOMPARE(error_spy.count(), 0);
+}
+
+/** If the SonicBooster can't amplify the format of the file, the boost should
+ *  be reset with a single error. This is found out in the audio thread, but
+ *  it should be handled in the GUI thread. */
+void AudioPlayerTest::unboostableFormat() {
+  AudioPlayer player;
+  QSignalSpy error_spy(&player, SIGNAL(error(const QString&)));
+  QSignalSpy can_boost_spy(&player, SIGNAL(canBoostChanged()));
+  player.m_can_boost = true;
+  player.m_sonic_booster.increaseLevel();
+
+  QAudioFormat format;
+  format.setCodec("audio/pcm");
+  format.setChannelCount(2);
+  format.setSampleRate(44100);
+  format.setSampleSize(32);
+  format.setSampleType(QAudioFormat::Float);
+  player.prepare(format);
+  QCOMPARE(error_spy.count(), 0);
+  QCOMPARE(can_boost_spy.count(), 0);
+
+  QTRY_COMPARE(error_spy.count(), 1);
+  QCOMPARE(can_boost_spy.count(), 1);
+  QCOMPARE(player.canBoost(), false);
+  QCOMPARE(player.m_sonic_booster.level(), 0);
+
+  // Boosting isn't possible anymore
+  player.boost(true);
+  QCOMPARE(player.m_sonic_booster.level(), 0);
+}
+
+/** The refresh rate should be kept within its limits, set the notify interval
+ *  of the decoder and be stored in the settings. */
+void AudioPlayerTest::refreshRate() {
+  AudioPlayer player;
+  int original_rate = player.getRefreshRate();
+  QSignalSpy spy(&player, SIGNAL(refreshRateChanged()));
+
+  player.setRefreshRate(original_rate == 20 ? 25 : 20);
+  QCOMPARE(spy.count(), 1);
+  int rate = player.getRefreshRate();
+  QCOMPARE(player.m_decoder.notifyInterval(), 1000 / rate);
+  player.setRefreshRate(rate);
+  QCOMPARE(spy.count(), 1); // Nothing changed
+
+  // A new player picks it up from the settings
+  AudioPlayer other_player;
+  QCOMPARE(other_player.getRefreshRate(), rate);
+
+  player.setRefreshRate(1000);
+  QCOMPARE(player.getRefreshRate(), (int)AudioPlayer::REFRESH_RATE_MAX);
+  player.setRefreshRate(0);
+  QCOMPARE(player.getRefreshRate(), (int)AudioPlayer::REFRESH_RATE_MIN);
+
+  player.setRefreshRate(original_rate);
+}
@@ -1,10 +1,12 @@
 #ifndef TST_AUDIOPLAYERTEST_H
 #define TST_AUDIOPLAYERTEST_H
 
+#include <QAudioDeviceInfo>
 #include <QDir>
 #include <QtTest>
 #include <QSignalSpy>
 
+#include "allocationcounter.h"
 #include "audioplayer.h"
 
 class AudioPlayerTest : public QObject {
@@ -32,8 +34,13 @@ private Q_SLOTS:
   void positionChangedSignal();
   void seek();
   void setPosition();
+  void seekCoalescing();
   void timeRounding();
   void stateTransitions();
+  void steadyStateAllocations();
+  void boostAfterFarSeek();
+  void unboostableFormat();
+  void refreshRate();
 };
 
 #endif // TST_AUDIOPLAYERTEST_H
@@ -134,6 +134,42 @@ void KeyCatcherTest::testAudioSeekWithArrows() {
   }
 }
 
+/** Test if we can skip to the previous and next marker with Alt+PageUp and
+ *  Alt+PageDown. */
+void KeyCatcherTest::testMarkerSkipWithPageKeys() {
+  QList<Qt::KeyboardModifiers> valid_modifiers;
+  valid_modifiers.append(Qt::AltModifier);
+  QList<Qt::KeyboardModifiers> invalid_modifiers = getInvalidModifiers(valid_modifiers);
+
+  QSignalSpy spy(m_catcher, SIGNAL(skipToMarker(bool)));
+
+  QKeyEvent event_up(QEvent::KeyPress, Qt::Key_PageUp, Qt::AltModifier);
+  QApplication::sendEvent(m_root, &event_up);
+  QCOMPARE(spy.count(), 1);
+  QCOMPARE(spy.last().at(0).toBool(), false);
+  QCOMPARE(m_key_typed_spy->count(), 0);
+
+  QKeyEvent event_down(QEvent::KeyPress, Qt::Key_PageDown, Qt::AltModifier);
+  QApplication::sendEvent(m_root, &event_down);
+  QCOMPARE(spy.count(), 2);
+  QCOMPARE(spy.last().at(0).toBool(), true);
+  QCOMPARE(m_key_typed_spy->count(), 0);
+
+  // Test if other modifiers are ignored
+  int key_typed = 0;
+  QList<Qt::KeyboardModifiers>::iterator imod;
+  for (imod = invalid_modifiers.begin(); imod != invalid_modifiers.end(); imod++) {
+    QKeyEvent event_up(QEvent::KeyPress, Qt::Key_PageUp, *imod);
+    QApplication::sendEvent(m_root, &event_up);
+    QCOMPARE(spy.count(), 2);
+    QCOMPARE(m_key_typed_spy->count(), ++key_typed);
+    QKeyEvent event_down(QEvent::KeyPress, Qt::Key_PageDown, *imod);
+    QApplication::sendEvent(m_root, &event_down);
+    QCOMPARE(spy.count(), 2);
+    QCOMPARE(m_key_typed_spy->count(), ++key_typed);
+  }
+}
+
 /** Test if we can control the audio stopping and pausing with the hardware
  *  audio keys. */
 void KeyCatcherTest::testAudioPlayPauseWithAudioKeys() {
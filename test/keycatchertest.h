@@ -29,6 +29,7 @@ private Q_SLOTS:
   void testCtrlS();
   void testAudioPlayPauseWithSpace();
   void testAudioSeekWithArrows();
+  void testMarkerSkipWithPageKeys();
   void testAudioPlayPauseWithAudioKeys();
   void testAudioSeekWithAudioKeys();
   void testModifiersOnAudioAudioKeys();
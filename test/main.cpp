@@ -6,6 +6,7 @@
 #include "keycatchertest.h"
 #include "historymodeltest.h"
 #include "transcribetest.h"
+#include "audiodecodertest.h"
 
 int main(int argc, char** argv) {
   QApplication app(argc, argv);
@@ -15,6 +16,7 @@ int main(int argc, char** argv) {
   QTest::qExec(new KeyCatcherTest(), argc, argv);
   QTest::qExec(new HistoryModelTest(), argc, argv);
   QTest::qExec(new TranscribeTest(), argc, argv);
+  QTest::qExec(new AudioDecoderTest(), argc, argv);
 
  return app.exec();
 }
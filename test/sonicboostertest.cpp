@@ -10,6 +10,49 @@ SonicBoosterTest::SonicBoosterTest() {
     m_booster_m_6->decreaseLevel();
     m_booster_p_6->increaseLevel();
   }
+
+  m_format16.setChannelCount(1);
+  m_format16.setCodec("audio/pcm");
+  m_format16.setSampleRate(44100);
+  m_format16.setSampleSize(16);
+  m_format16.setSampleType(QAudioFormat::SignedInt);
+}
+
+std::vector<qint16> SonicBoosterTest::getSamples(int num_samples, int peak) {
+  std::vector<qint16> samples(num_samples);
+  for (int i = 0; i < num_samples; i++) {
+    samples[i] = (qint16)((qint64)(i * 7919 % num_samples) * 2 * peak /
+                          num_samples - peak);
+  }
+  return samples;
+}
+
+qreal SonicBoosterTest::histogramFactor(qreal factor, const qint16* data,
+                                        int num_samples) {
+  const int max = std::numeric_limits<qint16>::max();
+  m_spectrogram.resize(max + 2);
+
+  // Create a reverse cumulative count of the number of samples for the
+  // relevant part of the spectrum
+  int cutoff = max / factor;
+  for (int i = cutoff; i <= max + 1; i++) {
+    m_spectrogram[i] = 0;
+  }
+  for (int i = 0; i < num_samples; i++) {
+    m_spectrogram[abs((int)data[i])]++;
+  }
+  for (int i = max; i > cutoff - 1; i--) {
+    m_spectrogram[i] += m_spectrogram[i + 1];
+  }
+
+  // Step down the boost factor until less than five percent is clipped. It
+  // used to go below 1.0 for audio that's clipped already.
+  int fraction = num_samples / 20;
+  while (m_spectrogram[cutoff] > fraction && factor > 1.0) {
+    factor -= 0.1;
+    cutoff = max / factor;
+  }
+  return qMax((qreal)1.0, factor);
 }
 
 template<class word_type> QAudioBuffer SonicBoosterTest::getBuffer() {
@@ -134,3 +177,382 @@ void SonicBoosterTest::unsigned16Data() {
   QCOMPARE((int)boosted1_5[1], (1 << 15) + (int)(200 * m_boost_factor_p_6));
   QCOMPARE((int)boosted1_5[2], (1 << 15) - (int)(200 * m_boost_factor_p_6));
 }
+
+void SonicBoosterTest::destinationBuffer_data() {
+  QTest::addColumn<int>("sample_size");
+  QTest::addColumn<int>("sample_type");
+
+  QTest::newRow("signed 8")    << 8  << (int)QAudioFormat::SignedInt;
+  QTest::newRow("unsigned 8")  << 8  << (int)QAudioFormat::UnSignedInt;
+  QTest::newRow("signed 16")   << 16 << (int)QAudioFormat::SignedInt;
+  QTest::newRow("unsigned 16") << 16 << (int)QAudioFormat::UnSignedInt;
+}
+
+void SonicBoosterTest::destinationBuffer() {
+  QFETCH(int, sample_size);
+  QFETCH(int, sample_type);
+
+  QAudioFormat format;
+  format.setChannelCount(1);
+  format.setCodec("audio/pcm");
+  format.setSampleRate(44100);
+  format.setSampleSize(sample_size);
+  format.setSampleType((QAudioFormat::SampleType)sample_type);
+
+  // Every pattern of bytes makes valid samples
+  QByteArray data(2000, Qt::Uninitialized);
+  for (int i = 0; i < data.size(); i++) {
+    data[i] = (char)((i * 97) % 251);
+  }
+
+  foreach (SonicBooster* booster, QList<SonicBooster*>() << m_booster_m_6
+                                                         << m_booster_p_6) {
+    QVERIFY(booster->boost(data.constData(), data.size(), format));
+    int         size;
+    const char* boosted = booster->getBoostedBuffer(size);
+    QCOMPARE(size, data.size());
+    QByteArray expected(boosted, size);
+
+    QByteArray out(data.size(), Qt::Uninitialized);
+    QVERIFY(booster->boost(data.constData(), out.data(), data.size(),
+                           format));
+    QVERIFY(out == expected);
+
+    QByteArray in_place(data.constData(), data.size());
+    char*      in_place_data = in_place.data();
+    QVERIFY(booster->boost(in_place_data, in_place_data, in_place.size(),
+                           format));
+    QVERIFY(in_place == expected);
+  }
+
+  // Without a boost factor, the data isn't touched
+  SonicBooster booster;
+  QByteArray out(data.size(), 0);
+  QVERIFY(!booster.boost(data.constData(), out.data(), data.size(), format));
+  QVERIFY(out == QByteArray(data.size(), 0));
+}
+
+void SonicBoosterTest::steadyStateAllocations() {
+  QAudioFormat format;
+  format.setChannelCount(2);
+  format.setCodec("audio/pcm");
+  format.setSampleRate(44100);
+  format.setSampleSize(16);
+  format.setSampleType(QAudioFormat::SignedInt);
+
+  QAudioBuffer buffer(1024, format);
+  qint16* raw_data = (qint16*)buffer.data();
+  for (int i = 0; i < buffer.sampleCount(); i++) {
+    raw_data[i] = (qint16)((i * 37) % 2000 - 1000);
+  }
+
+  // The first buffer sizes the internal buffer
+  SonicBooster booster;
+  booster.increaseLevel();
+  QVERIFY(booster.boost(buffer));
+
+  AllocationCounter counter;
+  for (int i = 0; i < 100; i++) {
+    QVERIFY(booster.boost(buffer));
+  }
+  QCOMPARE(counter.numAllocations(), 0);
+}
+
+void SonicBoosterTest::preparedFormat() {
+  const int NUM_SAMPLES = 1000;
+  std::vector<qint16> data = getSamples(NUM_SAMPLES, 20000);
+  std::vector<qint16> out(NUM_SAMPLES), expected(NUM_SAMPLES);
+
+  SonicBooster booster;
+  QVERIFY(booster.setFormat(m_format16));
+
+  // Nothing to do at 0 dB
+  QVERIFY(!booster.boost((const char*)data.data(), (char*)out.data(),
+                         NUM_SAMPLES * 2));
+
+  booster.increaseLevel();
+  booster.increaseLevel();
+  QVERIFY(booster.boost((const char*)data.data(), (char*)out.data(),
+                        NUM_SAMPLES * 2));
+  QVERIFY(m_booster_p_6->boost((const char*)data.data(),
+                               (char*)expected.data(), NUM_SAMPLES * 2,
+                               m_format16));
+  QVERIFY(out != expected);
+
+  for (int i = 0; i < 4; i++) booster.increaseLevel();
+  QVERIFY(booster.boost((const char*)data.data(), (char*)out.data(),
+                        NUM_SAMPLES * 2));
+  QVERIFY(out == expected);
+
+  // Formats that can't be boosted are left alone
+  QAudioFormat float_format = m_format16;
+  float_format.setSampleSize(32);
+  float_format.setSampleType(QAudioFormat::Float);
+  QVERIFY(!booster.setFormat(float_format));
+  QVERIFY(!booster.boost((const char*)data.data(), (char*)out.data(),
+                         NUM_SAMPLES * 2));
+}
+
+void SonicBoosterTest::unsignedLikeSigned_data() {
+  QTest::addColumn<int>("sample_size");
+  QTest::addColumn<int>("level");
+
+  QTest::newRow("8 bit, +6 dB")   << 8  << 6;
+  QTest::newRow("8 bit, -6 dB")   << 8  << -6;
+  QTest::newRow("16 bit, +6 dB")  << 16 << 6;
+  QTest::newRow("16 bit, +20 dB") << 16 << 20;
+}
+
+void SonicBoosterTest::unsignedLikeSigned() {
+  QFETCH(int, sample_size);
+  QFETCH(int, level);
+
+  QAudioFormat signed_format = m_format16;
+  signed_format.setSampleSize(sample_size);
+  QAudioFormat unsigned_format = signed_format;
+  unsigned_format.setSampleType(QAudioFormat::UnSignedInt);
+
+  SonicBooster booster;
+  for (int i = 0; i < qAbs(level); i++) {
+    if (level > 0) booster.increaseLevel();
+    else           booster.decreaseLevel();
+  }
+
+  // Loud enough for the boost factor to be limited
+  QByteArray signed_data(4001, Qt::Uninitialized);
+  for (int i = 0; i < signed_data.size(); i++) {
+    signed_data[i] = (char)((i * 97) % 251);
+  }
+  int num_bytes = signed_data.size() - signed_data.size() % (sample_size / 8);
+
+  // Flipping the sign bit of each sample makes it unsigned
+  int        msb           = sample_size / 8 - 1;
+  QByteArray unsigned_data = signed_data;
+  for (int i = msb; i < num_bytes; i += sample_size / 8) {
+    unsigned_data[i] = unsigned_data[i] ^ (char)0x80;
+  }
+
+  QByteArray signed_out(num_bytes, 0), unsigned_out(num_bytes, 0);
+  QVERIFY(booster.boost(signed_data.constData(), signed_out.data(),
+                        num_bytes, signed_format));
+  QVERIFY(booster.boost(unsigned_data.constData(), unsigned_out.data(),
+                        num_bytes, unsigned_format));
+  for (int i = msb; i < num_bytes; i += sample_size / 8) {
+    unsigned_out[i] = unsigned_out[i] ^ (char)0x80;
+  }
+  QVERIFY(unsigned_out == signed_out);
+}
+
+void SonicBoosterTest::gainKernels_data() {
+  QTest::addColumn<int>("type");
+
+  for (int type = GainKernel::SSE2; type <= GainKernel::NEON; type++) {
+    QTest::newRow(GainKernel::name((GainKernel::Type)type)) << type;
+  }
+}
+
+void SonicBoosterTest::gainKernels() {
+  QFETCH(int, type);
+  GainKernel::Type kernel = (GainKernel::Type)type;
+  if (!GainKernel::isSupported(kernel)) {
+    QSKIP("This kernel isn't supported on this CPU");
+  }
+
+  // Odd sizes leave samples that don't fill a whole vector
+  const int   sizes[]   = {0, 1, 7, 8, 15, 16, 17, 33, 1000, 4099};
+  // The last factor would overflow a qint32 before capping
+  const qreal factors[] = {0.0316, 0.5, 0.999, 1.0001, 1.4125, 1.995, 3.3,
+                           17.8, 1000.0, 1e6};
+  qsrand(42);
+  foreach (int size, sizes) {
+    std::vector<qint8>   data8(size),  expected8(size),  out8(size);
+    std::vector<qint16>  data16(size), expected16(size), out16(size);
+    std::vector<quint16> udata16(size), uexpected16(size), uout16(size);
+    for (int i = 0; i < size; i++) {
+      data8[i]   = (qint8)qrand();
+      data16[i]  = (qint16)qrand();
+      udata16[i] = (quint16)qrand();
+    }
+    if (size >= 2) {
+      data8[0]  = std::numeric_limits<qint8>::min();
+      data8[1]  = std::numeric_limits<qint8>::max();
+      data16[0] = std::numeric_limits<qint16>::min();
+      data16[1] = std::numeric_limits<qint16>::max();
+    }
+
+    foreach (qreal factor, factors) {
+      GainKernel::apply(GainKernel::Scalar, data8.data(), expected8.data(),
+                        size, factor);
+      GainKernel::apply(kernel, data8.data(), out8.data(), size, factor);
+      QVERIFY(out8 == expected8);
+
+      GainKernel::apply(GainKernel::Scalar, data16.data(), expected16.data(),
+                        size, factor);
+      GainKernel::apply(kernel, data16.data(), out16.data(), size, factor);
+      QVERIFY(out16 == expected16);
+
+      // In place too
+      out16 = data16;
+      GainKernel::apply(kernel, out16.data(), out16.data(), size, factor);
+      QVERIFY(out16 == expected16);
+
+      GainKernel::apply(GainKernel::Scalar, udata16.data(),
+                        uexpected16.data(), size, factor);
+      GainKernel::apply(kernel, udata16.data(), uout16.data(), size, factor);
+      QVERIFY(uout16 == uexpected16);
+    }
+  }
+}
+
+template<typename word_type>
+int SonicBoosterTest::fixedPointError(int num_samples, qreal factor) {
+  std::vector<word_type> data(num_samples), expected(num_samples),
+                         out(num_samples);
+  for (int i = 0; i < num_samples; i++) {
+    data[i] = (word_type)qrand();
+  }
+  if (num_samples >= 2) {
+    data[0] = std::numeric_limits<word_type>::min();
+    data[1] = std::numeric_limits<word_type>::max();
+  }
+
+  GainKernel::apply(GainKernel::Scalar, data.data(), expected.data(),
+                    num_samples, factor);
+  GainKernel::apply(GainKernel::FixedPoint, data.data(), out.data(),
+                    num_samples, factor);
+
+  int max_error = 0;
+  for (int i = 0; i < num_samples; i++) {
+    max_error = qMax(max_error, qAbs((int)out[i] - (int)expected[i]));
+  }
+  return max_error;
+}
+
+void SonicBoosterTest::fixedPoint() {
+  QVERIFY(GainKernel::isSupported(GainKernel::FixedPoint));
+
+  const qreal factors[] = {0.0316, 0.5, 0.999, 1.0, 1.0001, 1.4125, 1.995,
+                           3.3, 17.8, 1000.0};
+  qsrand(42);
+  foreach (qreal factor, factors) {
+    QVERIFY(fixedPointError<qint8>(1000, factor)   <= 1);
+    QVERIFY(fixedPointError<quint8>(1000, factor)  <= 1);
+    QVERIFY(fixedPointError<qint16>(1000, factor)  <= 1);
+    QVERIFY(fixedPointError<quint16>(1000, factor) <= 1);
+  }
+
+  // A unity gain shouldn't change anything at all
+  QVERIFY(fixedPointError<qint16>(1000, 1.0) == 0);
+
+  // And the same for a booster that uses it, at +6 dB
+  SonicBooster booster;
+  booster.setGainKernel(GainKernel::FixedPoint);
+  QCOMPARE(booster.gainKernel(), GainKernel::FixedPoint);
+  for (int i = 0; i < 6; i++) booster.increaseLevel();
+  m_booster_p_6->setGainKernel(GainKernel::Scalar);
+
+  std::vector<qint16> data = getSamples(4096, 10000);
+  std::vector<qint16> expected(data.size()), out(data.size());
+  QVERIFY(m_booster_p_6->boost((const char*)data.data(),
+                               (char*)expected.data(), data.size() * 2,
+                               m_format16));
+  QVERIFY(booster.boost((const char*)data.data(), (char*)out.data(),
+                        data.size() * 2, m_format16));
+  m_booster_p_6->setGainKernel(GainKernel::best());
+  for (size_t i = 0; i < data.size(); i++) {
+    QVERIFY(qAbs((int)out[i] - (int)expected[i]) <= 1);
+  }
+}
+
+void SonicBoosterTest::gainEstimation_data() {
+  QTest::addColumn<int>("level");
+  QTest::addColumn<int>("peak");
+
+  QTest::newRow("quiet")       << 6  << 3000;
+  QTest::newRow("moderate")    << 6  << 20000;
+  QTest::newRow("loud")        << 6  << 32767;
+  QTest::newRow("very loud")   << 20 << 32767;
+  QTest::newRow("small boost") << 1  << 32767;
+  QTest::newRow("attenuate")   << -6 << 32767;
+}
+
+void SonicBoosterTest::gainEstimation() {
+  QFETCH(int, level);
+  QFETCH(int, peak);
+
+  SonicBooster booster;
+  for (int i = 0; i < qAbs(level); i++) {
+    if (level > 0) booster.increaseLevel();
+    else           booster.decreaseLevel();
+  }
+
+  foreach (int num_samples, QList<int>() << 19 << 1000 << 4096) {
+    std::vector<qint16> data = getSamples(num_samples, peak);
+    std::vector<qint16> out(num_samples), expected(num_samples);
+    QVERIFY(booster.boost((const char*)data.data(), (char*)out.data(),
+                          num_samples * 2, m_format16));
+
+    qreal factor = qPow(10.0, level / 20.0);
+    if (factor > 1.0) {
+      factor = histogramFactor(factor, data.data(), num_samples);
+    }
+    GainKernel::apply(GainKernel::Scalar, data.data(), expected.data(),
+                      num_samples, factor);
+    QVERIFY(out == expected);
+  }
+}
+
+void SonicBoosterTest::gainEstimationBenchmark_data() {
+  QTest::addColumn<bool>("use_histogram");
+
+  QTest::newRow("histogram") << true;
+  QTest::newRow("selection") << false;
+}
+
+void SonicBoosterTest::gainEstimationBenchmark() {
+  QFETCH(bool, use_histogram);
+
+  const int NUM_SAMPLES = 4096;
+  std::vector<qint16> data = getSamples(NUM_SAMPLES, 32767);
+  std::vector<qint16> out(NUM_SAMPLES);
+
+  QBENCHMARK {
+    if (use_histogram) {
+      qreal factor = histogramFactor(m_boost_factor_p_6, data.data(),
+                                     NUM_SAMPLES);
+      GainKernel::apply(GainKernel::best(), data.data(), out.data(),
+                        NUM_SAMPLES, factor);
+    } else {
+      m_booster_p_6->boost((const char*)data.data(), (char*)out.data(),
+                           NUM_SAMPLES * 2, m_format16);
+    }
+  }
+}
+
+void SonicBoosterTest::gainKernelBenchmark_data() {
+  QTest::addColumn<int>("type");
+
+  for (int type = GainKernel::Scalar; type <= GainKernel::FixedPoint; type++) {
+    QTest::newRow(GainKernel::name((GainKernel::Type)type)) << type;
+  }
+}
+
+void SonicBoosterTest::gainKernelBenchmark() {
+  QFETCH(int, type);
+  GainKernel::Type kernel = (GainKernel::Type)type;
+  if (!GainKernel::isSupported(kernel)) {
+    QSKIP("This kernel isn't supported on this CPU");
+  }
+
+  // About 100 ms of stereo audio, boosted by 6 dB
+  const int NUM_SAMPLES = 8192;
+  std::vector<qint16> data(NUM_SAMPLES), out(NUM_SAMPLES);
+  for (int i = 0; i < NUM_SAMPLES; i++) {
+    data[i] = (qint16)((i * 37) % 20000 - 10000);
+  }
+
+  QBENCHMARK {
+    GainKernel::apply(kernel, data.data(), out.data(), NUM_SAMPLES,
+                      m_boost_factor_p_6);
+  }
+}
@@ -8,6 +8,8 @@
 
 #include <limits>
 
+#include "allocationcounter.h"
+#include "gainkernel.h"
 #include "sonicbooster.h"
 
 class SonicBoosterTest : public QObject {
@@ -31,12 +33,71 @@ private:
 
   template<class word_type> QAudioBuffer getBuffer();
 
+  // The format of the 16 bit test buffers
+  QAudioFormat m_format16;
+
+  /** Fill a buffer with num_samples 16 bit samples, evenly spread between
+   *  -peak and peak. */
+  std::vector<qint16> getSamples(int num_samples, int peak);
+
+  /** The way SonicBooster used to limit the boost factor, with a histogram
+   *  of all sample magnitudes. */
+  qreal histogramFactor(qreal factor, const qint16* data, int num_samples);
+  std::vector<int> m_spectrogram;
+
+  /** Boost num_samples random samples with the FixedPoint and the Scalar
+   *  kernel, and return the largest difference between the two. */
+  template<typename word_type>
+  int fixedPointError(int num_samples, qreal factor);
+
 private Q_SLOTS:
   void unsigned8Data();
   void signed8Data();
   void signed16Data();
   void unsigned16Data();
 
+  /** Boosting into a buffer of our own and in place should give the same
+   *  result as boosting into the internal buffer. */
+  void destinationBuffer_data();
+  void destinationBuffer();
+
+  /** Boosting buffers of the same size over and over again shouldn't
+   *  allocate memory. */
+  void steadyStateAllocations();
+
+  /** Once the format is set, audio should be boosted like when the format
+   *  is passed along, and changes to the level should be picked up. */
+  void preparedFormat();
+
+  /** Unsigned audio should be boosted exactly like the same audio in signed
+   *  form. */
+  void unsignedLikeSigned_data();
+  void unsignedLikeSigned();
+
+  /** All supported gain kernels should give exactly the same results as the
+   *  scalar one, for any buffer size and for signed and unsigned data. */
+  void gainKernels_data();
+  void gainKernels();
+
+  /** The FixedPoint kernel may be one off from the scalar one, but no more;
+   *  also when SonicBooster uses it. */
+  void fixedPoint();
+
+  /** The boost factor should be limited like it was with the histogram, so
+   *  that the output is the same. */
+  void gainEstimation_data();
+  void gainEstimation();
+
+  /** Compare the time it takes to boost a loud 16 bit buffer with the
+   *  histogram and with the current estimation. */
+  void gainEstimationBenchmark_data();
+  void gainEstimationBenchmark();
+
+  /** Measure the time each gain kernel takes for a block of 16 bit
+   *  samples. */
+  void gainKernelBenchmark_data();
+  void gainKernelBenchmark();
+
   //void adjustFactorForCapping();
 };
 